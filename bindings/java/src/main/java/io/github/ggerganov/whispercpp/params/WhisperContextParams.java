@@ -40,6 +40,18 @@ public class WhisperContextParams extends Structure {
     /** DTW memory size (internal use) */
     public NativeLong dtw_mem_size;
 
+    /** KV cache data types as ggml_type values (default = GGML_TYPE_F16) */
+    public int type_k_self;
+    public int type_v_self;
+    public int type_k_cross;
+    public int type_v_cross;
+
+    /** [EXPERIMENTAL] Keep the decoder graph and replay it while its shape does not change (default = true) */
+    public CBool decode_graph_reuse;
+
+    /** [EXPERIMENTAL] NUMA strategy of the CPU backend as a ggml_numa_strategy value (default = 0, disabled) */
+    public int numa;
+
     /** Use GPU for inference */
     public void useGpu(boolean enable) {
         use_gpu = enable ? CBool.TRUE : CBool.FALSE;
@@ -50,6 +62,11 @@ public class WhisperContextParams extends Structure {
         flash_attn = enable ? CBool.TRUE : CBool.FALSE;
     }
 
+    /** Reuse the decoder graph between decode steps */
+    public void useDecodeGraphReuse(boolean enable) {
+        decode_graph_reuse = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
     /** Enable DTW token-level timestamps */
     public void enableDtwTokenTimestamps(boolean enable) {
         dtw_token_timestamps = enable ? CBool.TRUE : CBool.FALSE;
@@ -70,7 +87,13 @@ public class WhisperContextParams extends Structure {
             "dtw_aheads_preset",
             "dtw_n_top",
             "dtw_aheads",
-            "dtw_mem_size"
+            "dtw_mem_size",
+            "type_k_self",
+            "type_v_self",
+            "type_k_cross",
+            "type_v_cross",
+            "decode_graph_reuse",
+            "numa"
         );
     }
 
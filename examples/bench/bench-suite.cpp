@@ -0,0 +1,650 @@
+// Per-stage benchmark of the whisper and parakeet pipelines
+//
+// Runs every stage separately over a set of thread counts and audio lengths and writes the
+// results as JSON or CSV with percentiles, so that they can be tracked and compared over time.
+//
+#include "common-whisper.h"
+
+#include "whisper.h"
+#include "parakeet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// command-line parameters
+struct bench_params {
+    std::vector<int>   n_threads = { std::min(4, (int32_t) std::thread::hardware_concurrency()) };
+    std::vector<float> audio_s   = { 10.0f, 30.0f };
+
+    int32_t n_rep     = 5;   // measured repetitions per configuration
+    int32_t n_warmup  = 1;   // discarded repetitions per configuration
+    int32_t n_prompt  = 224; // tokens in the prompt decode
+    int32_t n_gen     = 32;  // single-token decoder calls per repetition
+    int32_t n_batch   = 5;   // tokens in the batched decode
+    int32_t beam_size = 5;
+
+    std::string model          = "models/ggml-base.en.bin";
+    std::string model_parakeet = "";
+    std::string model_vad      = "";
+    std::string fname_inp      = "samples/jfk.wav";
+    std::string fname_out      = "";
+    std::string format         = "json";
+    std::string dtw            = "";
+
+    bool use_gpu    = true;
+    bool flash_attn = true;
+    bool verbose    = false;
+};
+
+static std::vector<std::string> split(const std::string & s, char delim) {
+    std::vector<std::string> res;
+    size_t start = 0;
+    while (true) {
+        const size_t end = s.find(delim, start);
+        res.push_back(s.substr(start, end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return res;
+}
+
+static void bench_print_usage(int /*argc*/, char ** argv, const bench_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,        --help              [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,...,  --threads N,...     [%-7d] comma-separated list of thread counts\n",       params.n_threads[0]);
+    fprintf(stderr, "  -l S,...,  --lengths S,...     [%-7s] comma-separated list of audio lengths in seconds\n", "10,30");
+    fprintf(stderr, "  -r N,      --repetitions N     [%-7d] measured repetitions per configuration\n",      params.n_rep);
+    fprintf(stderr, "  -w N,      --warmup N          [%-7d] warmup repetitions per configuration\n",        params.n_warmup);
+    fprintf(stderr, "  -np N,     --n-prompt N        [%-7d] number of tokens in the prompt decode\n",       params.n_prompt);
+    fprintf(stderr, "  -n N,      --n-gen N           [%-7d] number of single-token decoder calls\n",        params.n_gen);
+    fprintf(stderr, "  -nb N,     --n-batch N         [%-7d] number of tokens in the batched decode\n",      params.n_batch);
+    fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for the beam search run\n",           params.beam_size);
+    fprintf(stderr, "  -m FNAME,  --model FNAME       [%-7s] whisper model path\n",                          params.model.c_str());
+    fprintf(stderr, "  -pm FNAME, --parakeet-model F  [%-7s] parakeet model path (optional)\n",              params.model_parakeet.c_str());
+    fprintf(stderr, "  -vm FNAME, --vad-model FNAME   [%-7s] VAD model path (optional)\n",                   params.model_vad.c_str());
+    fprintf(stderr, "  -dtw MODEL --dtw MODEL         [%-7s] DTW alignment heads preset (optional)\n",       params.dtw.c_str());
+    fprintf(stderr, "  -f FNAME,  --file FNAME        [%-7s] input audio, repeated or cut to each length\n", params.fname_inp.c_str());
+    fprintf(stderr, "  -o FMT,    --output FMT        [%-7s] output format (json, csv)\n",                   params.format.c_str());
+    fprintf(stderr, "  -of FNAME, --output-file FNAME [%-7s] output file (default: stdout)\n",               params.fname_out.c_str());
+    fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
+    fprintf(stderr, "  -fa,       --flash-attn        [%-7s] enable flash attention\n",                      params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -nfa,      --no-flash-attn     [%-7s] disable flash attention\n",                     params.flash_attn ? "false" : "true");
+    fprintf(stderr, "  -v,        --verbose           [%-7s] print the library logs\n",                      params.verbose ? "true" : "false");
+    fprintf(stderr, "\n");
+}
+
+static char * requires_value_error(const std::string & arg) {
+    fprintf(stderr, "error: argument %s requires value\n", arg.c_str());
+    exit(1);
+}
+
+static bool bench_params_parse(int argc, char ** argv, bench_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            bench_print_usage(argc, argv, params);
+            exit(0);
+        }
+        #define ARGV_NEXT (((i + 1) < argc) ? argv[++i] : requires_value_error(arg))
+        else if (arg == "-t" || arg == "--threads") {
+            params.n_threads.clear();
+            for (const auto & s : split(ARGV_NEXT, ',')) {
+                params.n_threads.push_back(std::stoi(s));
+            }
+        }
+        else if (arg == "-l" || arg == "--lengths") {
+            params.audio_s.clear();
+            for (const auto & s : split(ARGV_NEXT, ',')) {
+                params.audio_s.push_back(std::stof(s));
+            }
+        }
+        else if (arg == "-r"   || arg == "--repetitions")    { params.n_rep          = std::stoi(ARGV_NEXT); }
+        else if (arg == "-w"   || arg == "--warmup")         { params.n_warmup       = std::stoi(ARGV_NEXT); }
+        else if (arg == "-np"  || arg == "--n-prompt")       { params.n_prompt       = std::stoi(ARGV_NEXT); }
+        else if (arg == "-n"   || arg == "--n-gen")          { params.n_gen          = std::stoi(ARGV_NEXT); }
+        else if (arg == "-nb"  || arg == "--n-batch")        { params.n_batch        = std::stoi(ARGV_NEXT); }
+        else if (arg == "-bs"  || arg == "--beam-size")      { params.beam_size      = std::stoi(ARGV_NEXT); }
+        else if (arg == "-m"   || arg == "--model")          { params.model          = ARGV_NEXT; }
+        else if (arg == "-pm"  || arg == "--parakeet-model") { params.model_parakeet = ARGV_NEXT; }
+        else if (arg == "-vm"  || arg == "--vad-model")      { params.model_vad      = ARGV_NEXT; }
+        else if (arg == "-dtw" || arg == "--dtw")            { params.dtw            = ARGV_NEXT; }
+        else if (arg == "-f"   || arg == "--file")           { params.fname_inp      = ARGV_NEXT; }
+        else if (arg == "-o"   || arg == "--output")         { params.format         = ARGV_NEXT; }
+        else if (arg == "-of"  || arg == "--output-file")    { params.fname_out      = ARGV_NEXT; }
+        else if (arg == "-ng"  || arg == "--no-gpu")         { params.use_gpu        = false; }
+        else if (arg == "-fa"  || arg == "--flash-attn")     { params.flash_attn     = true; }
+        else if (arg == "-nfa" || arg == "--no-flash-attn")  { params.flash_attn     = false; }
+        else if (arg == "-v"   || arg == "--verbose")        { params.verbose        = true; }
+        #undef ARGV_NEXT
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            bench_print_usage(argc, argv, params);
+            return false;
+        }
+    }
+
+    if (params.format != "json" && params.format != "csv") {
+        fprintf(stderr, "error: unknown output format '%s'\n", params.format.c_str());
+        return false;
+    }
+
+    if (params.n_threads.empty() || params.audio_s.empty() || params.n_rep <= 0) {
+        fprintf(stderr, "error: nothing to benchmark\n");
+        return false;
+    }
+
+    return true;
+}
+
+// the measurements of a single stage for one configuration
+struct bench_result {
+    std::string backend;
+    std::string stage;
+
+    int   n_threads;
+    float audio_s;
+
+    std::vector<double> ms;
+};
+
+struct bench_stats {
+    double mean;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+// percentile with linear interpolation between the closest ranks
+static double bench_percentile(const std::vector<double> & sorted, double p) {
+    if (sorted.size() == 1) {
+        return sorted[0];
+    }
+
+    const double idx = p*(sorted.size() - 1);
+    const size_t i0  = (size_t) std::floor(idx);
+    const size_t i1  = std::min(i0 + 1, sorted.size() - 1);
+
+    return sorted[i0] + (idx - i0)*(sorted[i1] - sorted[i0]);
+}
+
+static bench_stats bench_compute_stats(std::vector<double> ms) {
+    std::sort(ms.begin(), ms.end());
+
+    double sum = 0.0;
+    for (double v : ms) {
+        sum += v;
+    }
+
+    return {
+        /*.mean =*/ sum/ms.size(),
+        /*.min  =*/ ms.front(),
+        /*.p50  =*/ bench_percentile(ms, 0.50),
+        /*.p90  =*/ bench_percentile(ms, 0.90),
+        /*.p99  =*/ bench_percentile(ms, 0.99),
+        /*.max  =*/ ms.back(),
+    };
+}
+
+// collects the measurements of all stages, keyed by (backend, stage, n_threads, audio_s)
+struct bench_recorder {
+    std::vector<bench_result> results;
+
+    bool enabled = true; // false during warmup
+
+    void add(const char * backend, const char * stage, int n_threads, float audio_s, double ms) {
+        if (!enabled) {
+            return;
+        }
+
+        for (auto & r : results) {
+            if (r.backend == backend && r.stage == stage && r.n_threads == n_threads && r.audio_s == audio_s) {
+                r.ms.push_back(ms);
+                return;
+            }
+        }
+
+        results.push_back({ backend, stage, n_threads, audio_s, { ms } });
+    }
+};
+
+static double bench_elapsed_ms(int64_t t_start_us) {
+    return 1e-3*(ggml_time_us() - t_start_us);
+}
+
+// repeat or cut the input audio to the requested length
+static std::vector<float> bench_make_audio(const std::vector<float> & pcmf32, float audio_s) {
+    const size_t n_samples = (size_t) (audio_s*WHISPER_SAMPLE_RATE);
+
+    std::vector<float> res(n_samples);
+    for (size_t i = 0; i < n_samples; ++i) {
+        res[i] = pcmf32[i % pcmf32.size()];
+    }
+
+    return res;
+}
+
+static bool bench_whisper(
+        whisper_context * ctx,
+   whisper_vad_context * vctx,
+    const bench_params & params,
+    const std::vector<float> & pcmf32,
+                   int   n_threads,
+                 float   audio_s,
+        bench_recorder & rec) {
+    const char * backend = "whisper";
+
+    std::vector<whisper_token> tokens(std::max(params.n_prompt, params.n_batch) + 1, whisper_token_sot(ctx));
+
+    const int n_text_ctx = whisper_n_text_ctx(ctx);
+    const int n_prompt   = std::min(params.n_prompt, n_text_ctx/2);
+    const int n_gen      = std::min(params.n_gen,    n_text_ctx - n_prompt - 1);
+
+    // mel
+    {
+        whisper_reset_timings(ctx);
+
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_pcm_to_mel(ctx, pcmf32.data(), pcmf32.size(), n_threads) != 0) {
+            fprintf(stderr, "error: failed to compute the log mel spectrogram\n");
+            return false;
+        }
+        rec.add(backend, "mel", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+    }
+
+    // conv, encoder and cross-attention KV - every 30 s window of the audio is encoded
+    {
+        const int n_len    = whisper_n_len(ctx);
+        const int n_window = 2*whisper_n_audio_ctx(ctx); // mel frames per window
+
+        whisper_reset_timings(ctx);
+
+        const int64_t t_start_us = ggml_time_us();
+        for (int offset = 0; offset < n_len; offset += n_window) {
+            if (whisper_encode(ctx, offset, n_threads) != 0) {
+                fprintf(stderr, "error: failed to encode\n");
+                return false;
+            }
+        }
+        const double t_total_ms = bench_elapsed_ms(t_start_us);
+
+        whisper_timings * timings = whisper_get_timings(ctx);
+
+        // the stage times are averaged over the windows - report them as totals, like the encode row
+        const double t_conv_ms   = timings->conv_ms *timings->n_encode;
+        const double t_cross_ms  = timings->cross_ms*timings->n_encode;
+        const double t_encode_ms = timings->t_encode_us*1e-3;
+
+        rec.add(backend, "conv",    n_threads, audio_s, t_conv_ms);
+        rec.add(backend, "encoder", n_threads, audio_s, t_encode_ms - t_conv_ms - t_cross_ms);
+        rec.add(backend, "cross",   n_threads, audio_s, t_cross_ms);
+        rec.add(backend, "encode",  n_threads, audio_s, t_total_ms);
+
+        delete timings;
+    }
+
+    // prompt
+    {
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_decode(ctx, tokens.data(), n_prompt, 0, n_threads) != 0) {
+            fprintf(stderr, "error: failed to decode the prompt\n");
+            return false;
+        }
+        rec.add(backend, "prompt", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+    }
+
+    // single-token decoding
+    for (int i = 0; i < n_gen; ++i) {
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_decode(ctx, tokens.data(), 1, n_prompt + i, n_threads) != 0) {
+            fprintf(stderr, "error: failed to decode\n");
+            return false;
+        }
+        rec.add(backend, "decode", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+    }
+
+    // batched decoding
+    {
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_decode(ctx, tokens.data(), params.n_batch, n_prompt, n_threads) != 0) {
+            fprintf(stderr, "error: failed to decode the batch\n");
+            return false;
+        }
+        rec.add(backend, "batchd", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+    }
+
+    // full transcription with greedy sampling - per token sampling and DTW are only measured here
+    {
+        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+        wparams.n_threads        = n_threads;
+        wparams.print_progress   = false;
+        wparams.print_timestamps = false;
+        wparams.temperature_inc  = 0.0f;
+
+        whisper_reset_timings(ctx);
+
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            fprintf(stderr, "error: failed to run whisper_full (greedy)\n");
+            return false;
+        }
+        rec.add(backend, "full_greedy", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+
+        whisper_timings * timings = whisper_get_timings(ctx);
+
+        rec.add(backend, "sample", n_threads, audio_s, timings->sample_ms);
+        if (!params.dtw.empty()) {
+            rec.add(backend, "dtw", n_threads, audio_s, timings->dtw_ms);
+        }
+
+        delete timings;
+    }
+
+    // full transcription with beam search - the decoder runs one batch with all beams per step
+    if (params.beam_size > 1) {
+        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH);
+
+        wparams.n_threads             = n_threads;
+        wparams.print_progress        = false;
+        wparams.print_timestamps      = false;
+        wparams.temperature_inc       = 0.0f;
+        wparams.beam_search.beam_size = params.beam_size;
+
+        whisper_reset_timings(ctx);
+
+        const int64_t t_start_us = ggml_time_us();
+        if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            fprintf(stderr, "error: failed to run whisper_full (beam search)\n");
+            return false;
+        }
+        rec.add(backend, "full_beam", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+
+        whisper_timings * timings = whisper_get_timings(ctx);
+
+        rec.add(backend, "beam_decode", n_threads, audio_s, timings->batchd_ms);
+
+        delete timings;
+    }
+
+    // VAD
+    if (vctx) {
+        const int64_t t_start_us = ggml_time_us();
+        if (!whisper_vad_detect_speech(vctx, pcmf32.data(), pcmf32.size())) {
+            fprintf(stderr, "error: failed to detect speech\n");
+            return false;
+        }
+        rec.add("vad", "detect_speech", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+    }
+
+    return true;
+}
+
+static bool bench_parakeet(
+      parakeet_context * pctx,
+                   int   n_threads,
+                 float   audio_s,
+    const std::vector<float> & pcmf32,
+        bench_recorder & rec) {
+    const char * backend = "parakeet";
+
+    parakeet_full_params pparams = parakeet_full_default_params(PARAKEET_SAMPLING_GREEDY);
+
+    pparams.n_threads = n_threads;
+
+    parakeet_reset_timings(pctx);
+
+    const int64_t t_start_us = ggml_time_us();
+    if (parakeet_full(pctx, pparams, pcmf32.data(), pcmf32.size()) != 0) {
+        fprintf(stderr, "error: failed to run parakeet_full\n");
+        return false;
+    }
+    rec.add(backend, "full", n_threads, audio_s, bench_elapsed_ms(t_start_us));
+
+    parakeet_timings * timings = parakeet_get_timings(pctx);
+
+    rec.add(backend, "mel",     n_threads, audio_s, timings->mel_ms);
+    rec.add(backend, "encode",  n_threads, audio_s, timings->encode_ms);
+    rec.add(backend, "predict", n_threads, audio_s, timings->predict_ms);
+    rec.add(backend, "joint",   n_threads, audio_s, timings->decode_ms);
+    rec.add(backend, "sample",  n_threads, audio_s, timings->sample_ms);
+
+    delete timings;
+
+    return true;
+}
+
+static std::string bench_json_escape(const std::string & str) {
+    std::string res;
+    for (const char c : str) {
+        switch (c) {
+            case '"':  res += "\\\""; break;
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n";  break;
+            case '\r': res += "\\r";  break;
+            case '\t': res += "\\t";  break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    res += buf;
+                } else {
+                    res += c;
+                }
+        }
+    }
+    return res;
+}
+
+static void bench_write_json(FILE * f, const bench_params & params, const bench_recorder & rec) {
+    fprintf(f, "{\n");
+    fprintf(f, "  \"system_info\": \"%s\",\n", bench_json_escape(whisper_print_system_info()).c_str());
+    fprintf(f, "  \"model\": \"%s\",\n", bench_json_escape(params.model).c_str());
+    fprintf(f, "  \"model_parakeet\": \"%s\",\n", bench_json_escape(params.model_parakeet).c_str());
+    fprintf(f, "  \"input\": \"%s\",\n", bench_json_escape(params.fname_inp).c_str());
+    fprintf(f, "  \"flash_attn\": %s,\n", params.flash_attn ? "true" : "false");
+    fprintf(f, "  \"results\": [\n");
+    for (size_t i = 0; i < rec.results.size(); ++i) {
+        const auto & r = rec.results[i];
+        const auto   s = bench_compute_stats(r.ms);
+
+        fprintf(f, "    { \"backend\": \"%s\", \"stage\": \"%s\", \"n_threads\": %d, \"audio_s\": %.2f, \"n\": %d, "
+                   "\"mean_ms\": %.4f, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+                r.backend.c_str(), r.stage.c_str(), r.n_threads, r.audio_s, (int) r.ms.size(),
+                s.mean, s.min, s.p50, s.p90, s.p99, s.max, i + 1 < rec.results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+}
+
+static void bench_write_csv(FILE * f, const bench_recorder & rec) {
+    fprintf(f, "backend,stage,n_threads,audio_s,n,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,max_ms\n");
+    for (const auto & r : rec.results) {
+        const auto s = bench_compute_stats(r.ms);
+
+        fprintf(f, "%s,%s,%d,%.2f,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                r.backend.c_str(), r.stage.c_str(), r.n_threads, r.audio_s, (int) r.ms.size(),
+                s.mean, s.min, s.p50, s.p90, s.p99, s.max);
+    }
+}
+
+static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
+
+int main(int argc, char ** argv) {
+    ggml_backend_load_all();
+
+    bench_params params;
+
+    if (!bench_params_parse(argc, argv, params)) {
+        return 1;
+    }
+
+    if (!params.verbose) {
+        whisper_log_set(cb_log_disable, NULL);
+        parakeet_log_set(cb_log_disable, NULL);
+    }
+
+    std::vector<float> pcmf32;
+    std::vector<std::vector<float>> pcmf32s;
+
+    if (!read_audio_data(params.fname_inp, pcmf32, pcmf32s, false) || pcmf32.empty()) {
+        fprintf(stderr, "error: failed to read audio file '%s'\n", params.fname_inp.c_str());
+        return 2;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    if (!params.dtw.empty()) {
+        const struct {
+            const char * name;
+            whisper_alignment_heads_preset preset;
+        } presets[] = {
+            { "tiny",           WHISPER_AHEADS_TINY           },
+            { "tiny.en",        WHISPER_AHEADS_TINY_EN        },
+            { "base",           WHISPER_AHEADS_BASE           },
+            { "base.en",        WHISPER_AHEADS_BASE_EN        },
+            { "small",          WHISPER_AHEADS_SMALL          },
+            { "small.en",       WHISPER_AHEADS_SMALL_EN       },
+            { "medium",         WHISPER_AHEADS_MEDIUM         },
+            { "medium.en",      WHISPER_AHEADS_MEDIUM_EN      },
+            { "large.v1",       WHISPER_AHEADS_LARGE_V1       },
+            { "large.v2",       WHISPER_AHEADS_LARGE_V2       },
+            { "large.v3",       WHISPER_AHEADS_LARGE_V3       },
+            { "large.v3.turbo", WHISPER_AHEADS_LARGE_V3_TURBO },
+        };
+
+        cparams.dtw_token_timestamps = true;
+        cparams.dtw_aheads_preset    = WHISPER_AHEADS_NONE;
+
+        for (const auto & p : presets) {
+            if (params.dtw == p.name) {
+                cparams.dtw_aheads_preset = p.preset;
+            }
+        }
+
+        if (cparams.dtw_aheads_preset == WHISPER_AHEADS_NONE) {
+            fprintf(stderr, "error: unknown DTW preset '%s'\n", params.dtw.c_str());
+            return 2;
+        }
+    }
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 3;
+    }
+
+    // the number of VAD threads is fixed at init - one VAD context per swept thread count
+    std::vector<whisper_vad_context *> vctxs(params.n_threads.size(), nullptr);
+    if (!params.model_vad.empty()) {
+        for (size_t i = 0; i < params.n_threads.size(); ++i) {
+            struct whisper_vad_context_params vparams = whisper_vad_default_context_params();
+
+            vparams.n_threads = params.n_threads[i];
+            vparams.use_gpu   = params.use_gpu;
+
+            vctxs[i] = whisper_vad_init_from_file_with_params(params.model_vad.c_str(), vparams);
+            if (vctxs[i] == nullptr) {
+                fprintf(stderr, "error: failed to initialize VAD context\n");
+                for (auto * vctx : vctxs) {
+                    whisper_vad_free(vctx);
+                }
+                whisper_free(ctx);
+                return 3;
+            }
+        }
+    }
+
+    struct parakeet_context * pctx = nullptr;
+    if (!params.model_parakeet.empty()) {
+        struct parakeet_context_params pparams = parakeet_context_default_params();
+
+        pparams.use_gpu = params.use_gpu;
+
+        pctx = parakeet_init_from_file_with_params(params.model_parakeet.c_str(), pparams);
+        if (pctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize parakeet context\n");
+            for (auto * vctx : vctxs) {
+                whisper_vad_free(vctx);
+            }
+            whisper_free(ctx);
+            return 3;
+        }
+    }
+
+    fprintf(stderr, "system_info: %s\n", whisper_print_system_info());
+
+    bench_recorder rec;
+
+    int ret = 0;
+
+    for (const float audio_s : params.audio_s) {
+        const std::vector<float> pcm = bench_make_audio(pcmf32, audio_s);
+
+        for (size_t it = 0; it < params.n_threads.size(); ++it) {
+            const int n_threads = params.n_threads[it];
+
+            fprintf(stderr, "%s: audio = %6.2f s, n_threads = %d\n", __func__, audio_s, n_threads);
+
+            for (int i = 0; i < params.n_warmup + params.n_rep && ret == 0; ++i) {
+                rec.enabled = i >= params.n_warmup;
+
+                if (!bench_whisper(ctx, vctxs[it], params, pcm, n_threads, audio_s, rec)) {
+                    ret = 4;
+                }
+
+                if (pctx && ret == 0 && !bench_parakeet(pctx, n_threads, audio_s, pcm, rec)) {
+                    ret = 4;
+                }
+            }
+        }
+    }
+
+    if (ret == 0) {
+        FILE * f = stdout;
+        if (!params.fname_out.empty()) {
+            f = fopen(params.fname_out.c_str(), "w");
+            if (f == nullptr) {
+                fprintf(stderr, "error: failed to open '%s' for writing\n", params.fname_out.c_str());
+                ret = 5;
+            }
+        }
+
+        if (f) {
+            if (params.format == "json") {
+                bench_write_json(f, params, rec);
+            } else {
+                bench_write_csv(f, rec);
+            }
+
+            if (f != stdout) {
+                fclose(f);
+            }
+        }
+    }
+
+    if (pctx) {
+        parakeet_free(pctx);
+    }
+    for (auto * vctx : vctxs) {
+        whisper_vad_free(vctx);
+    }
+    whisper_free(ctx);
+
+    return ret;
+}
@@ -44,6 +44,7 @@ struct whisper_params {
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
+    int32_t n_draft       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).speculative.n_draft;
 
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
@@ -58,8 +59,11 @@ struct whisper_params {
     bool detect_language = false;
     bool diarize         = false;
     bool tinydiarize     = false;
+    bool multi_channel   = false;
     bool split_on_word   = false;
     bool no_fallback     = false;
+    bool fallback_exit   = false;
+    bool fallback_resume = false;
     bool output_txt      = false;
     bool output_vtt      = false;
     bool output_srt      = false;
@@ -77,6 +81,7 @@ struct whisper_params {
     bool log_score       = false;
     bool use_gpu         = true;
     bool flash_attn      = true;
+    bool graph_reuse     = true;
     int32_t gpu_device   = 0;
     bool suppress_nst    = false;
     bool carry_initial_prompt = false;
@@ -85,6 +90,7 @@ struct whisper_params {
     std::string prompt;
     std::string font_path = "/System/Library/Fonts/Supplemental/Courier New Bold.ttf";
     std::string model     = "models/ggml-base.en.bin";
+    std::string model_draft;
     std::string grammar;
     std::string grammar_rule;
 
@@ -98,6 +104,21 @@ struct whisper_params {
 
     std::string dtw = "";
 
+    std::string fname_trace;
+
+    // KV cache types (self-attention and cross-attention)
+    std::string cache_type_k_self  = "f16";
+    std::string cache_type_v_self  = "f16";
+    std::string cache_type_k_cross = "f16";
+    std::string cache_type_v_cross = "f16";
+
+    std::string numa = "disabled";
+
+    // [EXPERIMENTAL] ggml threadpool - created only when one of these is set
+    std::string cpu_mask;
+    bool        cpu_strict = false;
+    int32_t     poll       = -1;
+
     std::vector<std::string> fname_inp = {};
     std::vector<std::string> fname_out = {};
 
@@ -124,6 +145,48 @@ static char * whisper_param_turn_lowercase(char * in){
     return in;
 }
 
+static ggml_type whisper_param_cache_type(const std::string & name) {
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q4_0 }) {
+        if (name == ggml_type_name(type)) {
+            return type;
+        }
+    }
+
+    return GGML_TYPE_COUNT;
+}
+
+// [EXPERIMENTAL] hex mask of the CPUs of the threadpool, the lowest bit is CPU 0
+static bool whisper_param_cpu_mask(const std::string & mask, bool * cpumask) {
+    std::string hex = mask;
+    if (hex.rfind("0x", 0) == 0 || hex.rfind("0X", 0) == 0) {
+        hex = hex.substr(2);
+    }
+
+    if (hex.empty()) {
+        return false;
+    }
+
+    const int n = hex.size();
+    for (int i = 0; i < n; ++i) {
+        const char c = tolower(hex[n - 1 - i]);
+
+        int v = 0;
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else {
+            return false;
+        }
+
+        for (int b = 0; b < 4 && 4*i + b < GGML_MAX_N_THREADS; ++b) {
+            cpumask[4*i + b] = (v >> b) & 1;
+        }
+    }
+
+    return true;
+}
+
 static char * requires_value_error(const std::string & arg) {
     fprintf(stderr, "error: argument %s requires value\n", arg.c_str());
     exit(0);
@@ -176,8 +239,11 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-tr"   || arg == "--translate")            { params.translate       = true; }
         else if (arg == "-di"   || arg == "--diarize")              { params.diarize         = true; }
         else if (arg == "-tdrz" || arg == "--tinydiarize")          { params.tinydiarize     = true; }
+        else if (arg == "-mch"  || arg == "--multi-channel")        { params.multi_channel   = true; }
         else if (arg == "-sow"  || arg == "--split-on-word")        { params.split_on_word   = true; }
         else if (arg == "-nf"   || arg == "--no-fallback")          { params.no_fallback     = true; }
+        else if (arg == "-fee"  || arg == "--fallback-early-exit")  { params.fallback_exit   = true; }
+        else if (arg == "-fr"   || arg == "--fallback-resume")      { params.fallback_resume = true; }
         else if (arg == "-otxt" || arg == "--output-txt")           { params.output_txt      = true; }
         else if (arg == "-ovtt" || arg == "--output-vtt")           { params.output_vtt      = true; }
         else if (arg == "-osrt" || arg == "--output-srt")           { params.output_srt      = true; }
@@ -199,14 +265,26 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (                  arg == "--prompt")               { params.prompt          = ARGV_NEXT; }
         else if (                  arg == "--carry-initial-prompt") { params.carry_initial_prompt = true; }
         else if (arg == "-m"    || arg == "--model")                { params.model           = ARGV_NEXT; }
+        else if (arg == "-md"   || arg == "--model-draft")          { params.model_draft     = ARGV_NEXT; }
+        else if (                  arg == "--draft-max")            { params.n_draft         = std::stoi(ARGV_NEXT); }
         else if (arg == "-f"    || arg == "--file")                 { params.fname_inp.emplace_back(ARGV_NEXT); }
         else if (arg == "-oved" || arg == "--ov-e-device")          { params.openvino_encode_device = ARGV_NEXT; }
         else if (arg == "-dtw"  || arg == "--dtw")                  { params.dtw             = ARGV_NEXT; }
+        else if (arg == "-ctk"  || arg == "--cache-type-k")         { params.cache_type_k_self  = ARGV_NEXT; }
+        else if (arg == "-ctv"  || arg == "--cache-type-v")         { params.cache_type_v_self  = ARGV_NEXT; }
+        else if (arg == "-ctkx" || arg == "--cache-type-k-cross")   { params.cache_type_k_cross = ARGV_NEXT; }
+        else if (arg == "-ctvx" || arg == "--cache-type-v-cross")   { params.cache_type_v_cross = ARGV_NEXT; }
         else if (arg == "-ls"   || arg == "--log-score")            { params.log_score       = true; }
+        else if (                  arg == "--trace")                { params.fname_trace     = ARGV_NEXT; }
         else if (arg == "-ng"   || arg == "--no-gpu")               { params.use_gpu         = false; }
         else if (arg == "-dev"  || arg == "--device")               { params.gpu_device      = std::stoi(ARGV_NEXT); }
         else if (arg == "-fa"   || arg == "--flash-attn")           { params.flash_attn      = true; }
         else if (arg == "-nfa"  || arg == "--no-flash-attn")        { params.flash_attn      = false; }
+        else if (arg == "-ngr"  || arg == "--no-graph-reuse")       { params.graph_reuse     = false; }
+        else if (                  arg == "--numa")                 { params.numa            = ARGV_NEXT; }
+        else if (arg == "-C"    || arg == "--cpu-mask")             { params.cpu_mask        = ARGV_NEXT; }
+        else if (                  arg == "--cpu-strict")           { params.cpu_strict      = true; }
+        else if (                  arg == "--poll")                 { params.poll            = std::stoi(ARGV_NEXT); }
         else if (arg == "-sns"  || arg == "--suppress-nst")         { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")       { params.suppress_regex  = ARGV_NEXT; }
         else if (                  arg == "--grammar")              { params.grammar         = ARGV_NEXT; }
@@ -260,7 +338,10 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -tr,       --translate            [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
     fprintf(stderr, "  -di,       --diarize              [%-7s] stereo audio diarization\n",                       params.diarize ? "true" : "false");
     fprintf(stderr, "  -tdrz,     --tinydiarize          [%-7s] enable tinydiarize (requires a tdrz model)\n",     params.tinydiarize ? "true" : "false");
+    fprintf(stderr, "  -mch,      --multi-channel        [%-7s] [EXPERIMENTAL] transcribe each stereo channel as a speaker\n", params.multi_channel ? "true" : "false");
     fprintf(stderr, "  -nf,       --no-fallback          [%-7s] do not use temperature fallback while decoding\n", params.no_fallback ? "true" : "false");
+    fprintf(stderr, "  -fee,      --fallback-early-exit  [%-7s] stop a failing decoder before the end of the window\n", params.fallback_exit ? "true" : "false");
+    fprintf(stderr, "  -fr,       --fallback-resume      [%-7s] resume fallbacks from the last good segment\n",   params.fallback_resume ? "true" : "false");
     fprintf(stderr, "  -otxt,     --output-txt           [%-7s] output result in a text file\n",                   params.output_txt ? "true" : "false");
     fprintf(stderr, "  -ovtt,     --output-vtt           [%-7s] output result in a vtt file\n",                    params.output_vtt ? "true" : "false");
     fprintf(stderr, "  -osrt,     --output-srt           [%-7s] output result in a srt file\n",                    params.output_srt ? "true" : "false");
@@ -282,14 +363,26 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "             --prompt PROMPT        [%-7s] initial prompt (max n_text_ctx/2 tokens)\n",       params.prompt.c_str());
     fprintf(stderr, "             --carry-initial-prompt [%-7s] always prepend initial prompt\n",                  params.carry_initial_prompt ? "true" : "false");
     fprintf(stderr, "  -m FNAME,  --model FNAME          [%-7s] model path\n",                                     params.model.c_str());
+    fprintf(stderr, "  -md FNAME, --model-draft FNAME    [%-7s] draft model for speculative decoding (greedy only)\n", params.model_draft.c_str());
+    fprintf(stderr, "             --draft-max N          [%-7d] max number of tokens to draft per step\n",        params.n_draft);
     fprintf(stderr, "  -f FNAME,  --file FNAME           [%-7s] input audio file path\n",                          "");
     fprintf(stderr, "  -oved D,   --ov-e-device DNAME    [%-7s] the OpenVINO device used for encode inference\n",  params.openvino_encode_device.c_str());
     fprintf(stderr, "  -dtw MODEL --dtw MODEL            [%-7s] compute token-level timestamps\n",                 params.dtw.c_str());
+    fprintf(stderr, "  -ctk T,    --cache-type-k T       [%-7s] self-attention KV cache type for K (f16, q8_0, q4_0)\n", params.cache_type_k_self.c_str());
+    fprintf(stderr, "  -ctv T,    --cache-type-v T       [%-7s] self-attention KV cache type for V (f16, q8_0, q4_0)\n", params.cache_type_v_self.c_str());
+    fprintf(stderr, "  -ctkx T,   --cache-type-k-cross T [%-7s] cross-attention KV cache type for K\n",           params.cache_type_k_cross.c_str());
+    fprintf(stderr, "  -ctvx T,   --cache-type-v-cross T [%-7s] cross-attention KV cache type for V\n",           params.cache_type_v_cross.c_str());
+    fprintf(stderr, "  --trace FNAME                     [%-7s] write a Chrome trace of the processing stages\n",   params.fname_trace.c_str());
     fprintf(stderr, "  -ls,       --log-score            [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu               [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -dev N,    --device N             [%-7d] GPU device ID (default: 0)\n",                     params.gpu_device);
     fprintf(stderr, "  -fa,       --flash-attn           [%-7s] enable flash attention\n",                         params.flash_attn ? "true" : "false");
     fprintf(stderr, "  -nfa,      --no-flash-attn        [%-7s] disable flash attention\n",                        params.flash_attn ? "false" : "true");
+    fprintf(stderr, "  -ngr,      --no-graph-reuse       [%-7s] rebuild the decoder graph for every decode step\n",  params.graph_reuse ? "false" : "true");
+    fprintf(stderr, "             --numa TYPE            [%-7s] NUMA strategy (disabled, distribute, isolate, numactl)\n", params.numa.c_str());
+    fprintf(stderr, "  -C M,      --cpu-mask M           [%-7s] compute on a threadpool pinned to the CPUs of this hex mask\n", params.cpu_mask.c_str());
+    fprintf(stderr, "             --cpu-strict           [%-7s] pin each threadpool thread to one CPU of the mask\n", params.cpu_strict ? "true" : "false");
+    fprintf(stderr, "             --poll N               [%-7d] threadpool polling level (0 - no polling, 100 - aggressive)\n", params.poll);
     fprintf(stderr, "  -sns,      --suppress-nst         [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX            [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
     fprintf(stderr, "  --grammar GRAMMAR                 [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
@@ -964,6 +1057,172 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
+// [EXPERIMENTAL] multi-channel transcription
+//
+// Each channel of a stereo recording (e.g. the two sides of a call) is transcribed on its own state of the shared
+// context, with all channels running at the same time. The segments are merged into a single timeline in which the
+// channel is the speaker.
+
+struct channel_segment {
+    int channel;
+    int i_segment; // index of the segment in the state of the channel
+
+    int64_t t0;
+    int64_t t1;
+};
+
+struct channel_transcript {
+    // every channel has a state of its own, for the draft model too
+    std::vector<whisper_state *> states;
+    std::vector<whisper_state *> states_draft;
+
+    std::vector<channel_segment> segments; // ordered by start time
+
+    ~channel_transcript() {
+        for (auto * state : states) {
+            whisper_free_state(state);
+        }
+        for (auto * state : states_draft) {
+            whisper_free_state(state);
+        }
+    }
+
+    const char * text(const channel_segment & seg) const {
+        return whisper_full_get_segment_text_from_state(states[seg.channel], seg.i_segment);
+    }
+};
+
+static bool transcribe_channels(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        const std::vector<std::vector<float>> & pcmf32s,
+        channel_transcript & transcript) {
+    const int n_channels = pcmf32s.size();
+
+    whisper_context * ctx_draft = params.speculative.ctx;
+
+    for (int c = 0; c < n_channels; ++c) {
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            return false;
+        }
+        transcript.states.push_back(state);
+
+        if (ctx_draft) {
+            whisper_state * state_draft = whisper_init_state(ctx_draft);
+            if (state_draft == nullptr) {
+                return false;
+            }
+            transcript.states_draft.push_back(state_draft);
+        }
+    }
+
+    // the segment callbacks read the default state, the merged timeline is printed once all channels are done
+    params.print_progress = false;
+    params.print_realtime = false;
+
+    params.new_segment_callback           = nullptr;
+    params.new_segment_callback_user_data = nullptr;
+
+    params.progress_callback           = nullptr;
+    params.progress_callback_user_data = nullptr;
+
+    std::vector<int> ret(n_channels, 0);
+
+    auto run = [&](int c) {
+        auto params_cur = params;
+
+        params_cur.speculative.state = ctx_draft ? transcript.states_draft[c] : nullptr;
+
+        ret[c] = whisper_full_with_state(ctx, transcript.states[c], params_cur, pcmf32s[c].data(), pcmf32s[c].size());
+    };
+
+    // the calling thread transcribes the first channel
+    std::vector<std::thread> workers;
+    for (int c = 1; c < n_channels; ++c) {
+        workers.emplace_back(run, c);
+    }
+
+    run(0);
+
+    for (auto & worker : workers) {
+        worker.join();
+    }
+
+    for (int c = 0; c < n_channels; ++c) {
+        if (ret[c] != 0) {
+            fprintf(stderr, "%s: failed to process channel %d\n", __func__, c);
+            return false;
+        }
+
+        const int n_segments = whisper_full_n_segments_from_state(transcript.states[c]);
+        for (int i = 0; i < n_segments; ++i) {
+            transcript.segments.push_back({
+                c, i,
+                whisper_full_get_segment_t0_from_state(transcript.states[c], i),
+                whisper_full_get_segment_t1_from_state(transcript.states[c], i),
+            });
+        }
+    }
+
+    std::stable_sort(transcript.segments.begin(), transcript.segments.end(), [](const channel_segment & a, const channel_segment & b) {
+        return a.t0 < b.t0;
+    });
+
+    return true;
+}
+
+static void print_channels(const channel_transcript & transcript, const whisper_params & params) {
+    printf("\n");
+
+    for (const auto & seg : transcript.segments) {
+        if (!params.no_timestamps) {
+            printf("[%s --> %s]  ", to_timestamp(seg.t0).c_str(), to_timestamp(seg.t1).c_str());
+        }
+
+        printf("(speaker %d)%s\n", seg.channel, transcript.text(seg));
+    }
+
+    fflush(stdout);
+}
+
+static void output_channels_txt(const channel_transcript & transcript, std::ofstream & fout) {
+    for (const auto & seg : transcript.segments) {
+        fout << "(speaker " << seg.channel << ")" << transcript.text(seg) << "\n";
+    }
+}
+
+static void output_channels_vtt(const channel_transcript & transcript, std::ofstream & fout) {
+    fout << "WEBVTT\n\n";
+
+    for (const auto & seg : transcript.segments) {
+        fout << to_timestamp(seg.t0) << " --> " << to_timestamp(seg.t1) << "\n";
+        fout << "<v Speaker" << seg.channel << ">" << transcript.text(seg) << "\n\n";
+    }
+}
+
+static void output_channels_srt(const channel_transcript & transcript, std::ofstream & fout, const whisper_params & params) {
+    for (size_t i = 0; i < transcript.segments.size(); ++i) {
+        const auto & seg = transcript.segments[i];
+
+        fout << i + 1 + params.offset_n << "\n";
+        fout << to_timestamp(seg.t0, true) << " --> " << to_timestamp(seg.t1, true) << "\n";
+        fout << "(speaker " << seg.channel << ")" << transcript.text(seg) << "\n\n";
+    }
+}
+
+static void output_channels_csv(const channel_transcript & transcript, std::ofstream & fout) {
+    fout << "start,end,speaker,text\n";
+
+    for (const auto & seg : transcript.segments) {
+        char * text_escaped = escape_double_quotes_in_csv(transcript.text(seg));
+
+        fout << 10 * seg.t0 << "," << 10 * seg.t1 << "," << seg.channel << ",";
+        fout << "\"" << text_escaped << "\"\n";
+
+        free(text_escaped);
+    }
+}
 
 static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
 
@@ -1044,10 +1303,20 @@ int main(int argc, char ** argv) {
         exit(0);
     }
 
+    if (params.multi_channel && (params.diarize || params.tinydiarize || params.vad || params.n_processors > 1)) {
+        fprintf(stderr, "error: cannot use --multi-channel with --diarize, --tinydiarize, --vad or --processors\n");
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
     if (params.no_prints) {
         whisper_log_set(cb_log_disable, NULL);
     }
 
+    if (!params.fname_trace.empty()) {
+        whisper_trace_set_enabled(true);
+    }
+
     // whisper init
     struct whisper_context_params cparams = whisper_context_default_params();
 
@@ -1055,6 +1324,26 @@ int main(int argc, char ** argv) {
     cparams.gpu_device = params.gpu_device;
     cparams.flash_attn = params.flash_attn;
 
+    cparams.decode_graph_reuse = params.graph_reuse;
+
+    cparams.type_k_self  = whisper_param_cache_type(params.cache_type_k_self);
+    cparams.type_v_self  = whisper_param_cache_type(params.cache_type_v_self);
+    cparams.type_k_cross = whisper_param_cache_type(params.cache_type_k_cross);
+    cparams.type_v_cross = whisper_param_cache_type(params.cache_type_v_cross);
+
+    if (cparams.type_k_self  == GGML_TYPE_COUNT || cparams.type_v_self  == GGML_TYPE_COUNT ||
+        cparams.type_k_cross == GGML_TYPE_COUNT || cparams.type_v_cross == GGML_TYPE_COUNT) {
+        fprintf(stderr, "error: unsupported KV cache type (use f32, f16, q8_0 or q4_0)\n");
+        return 3;
+    }
+
+    cparams.numa = numa_strategy_from_str(params.numa);
+
+    if (cparams.numa == GGML_NUMA_STRATEGY_COUNT) {
+        fprintf(stderr, "error: unsupported NUMA strategy '%s'\n", params.numa.c_str());
+        return 3;
+    }
+
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
         cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
@@ -1088,6 +1377,63 @@ int main(int argc, char ** argv) {
     // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
     whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+    // [EXPERIMENTAL] compute on a dedicated threadpool
+    ggml_threadpool_t threadpool = nullptr;
+    decltype(ggml_threadpool_free) * threadpool_free_fn = nullptr;
+
+    if (!params.cpu_mask.empty() || params.cpu_strict || params.poll >= 0) {
+        auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        auto * cpu_reg = cpu_dev ? ggml_backend_dev_backend_reg(cpu_dev) : nullptr;
+
+        auto * threadpool_new_fn = (decltype(ggml_threadpool_new) *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_threadpool_new");
+        threadpool_free_fn       = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_threadpool_free");
+
+        struct ggml_threadpool_params tpp = ggml_threadpool_params_default(params.n_threads);
+
+        if (!params.cpu_mask.empty() && !whisper_param_cpu_mask(params.cpu_mask, tpp.cpumask)) {
+            fprintf(stderr, "error: invalid CPU mask '%s'\n", params.cpu_mask.c_str());
+            whisper_free(ctx);
+            return 3;
+        }
+
+        tpp.strict_cpu = params.cpu_strict;
+        if (params.poll >= 0) {
+            tpp.poll = params.poll;
+        }
+
+        threadpool = threadpool_new_fn && threadpool_free_fn ? threadpool_new_fn(&tpp) : nullptr;
+        if (threadpool == nullptr) {
+            fprintf(stderr, "error: failed to create the threadpool\n");
+            whisper_free(ctx);
+            return 3;
+        }
+
+        whisper_attach_threadpool(ctx, threadpool);
+    }
+
+    struct whisper_context * ctx_draft = nullptr;
+
+    if (!params.model_draft.empty()) {
+        struct whisper_context_params cparams_draft = cparams;
+
+        cparams_draft.dtw_token_timestamps = false;
+
+        ctx_draft = whisper_init_from_file_with_params(params.model_draft.c_str(), cparams_draft);
+
+        if (ctx_draft == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper draft context\n");
+            whisper_free(ctx);
+            return 3;
+        }
+
+        // the draft model runs in between the decoder steps of the main model, so they can share the threadpool
+        whisper_attach_threadpool(ctx_draft, threadpool);
+
+        if (params.beam_size > 1) {
+            fprintf(stderr, "%s: warning: the draft model is used only with greedy sampling (use -bs 1)\n", __func__);
+        }
+    }
+
     if (!params.grammar.empty()) {
         auto & grammar = params.grammar_parsed;
         if (is_file_exist(params.grammar.c_str())) {
@@ -1165,11 +1511,21 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
+        channel_transcript transcript; // [EXPERIMENTAL] --multi-channel
+
+        int n_channels = 0;
+
+        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize || params.multi_channel, &n_channels)) {
             fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
             continue;
         }
 
+        // the decoder upmixes mono audio to two identical channels, which would be transcribed twice
+        if (params.multi_channel && n_channels != 2) {
+            fprintf(stderr, "error: --multi-channel needs stereo audio, '%s' has %d channel(s)\n", fname_inp.c_str(), n_channels);
+            continue;
+        }
+
         if (!whisper_is_multilingual(ctx)) {
             if (params.language != "en" || params.translate) {
                 params.language = "en";
@@ -1185,7 +1541,7 @@ int main(int argc, char ** argv) {
             // print system information
             fprintf(stderr, "\n");
             fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
-                    params.n_threads*params.n_processors, std::thread::hardware_concurrency(), whisper_print_system_info());
+                    params.n_threads*(params.multi_channel ? (int) pcmf32s.size() : params.n_processors), std::thread::hardware_concurrency(), whisper_print_system_info());
 
             // print some info about the processing
             fprintf(stderr, "\n");
@@ -1242,6 +1598,12 @@ int main(int argc, char ** argv) {
             wparams.greedy.best_of        = params.best_of;
             wparams.beam_search.beam_size = params.beam_size;
 
+            wparams.speculative.ctx     = ctx_draft;
+            wparams.speculative.n_draft = params.n_draft;
+
+            wparams.fallback.early_exit = params.fallback_exit;
+            wparams.fallback.resume     = params.fallback_resume;
+
             wparams.temperature_inc  = params.no_fallback ? 0.0f : params.temperature_inc;
             wparams.temperature      = params.temperature;
 
@@ -1315,12 +1677,43 @@ int main(int argc, char ** argv) {
                 wparams.abort_callback_user_data = &is_aborted;
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            if (params.multi_channel) {
+                if (!transcribe_channels(ctx, wparams, pcmf32s, transcript)) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    return 10;
+                }
+            } else if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 10;
             }
         }
 
+        // [EXPERIMENTAL] the outputs of the merged timeline
+        if (params.multi_channel) {
+            if (fout_factory.print_segment_callback) {
+                print_channels(transcript, params);
+            }
+
+            if (params.output_txt && fout_factory.open(".txt", "output_channels_txt")) {
+                output_channels_txt(transcript, fout_factory.fout);
+            }
+            if (params.output_vtt && fout_factory.open(".vtt", "output_channels_vtt")) {
+                output_channels_vtt(transcript, fout_factory.fout);
+            }
+            if (params.output_srt && fout_factory.open(".srt", "output_channels_srt")) {
+                output_channels_srt(transcript, fout_factory.fout, params);
+            }
+            if (params.output_csv && fout_factory.open(".csv", "output_channels_csv")) {
+                output_channels_csv(transcript, fout_factory.fout);
+            }
+
+            if (params.output_wts || params.output_jsn || params.output_lrc || params.log_score) {
+                fprintf(stderr, "%s: warning: --multi-channel writes only the txt, vtt, srt and csv outputs\n", __func__);
+            }
+
+            continue;
+        }
+
         // output stuff
         {
             // macros to stringify function name
@@ -1350,7 +1743,17 @@ int main(int argc, char ** argv) {
     if (!params.no_prints) {
         whisper_print_timings(ctx);
     }
+    if (!params.fname_trace.empty()) {
+        whisper_trace_dump(params.fname_trace.c_str());
+    }
+    if (ctx_draft) {
+        whisper_free(ctx_draft);
+    }
     whisper_free(ctx);
 
+    if (threadpool) {
+        threadpool_free_fn(threadpool);
+    }
+
     return 0;
 }
@@ -37,14 +37,25 @@
 #ifdef WHISPER_COMMON_FFMPEG
 // as implemented in ffmpeg-trancode.cpp only embedded in common lib if whisper built with ffmpeg support
 extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data, int out_sample_rate = WHISPER_SAMPLE_RATE);
+extern bool ffmpeg_decode_audio(const uint8_t * data, size_t size, std::vector<uint8_t> & wav_data, int out_sample_rate = WHISPER_SAMPLE_RATE);
 #endif
 
 // extract f32 PCM frames from an initialized decoder, downmix to mono and keep the stereo split
-static bool read_audio_from_decoder(ma_decoder & decoder, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+static bool read_audio_from_decoder(ma_decoder & decoder, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo, int * n_channels) {
     ma_result result;
     ma_uint64 frame_count;
     ma_uint64 frames_read;
 
+    // the decoder converts to the requested channel count, the backend reports the channels of the source
+    if (n_channels) {
+        ma_uint32 channels = 0;
+        if ((result = ma_data_source_get_data_format(decoder.pBackend, NULL, &channels, NULL, NULL, 0)) != MA_SUCCESS) {
+            fprintf(stderr, "error: failed to retrieve the format of the audio data (%s)\n", ma_result_description(result));
+            return false;
+        }
+        *n_channels = channels;
+    }
+
     if ((result = ma_decoder_get_length_in_pcm_frames(&decoder, &frame_count)) != MA_SUCCESS) {
         fprintf(stderr, "error: failed to retrieve the length of the audio data (%s)\n", ma_result_description(result));
         return false;
@@ -75,7 +86,7 @@ static bool read_audio_from_decoder(ma_decoder & decoder, std::vector<float> & p
     return true;
 }
 
-bool read_audio_data(const std::string & fname, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+bool read_audio_data(const std::string & fname, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo, int * n_channels) {
     std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
 
     ma_result result;
@@ -159,22 +170,43 @@ bool read_audio_data(const std::string & fname, std::vector<float> & pcmf32, std
         }
     }
 
-    return read_audio_from_decoder(decoder.decoder, pcmf32, pcmf32s, stereo);
+    return read_audio_from_decoder(decoder.decoder, pcmf32, pcmf32s, stereo, n_channels);
 }
 
 // decode audio bytes already held in memory
-bool read_audio_data(const char * buffer, size_t buffer_size, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+bool read_audio_data(const char * buffer, size_t buffer_size, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo, int * n_channels) {
     ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
     ma_decoder decoder;
 
-    if (ma_decoder_init_memory(buffer, buffer_size, &decoder_config, &decoder) != MA_SUCCESS) {
-        fprintf(stderr, "error: failed to decode audio data from memory buffer\n");
-        return false;
+    if (ma_decoder_init_memory(buffer, buffer_size, &decoder_config, &decoder) == MA_SUCCESS) {
+        bool ok = read_audio_from_decoder(decoder, pcmf32, pcmf32s, stereo, n_channels);
+        ma_decoder_uninit(&decoder);
+        return ok;
     }
 
-    bool ok = read_audio_from_decoder(decoder, pcmf32, pcmf32s, stereo);
-    ma_decoder_uninit(&decoder);
-    return ok;
+#if defined(WHISPER_COMMON_FFMPEG)
+    // formats that miniaudio cannot decode (e.g. m4a, opus, webm) - transcode to WAV in memory
+    std::vector<uint8_t> wav_data;
+    if (ffmpeg_decode_audio((const uint8_t *) buffer, buffer_size, wav_data) == 0) {
+        if (ma_decoder_init_memory(wav_data.data(), wav_data.size(), &decoder_config, &decoder) == MA_SUCCESS) {
+            bool ok = read_audio_from_decoder(decoder, pcmf32, pcmf32s, stereo, n_channels);
+            ma_decoder_uninit(&decoder);
+            return ok;
+        }
+    }
+#endif
+
+    fprintf(stderr, "error: failed to decode audio data from memory buffer\n");
+    return false;
+}
+
+ggml_numa_strategy numa_strategy_from_str(const std::string & name) {
+    if (name == "disabled")   { return GGML_NUMA_STRATEGY_DISABLED;   }
+    if (name == "distribute") { return GGML_NUMA_STRATEGY_DISTRIBUTE; }
+    if (name == "isolate")    { return GGML_NUMA_STRATEGY_ISOLATE;    }
+    if (name == "numactl")    { return GGML_NUMA_STRATEGY_NUMACTL;    }
+
+    return GGML_NUMA_STRATEGY_COUNT;
 }
 
 //  500 -> 00:05.000
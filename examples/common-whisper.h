@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ggml-cpu.h"
+
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -8,19 +10,27 @@
 // fname can be a buffer of WAV data instead of a filename
 // The sample rate of the audio must be equal to COMMON_SAMPLE_RATE
 // If stereo flag is set and the audio has 2 channels, the pcmf32s will contain 2 channel PCM
+// If n_channels is given, it receives the number of channels of the source, before they are mixed
 bool read_audio_data(
         const std::string & fname,
         std::vector<float> & pcmf32,
         std::vector<std::vector<float>> & pcmf32s,
-        bool stereo);
+        bool stereo,
+        int * n_channels = nullptr);
 
 // decode audio bytes already held in memory (uploaded file, network buffer)
+// formats that miniaudio cannot decode are transcoded in memory when built with WHISPER_FFMPEG
 bool read_audio_data(
         const char * buffer,
         size_t buffer_size,
         std::vector<float> & pcmf32,
         std::vector<std::vector<float>> & pcmf32s,
-        bool stereo);
+        bool stereo,
+        int * n_channels = nullptr);
+
+// [EXPERIMENTAL] NUMA strategy of the CPU backend by name (disabled, distribute, isolate, numactl)
+// returns GGML_NUMA_STRATEGY_COUNT for an unknown name
+ggml_numa_strategy numa_strategy_from_str(const std::string & name);
 
 // convert timestamp to string, 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma = false);
@@ -1,5 +1,6 @@
 #ifdef WHISPER_COMMON_FFMPEG
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <cstdio>
@@ -42,24 +43,19 @@ static size_t wav_header_write(uint8_t * buf, int num_channels, int sample_rate,
     return 44;
 }
 
-bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data, int out_sample_rate) {
-    {
-        const char * verbose = getenv("WHISPER_COMMON_FFMPEG_VERBOSE");
-        if (verbose && strcmp(verbose, "2") == 0) {
-            av_log_set_level(AV_LOG_DEBUG);
-        } else if (verbose && strcmp(verbose, "1") == 0) {
-            av_log_set_level(AV_LOG_VERBOSE);
-        } else {
-            av_log_set_level(AV_LOG_WARNING);
-        }
-    }
-
-    AVFormatContext * fmt_ctx = nullptr;
-    if (avformat_open_input(&fmt_ctx, ifname.c_str(), nullptr, nullptr) != 0) {
-        fprintf(stderr, "error: failed to open input file '%s'\n", ifname.c_str());
-        return true;
+static void ffmpeg_set_log_level() {
+    const char * verbose = getenv("WHISPER_COMMON_FFMPEG_VERBOSE");
+    if (verbose && strcmp(verbose, "2") == 0) {
+        av_log_set_level(AV_LOG_DEBUG);
+    } else if (verbose && strcmp(verbose, "1") == 0) {
+        av_log_set_level(AV_LOG_VERBOSE);
+    } else {
+        av_log_set_level(AV_LOG_WARNING);
     }
+}
 
+// decode the first audio stream of an opened input - fmt_ctx is closed in all cases
+static bool ffmpeg_decode_input(AVFormatContext * fmt_ctx, const std::string & ifname, std::vector<uint8_t> & wav_data, int out_sample_rate) {
     if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
         fprintf(stderr, "error: failed to find stream information\n");
         avformat_close_input(&fmt_ctx);
@@ -235,4 +231,105 @@ bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_
     return false; // success
 }
 
+bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data, int out_sample_rate) {
+    ffmpeg_set_log_level();
+
+    AVFormatContext * fmt_ctx = nullptr;
+    if (avformat_open_input(&fmt_ctx, ifname.c_str(), nullptr, nullptr) != 0) {
+        fprintf(stderr, "error: failed to open input file '%s'\n", ifname.c_str());
+        return true;
+    }
+
+    return ffmpeg_decode_input(fmt_ctx, ifname, wav_data, out_sample_rate);
+}
+
+// custom AVIOContext over a memory buffer, so that uploads do not go through temporary files
+struct ffmpeg_buffer_reader {
+    const uint8_t * data;
+    size_t size;
+    size_t pos;
+};
+
+static int ffmpeg_buffer_read(void * opaque, uint8_t * buf, int buf_size) {
+    auto * reader = (ffmpeg_buffer_reader *) opaque;
+
+    const size_t n = std::min<size_t>(buf_size, reader->size - reader->pos);
+    if (n == 0) {
+        return AVERROR_EOF;
+    }
+
+    memcpy(buf, reader->data + reader->pos, n);
+    reader->pos += n;
+
+    return (int) n;
+}
+
+static int64_t ffmpeg_buffer_seek(void * opaque, int64_t offset, int whence) {
+    auto * reader = (ffmpeg_buffer_reader *) opaque;
+
+    if (whence == AVSEEK_SIZE) {
+        return reader->size;
+    }
+
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: pos = offset;                          break;
+        case SEEK_CUR: pos = (int64_t) reader->pos  + offset; break;
+        case SEEK_END: pos = (int64_t) reader->size + offset; break;
+        default: return -1;
+    }
+
+    if (pos < 0 || pos > (int64_t) reader->size) {
+        return -1;
+    }
+
+    reader->pos = pos;
+
+    return pos;
+}
+
+bool ffmpeg_decode_audio(const uint8_t * data, size_t size, std::vector<uint8_t> & wav_data, int out_sample_rate) {
+    ffmpeg_set_log_level();
+
+    const int avio_buffer_size = 64*1024;
+
+    uint8_t * avio_buffer = (uint8_t *) av_malloc(avio_buffer_size);
+    if (!avio_buffer) {
+        fprintf(stderr, "error: failed to allocate the AVIO buffer\n");
+        return true;
+    }
+
+    ffmpeg_buffer_reader reader = { data, size, 0 };
+
+    AVIOContext * avio_ctx = avio_alloc_context(avio_buffer, avio_buffer_size, 0, &reader, ffmpeg_buffer_read, nullptr, ffmpeg_buffer_seek);
+    if (!avio_ctx) {
+        fprintf(stderr, "error: failed to allocate the AVIO context\n");
+        av_free(avio_buffer);
+        return true;
+    }
+
+    bool failed = true;
+
+    AVFormatContext * fmt_ctx = avformat_alloc_context();
+    if (!fmt_ctx) {
+        fprintf(stderr, "error: failed to allocate the format context\n");
+    } else {
+        fmt_ctx->pb     = avio_ctx;
+        fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+        // on failure the format context is freed by avformat_open_input()
+        if (avformat_open_input(&fmt_ctx, nullptr, nullptr, nullptr) != 0) {
+            fprintf(stderr, "error: failed to open input buffer\n");
+        } else {
+            failed = ffmpeg_decode_input(fmt_ctx, "<memory>", wav_data, out_sample_rate);
+        }
+    }
+
+    // avio may have replaced the buffer
+    av_freep(&avio_ctx->buffer);
+    avio_context_free(&avio_ctx);
+
+    return failed;
+}
+
 #endif // WHISPER_COMMON_FFMPEG
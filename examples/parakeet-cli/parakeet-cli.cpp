@@ -18,9 +18,11 @@ struct parakeet_params {
     bool print_segments = false;
     bool output_txt     = false;
     bool no_prints      = false;
+    bool pred_lut       = false;
 
     std::string model       = "models/ggml-parakeet-tdt-0.6b-v3.bin";
     std::string output_file = "";
+    std::string fname_trace = "";
     std::vector<std::string> fname_inp = {};
 };
 
@@ -63,6 +65,8 @@ static bool parakeet_params_parse(int argc, char ** argv, parakeet_params & para
         else if (arg == "-otxt" || arg == "--output-txt")      { params.output_txt        = true; }
         else if (arg == "-of"   || arg == "--output-file")     { params.output_file       = ARGV_NEXT; }
         else if (arg == "-np"   || arg == "--no-prints")       { params.no_prints         = true; }
+        else if (                  arg == "--trace")           { params.fname_trace       = ARGV_NEXT; }
+        else if (                  arg == "--pred-lut")        { params.pred_lut          = true; }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             parakeet_print_usage(argc, argv, params);
@@ -89,6 +93,8 @@ static void parakeet_print_usage(int /*argc*/, char ** argv, const parakeet_para
     fprintf(stderr, "  -otxt,  --output-txt        [%-7s] output result in a text file\n",                params.output_txt ? "true" : "false");
     fprintf(stderr, "  -of,    --output-file FILE  [%-7s] output file path (without file extension)\n",   "");
     fprintf(stderr, "  -np,    --no-prints         [%-7s] do not print anything other than the results\n", params.no_prints ? "true" : "false");
+    fprintf(stderr, "          --trace FILE        [%-7s] write a Chrome trace of the processing stages\n", "");
+    fprintf(stderr, "          --pred-lut          [%-7s] precompute the predictor input gates for all tokens\n", params.pred_lut ? "true" : "false");
     fprintf(stderr, "\n");
 }
 
@@ -119,6 +125,10 @@ int main(int argc, char ** argv) {
         parakeet_log_set(cb_log_disable, NULL);
     }
 
+    if (!params.fname_trace.empty()) {
+        parakeet_trace_set_enabled(true);
+    }
+
     if (params.fname_inp.empty()) {
         fprintf(stderr, "error: no input files specified\n");
         parakeet_print_usage(argc, argv, params);
@@ -128,6 +138,7 @@ int main(int argc, char ** argv) {
     struct parakeet_context_params ctx_params = parakeet_context_default_params();
     ctx_params.use_gpu     = params.use_gpu;
     ctx_params.gpu_device  = params.gpu_device;
+    ctx_params.pred_lut    = params.pred_lut;
 
     if (!params.no_prints) {
         fprintf(stderr, "Loading Parakeet model from: %s\n", params.model.c_str());
@@ -169,6 +180,7 @@ int main(int argc, char ** argv) {
         full_params.n_threads           = params.n_threads;
         full_params.new_token_callback  = token_callback;
         full_params.new_token_callback_user_data = &is_first;
+        full_params.token_probs         = params.print_segments;
 
         const int mel_frames = (int)(pcmf32.size() / PARAKEET_HOP_LENGTH);
         int ret = parakeet_full(pctx, full_params, pcmf32.data(), pcmf32.size());
@@ -237,6 +249,10 @@ int main(int argc, char ** argv) {
         }
     }
 
+    if (!params.fname_trace.empty()) {
+        parakeet_trace_dump(params.fname_trace.c_str());
+    }
+
     parakeet_free(pctx);
 
     return 0;
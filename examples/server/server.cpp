@@ -2,12 +2,15 @@
 #include "common-whisper.h"
 
 #include "whisper.h"
+#include "parakeet.h"
 #include "httplib.h"
 #include "json.hpp"
 
+#include <algorithm>
 #include <cfloat>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <fstream>
 #include <sstream>
@@ -18,7 +21,16 @@
 #include <csignal>
 #include <atomic>
 #include <functional>
+#include <future>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <tuple>
+#include <unordered_map>
 #if defined (_WIN32)
 #include <windows.h>
 #endif
@@ -31,6 +43,11 @@ enum server_state {
     SERVER_STATE_READY,          // Server is ready and model is loaded
 };
 
+enum model_backend {
+    MODEL_BACKEND_WHISPER,
+    MODEL_BACKEND_PARAKEET,
+};
+
 namespace {
 
 // output formats
@@ -66,6 +83,29 @@ struct server_params
     int32_t read_timeout  = 600;
     int32_t write_timeout = 600;
 
+    // [EXPERIMENTAL] realtime sessions
+    int32_t n_streams      = 4;
+    int32_t stream_timeout = 60;
+
+    // [EXPERIMENTAL] model registry
+    std::string   model_name    = "default"; // name of the --model
+    model_backend backend       = MODEL_BACKEND_WHISPER; // backend of the --model
+    int32_t       models_budget = 0;         // MB, 0 - unlimited
+
+    std::vector<std::tuple<std::string, std::string, model_backend>> models; // additional models, name, path and backend
+
+    // [EXPERIMENTAL] concurrent requests per parakeet model
+    int32_t n_parakeet_states = 2;
+
+    // [EXPERIMENTAL] request scheduler
+    int32_t sched_slots         = 1;  // whisper requests that compute at the same time
+    int32_t sched_preempt       = 1;  // whisper requests that can be paused for a higher priority one
+    int32_t sched_interactive_s = 30; // requests with up to this many seconds of audio are interactive by default
+
+    // [EXPERIMENTAL] result cache
+    int32_t     cache_size = 0; // MB, 0 - disabled
+    std::string cache_dir  = "";
+
     bool ffmpeg_converter = false;
 };
 
@@ -118,6 +158,7 @@ struct whisper_params {
     std::string tdrz_speaker_turn      = " [SPEAKER_TURN]"; // TODO: set from command line
     std::string openvino_encode_device = "CPU";
     std::string dtw                    = "";
+    std::string numa                   = "disabled";
 
     // Voice Activity Detection (VAD) parameters
     bool        vad                         = false;
@@ -130,6 +171,29 @@ struct whisper_params {
     float       vad_samples_overlap         = 0.1f;
 };
 
+const char * model_backend_str(model_backend backend) {
+    switch (backend) {
+        case MODEL_BACKEND_WHISPER:  return "whisper";
+        case MODEL_BACKEND_PARAKEET: return "parakeet";
+    }
+
+    return "unknown";
+}
+
+// returns false if the name is not a backend
+bool model_backend_from_str(const std::string & name, model_backend & backend) {
+    if (name == "whisper") {
+        backend = MODEL_BACKEND_WHISPER;
+        return true;
+    }
+    if (name == "parakeet") {
+        backend = MODEL_BACKEND_PARAKEET;
+        return true;
+    }
+
+    return false;
+}
+
 void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params, const server_params& sparams) {
     fprintf(stderr, "\n");
     fprintf(stderr, "usage: %s [options] \n", argv[0]);
@@ -173,14 +237,28 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  --public PATH,                         [%-7s] Path to the public folder\n",                               sparams.public_path.c_str());
     fprintf(stderr, "  --request-path PATH,                   [%-7s] Request path for all requests\n",                           sparams.request_path.c_str());
     fprintf(stderr, "  --inference-path PATH,                 [%-7s] Inference path for all requests\n",                         sparams.inference_path.c_str());
-    fprintf(stderr, "  --convert,                             [%-7s] Convert audio to WAV, requires ffmpeg on the server\n",     sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  --convert,                             [%-7s] Convert audio that cannot be decoded in process, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
     fprintf(stderr, "  --tmp-dir,                             [%-7s] Temporary directory for ffmpeg transcoded files\n",         sparams.tmp_dir.c_str());
+    fprintf(stderr, "  --streams N,                           [%-7d] Maximum number of concurrent realtime sessions\n",         sparams.n_streams);
+    fprintf(stderr, "  --stream-timeout N,                    [%-7d] Close realtime sessions idle for N seconds\n",             sparams.stream_timeout);
+    fprintf(stderr, "  --model-name NAME,                     [%-7s] Name of the --model in requests\n",                         sparams.model_name.c_str());
+    fprintf(stderr, "  --backend NAME,                        [%-7s] Backend of the --model (whisper, parakeet)\n",             model_backend_str(sparams.backend));
+    fprintf(stderr, "  --add-model NAME=FNAME,                [%-7s] Register another model, loaded on first use\n",            "");
+    fprintf(stderr, "  --add-parakeet-model NAME=FNAME,       [%-7s] Register a parakeet model, loaded on first use\n",          "");
+    fprintf(stderr, "  --parakeet-states N,                   [%-7d] Concurrent requests per parakeet model\n",                  sparams.n_parakeet_states);
+    fprintf(stderr, "  --models-budget N,                     [%-7d] Unload idle models to keep the loaded ones under N MB (0 - unlimited)\n", sparams.models_budget);
+    fprintf(stderr, "  --sched-slots N,                       [%-7d] Whisper requests per model that compute at the same time\n",        sparams.sched_slots);
+    fprintf(stderr, "  --sched-preempt N,                     [%-7d] Whisper requests per model that can be paused for a higher priority one\n", sparams.sched_preempt);
+    fprintf(stderr, "  --sched-interactive-s N,               [%-7d] Requests with up to N seconds of audio are interactive by default\n", sparams.sched_interactive_s);
+    fprintf(stderr, "  --cache N,                             [%-7d] Cache up to N MB of transcripts in memory (0 - disabled)\n", sparams.cache_size);
+    fprintf(stderr, "  --cache-dir DIR,                       [%-7s] Also store the cached transcripts in DIR\n",                sparams.cache_dir.c_str());
     fprintf(stderr, "  -sns,      --suppress-nst              [%-7s] suppress non-speech tokens\n",                              params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  -nth N,    --no-speech-thold N         [%-7.2f] no speech threshold\n",                                   params.no_speech_thold);
     fprintf(stderr, "  -ng,       --no-gpu                    [%-7s] do not use gpu\n",                                          params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -dev N,    --device N                  [%-7d] GPU device ID (default: 0)\n",                              params.gpu_device);
     fprintf(stderr, "  -fa,       --flash-attn                [%-7s] enable flash attention\n",                                  params.flash_attn ? "true" : "false");
     fprintf(stderr, "  -nfa,      --no-flash-attn             [%-7s] disable flash attention\n",                                 params.flash_attn ? "false" : "true");
+    fprintf(stderr, "             --numa TYPE                 [%-7s] NUMA strategy (disabled, distribute, isolate, numactl)\n",  params.numa.c_str());
     fprintf(stderr, "  -nlp,      --no-language-probabilities [%-7s] exclude language probabilities from verbose_json output\n", params.no_language_probabilities ? "true" : "false");
     // Voice Activity Detection (VAD) parameters
     fprintf(stderr, "\nVoice Activity Detection (VAD) options:\n");
@@ -243,6 +321,7 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (arg == "-dev"   || arg == "--device")                    { params.gpu_device                = std::stoi(argv[++i]); }
         else if (arg == "-fa"    || arg == "--flash-attn")                { params.flash_attn                = true; }
         else if (arg == "-nfa"   || arg == "--no-flash-attn")             { params.flash_attn                = false; }
+        else if (                   arg == "--numa")                      { params.numa                      = argv[++i]; }
         else if (arg == "-sns"   || arg == "--suppress-nst")              { params.suppress_nst              = true; }
         else if (arg == "-nth"   || arg == "--no-speech-thold")           { params.no_speech_thold           = std::stof(argv[++i]); }
         else if (arg == "-nlp"   || arg == "--no-language-probabilities") { params.no_language_probabilities = true; }
@@ -255,6 +334,34 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (                   arg == "--inference-path")  { sparams.inference_path = argv[++i]; }
         else if (                   arg == "--convert")         { sparams.ffmpeg_converter     = true; }
         else if (                   arg == "--tmp-dir")         { sparams.tmp_dir     = argv[++i]; }
+        else if (                   arg == "--streams")         { sparams.n_streams      = std::stoi(argv[++i]); }
+        else if (                   arg == "--stream-timeout")  { sparams.stream_timeout = std::stoi(argv[++i]); }
+        else if (                   arg == "--model-name")      { sparams.model_name     = argv[++i]; }
+        else if (                   arg == "--models-budget")   { sparams.models_budget  = std::stoi(argv[++i]); }
+        else if (                   arg == "--cache")           { sparams.cache_size     = std::stoi(argv[++i]); }
+        else if (                   arg == "--cache-dir")       { sparams.cache_dir      = argv[++i]; }
+        else if (                   arg == "--parakeet-states") { sparams.n_parakeet_states = std::stoi(argv[++i]); }
+        else if (                   arg == "--sched-slots")     { sparams.sched_slots         = std::stoi(argv[++i]); }
+        else if (                   arg == "--sched-preempt")   { sparams.sched_preempt       = std::stoi(argv[++i]); }
+        else if (                   arg == "--sched-interactive-s") { sparams.sched_interactive_s = std::stoi(argv[++i]); }
+        else if (                   arg == "--backend") {
+            if (!model_backend_from_str(argv[++i], sparams.backend)) {
+                fprintf(stderr, "error: unknown backend '%s'\n", argv[i]);
+                whisper_print_usage(argc, argv, params, sparams);
+                exit(0);
+            }
+        }
+        else if (                   arg == "--add-model" || arg == "--add-parakeet-model") {
+            const std::string value = argv[++i];
+            const size_t pos = value.find('=');
+            if (pos == std::string::npos || pos == 0) {
+                fprintf(stderr, "error: expected NAME=FNAME for %s, got '%s'\n", arg.c_str(), value.c_str());
+                whisper_print_usage(argc, argv, params, sparams);
+                exit(0);
+            }
+            sparams.models.emplace_back(value.substr(0, pos), value.substr(pos + 1),
+                    arg == "--add-model" ? MODEL_BACKEND_WHISPER : MODEL_BACKEND_PARAKEET);
+        }
 
         // Voice Activity Detection (VAD)
         else if (                   arg == "--vad")                         { params.vad                         = true; }
@@ -296,6 +403,10 @@ void check_ffmpeg_availibility() {
 }
 
 std::string generate_temp_filename(const std::string &path, const std::string &prefix, const std::string &extension) {
+    // requests are decoded concurrently - the rng and std::localtime are not thread-safe
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
     auto now = std::chrono::system_clock::now();
     auto now_time_t = std::chrono::system_clock::to_time_t(now);
 
@@ -383,11 +494,12 @@ void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct wh
     }
 }
 
-void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
     const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    // the requests run on the default state of the context or on a state of the request pool
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -403,8 +515,8 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
@@ -416,29 +528,29 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
-                const float  p    = whisper_full_get_token_p   (ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                const float  p    = whisper_full_get_token_p_from_state   (state, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
 
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -451,23 +563,162 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
     }
 }
 
-std::string output_str(struct whisper_context * ctx, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
-    std::stringstream result;
-    const int n_segments = whisper_full_n_segments(ctx);
+// the result of a transcription - responses are rendered from this instead of the context, so that they can also
+// be served from the result cache
+struct transcript_token {
+    whisper_token id;
+    std::string   text;
+
+    float p;
+    float plog;
+
+    int64_t t0;
+    int64_t t1;
+    int64_t t_dtw;
+
+    bool word_start; // only used with subword tokens
+};
+
+struct transcript_segment {
+    std::string text;
+
+    int64_t t0;
+    int64_t t1;
+
+    float no_speech_prob;
+
+    std::vector<transcript_token> tokens;
+};
+
+struct transcript {
+    int lang_id = -1; // -1 if the model does not detect the language
+
+    whisper_token token_eot = 0;
+
+    // the tokens are subwords and words are made of the tokens from one word_start to the next (parakeet)
+    bool subword_tokens = false;
+
+    // false if the token probabilities were not computed
+    bool token_probs = true;
+
+    std::vector<transcript_segment> segments;
+
+    // empty unless the language probabilities were requested
+    int detected_lang_id = -1;
+    std::vector<float> lang_probs;
+};
+
+// the results of the default state of the context if state is nullptr
+transcript get_transcript(struct whisper_context * ctx, struct whisper_state * state = nullptr) {
+    transcript result;
+
+    result.lang_id   = state ? whisper_full_lang_id_from_state(state) : whisper_full_lang_id(ctx);
+    result.token_eot = whisper_token_eot(ctx);
+
+    const int n_segments = state ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+    result.segments.resize(n_segments);
+
+    for (int i = 0; i < n_segments; ++i) {
+        auto & segment = result.segments[i];
+
+        segment.text           = state ? whisper_full_get_segment_text_from_state(state, i)           : whisper_full_get_segment_text(ctx, i);
+        segment.t0             = state ? whisper_full_get_segment_t0_from_state(state, i)             : whisper_full_get_segment_t0(ctx, i);
+        segment.t1             = state ? whisper_full_get_segment_t1_from_state(state, i)             : whisper_full_get_segment_t1(ctx, i);
+        segment.no_speech_prob = state ? whisper_full_get_segment_no_speech_prob_from_state(state, i) : whisper_full_get_segment_no_speech_prob(ctx, i);
+
+        const int n_tokens = state ? whisper_full_n_tokens_from_state(state, i) : whisper_full_n_tokens(ctx, i);
+        segment.tokens.resize(n_tokens);
+
+        for (int j = 0; j < n_tokens; ++j) {
+            const whisper_token_data data = state ? whisper_full_get_token_data_from_state(state, i, j) : whisper_full_get_token_data(ctx, i, j);
+
+            segment.tokens[j] = {
+                data.id,
+                state ? whisper_full_get_token_text_from_state(ctx, state, i, j) : whisper_full_get_token_text(ctx, i, j),
+                data.p,
+                data.plog,
+                data.t0,
+                data.t1,
+                data.t_dtw,
+                false,
+            };
+        }
+    }
+
+    return result;
+}
+
+// parakeet returns a single segment for all of the audio - split it into sentences, so that the subtitle formats
+// get cues of a reasonable length
+transcript get_transcript(struct parakeet_context * ctx, struct parakeet_state * state, bool token_probs) {
+    transcript result;
+
+    result.token_eot      = parakeet_n_vocab(ctx);
+    result.subword_tokens = true;
+    result.token_probs    = token_probs;
+
+    std::vector<transcript_token> tokens;
+
+    const int n_segments = parakeet_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const int n_tokens = parakeet_full_n_tokens_from_state(state, i);
+        for (int j = 0; j < n_tokens; ++j) {
+            const parakeet_token_data data = parakeet_full_get_token_data_from_state(state, i, j);
+
+            char text[256];
+            if (parakeet_token_to_text(parakeet_token_to_str(ctx, data.id), tokens.empty(), text, sizeof(text)) < 0) {
+                text[0] = '\0';
+            }
+
+            tokens.push_back({ data.id, text, data.p, data.plog, data.t0, data.t1, -1, data.is_word_start });
+        }
+    }
+
+    transcript_segment segment;
+
+    const auto flush = [&]() {
+        if (segment.tokens.empty()) {
+            return;
+        }
+
+        segment.t0 = segment.tokens.front().t0;
+        segment.t1 = segment.tokens.back().t1;
+        segment.no_speech_prob = 0.0f;
+
+        result.segments.push_back(std::move(segment));
+        segment = {};
+    };
+
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        segment.text += tokens[i].text;
+        segment.tokens.push_back(tokens[i]);
+
+        const std::string & text = tokens[i].text;
+
+        // a sentence ends with punctuation that is followed by a new word
+        const bool is_end = !text.empty() && (text.back() == '.' || text.back() == '?' || text.back() == '!');
+        if (is_end && (i + 1 == tokens.size() || tokens[i + 1].word_start)) {
+            flush();
+        }
+    }
+    flush();
+
+    return result;
+}
+
+std::string output_str(const transcript & result, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
+    std::stringstream ss;
+    for (const auto & segment : result.segments) {
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            speaker = estimate_diarization_speaker(pcmf32s, segment.t0, segment.t1);
         }
 
-        result << speaker << text << "\n";
+        ss << speaker << segment.text << "\n";
     }
-    return result.str();
+    return ss.str();
 }
 
 bool parse_str_to_bool(const std::string & s) {
@@ -636,126 +887,1410 @@ void get_req_parameters(const Request & req, whisper_params & params)
     }
 }
 
-}  // namespace
+// the strings of params are referenced by the result, so params must outlive it
+whisper_full_params get_full_params(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
-int main(int argc, char ** argv) {
-    ggml_backend_load_all();
+    wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
 
-    whisper_params params;
-    server_params sparams;
+    wparams.print_realtime   = false;
+    wparams.print_progress   = params.print_progress;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.n_threads        = params.n_threads;
+    wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
+    wparams.offset_ms        = params.offset_t_ms;
+    wparams.duration_ms      = params.duration_ms;
 
-    std::mutex whisper_mutex;
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+    wparams.audio_ctx        = params.audio_ctx;
 
-    if (whisper_params_parse(argc, argv, params, sparams) == false) {
-        whisper_print_usage(argc, argv, params, sparams);
-        return 1;
+    wparams.debug_mode       = params.debug_mode;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    wparams.initial_prompt   = params.prompt.c_str();
+    wparams.carry_initial_prompt = params.carry_initial_prompt;
+
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    wparams.temperature      = params.temperature;
+    wparams.no_speech_thold  = params.no_speech_thold;
+    wparams.temperature_inc  = params.temperature_inc;
+    wparams.entropy_thold    = params.entropy_thold;
+    wparams.logprob_thold    = params.logprob_thold;
+
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.token_timestamps = params.token_timestamps;
+    wparams.no_context       = params.no_context;
+
+    wparams.suppress_nst     = params.suppress_nst;
+
+    wparams.vad              = params.vad;
+    wparams.vad_model_path   = params.vad_model.c_str();
+
+    wparams.vad_params.threshold               = params.vad_threshold;
+    wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
+    wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+    wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
+    wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
+    wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+
+    return wparams;
+}
+
+// [EXPERIMENTAL] realtime transcription
+//
+// A session is opened with POST /stream, receives raw 16 kHz mono PCM with POST /stream/<id> and is closed
+// with DELETE /stream/<id>. The audio is transcribed with whisper_stream as it arrives, so each push returns
+// the text committed since the previous push together with the current uncommitted hypothesis.
+
+// whisper states shared by the sessions - idle states are kept, so that opening a session does not allocate
+// the compute buffers again
+struct state_pool {
+    whisper_context * ctx = nullptr;
+
+    int n_max  = 0;
+    int n_used = 0;
+
+    size_t state_size = 0; // bytes allocated by one state
+
+    std::vector<whisper_state *> idle;
+    std::mutex mutex;
+
+    // returns nullptr if all states are in use
+    whisper_state * acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (n_used >= n_max) {
+            return nullptr;
+        }
+
+        whisper_state * state = nullptr;
+        if (!idle.empty()) {
+            state = idle.back();
+            idle.pop_back();
+        } else {
+            state = whisper_init_state(ctx);
+            if (state == nullptr) {
+                return nullptr;
+            }
+            state_size = whisper_get_state_memory_size(state);
+        }
+
+        n_used++;
+
+        return state;
     }
 
-    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
-        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
-        whisper_print_usage(argc, argv, params, sparams);
-        exit(0);
+    void release(whisper_state * state) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        idle.push_back(state);
+        n_used--;
     }
 
-    if (params.diarize && params.tinydiarize) {
-        fprintf(stderr, "error: cannot use both --diarize and --tinydiarize\n");
-        whisper_print_usage(argc, argv, params, sparams);
-        exit(0);
+    // free the idle states and switch to another context - no state can be in use
+    void reset(whisper_context * ctx_new) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto * state : idle) {
+            whisper_free_state(state);
+        }
+        idle.clear();
+
+        ctx = ctx_new;
     }
+};
 
-    if (sparams.ffmpeg_converter) {
-        check_ffmpeg_availibility();
+// [EXPERIMENTAL] request scheduler
+//
+// Each whisper model computes its requests in a limited number of slots, requests on different models do not
+// wait for each other. A waiting request is ranked by its class, then by its deadline and then by its arrival, and
+// the best ranked one gets the next free slot. Running requests yield
+// at the seek-window boundaries of whisper_full_with_state (the encoder_begin_callback): if a better ranked
+// request is waiting, the running one gives up its slot and pauses until it is the best ranked again. A paused
+// request keeps its state, so it resumes with the next window and does not recompute the finished ones.
+
+enum request_class {
+    REQUEST_CLASS_INTERACTIVE, // short commands, live captions
+    REQUEST_CLASS_BATCH,       // long uploads
+};
+
+const char * request_class_str(request_class cls) {
+    switch (cls) {
+        case REQUEST_CLASS_INTERACTIVE: return "interactive";
+        case REQUEST_CLASS_BATCH:       return "batch";
     }
-    // whisper init
-    struct whisper_context_params cparams = whisper_context_default_params();
 
-    cparams.use_gpu    = params.use_gpu;
-    cparams.gpu_device = params.gpu_device;
-    cparams.flash_attn = params.flash_attn;
+    return "unknown";
+}
 
-    if (!params.dtw.empty()) {
-        cparams.dtw_token_timestamps = true;
-        cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
+struct sched_ticket {
+    request_class cls = REQUEST_CLASS_INTERACTIVE;
 
-        if (params.dtw == "tiny") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY;
-        }
-        if (params.dtw == "tiny.en") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY_EN;
-        }
-        if (params.dtw == "base") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE;
-        }
-        if (params.dtw == "base.en") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE_EN;
-        }
-        if (params.dtw == "small") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(); // max - none
+
+    uint64_t seq = 0; // arrival order
+
+    bool granted = false; // the request holds a slot
+    bool paused  = false; // the request was preempted and waits to resume
+
+    int n_preempted = 0;
+};
+
+struct request_scheduler {
+    int n_slots   = 1;
+    int n_preempt = 0; // requests that can be paused at the same time
+
+    int n_running = 0;
+    int n_paused  = 0;
+
+    uint64_t seq = 0;
+
+    std::vector<sched_ticket *> waiting;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // true if a is served before b
+    static bool before(const sched_ticket & a, const sched_ticket & b) {
+        if (a.cls != b.cls) {
+            return a.cls < b.cls;
         }
-        if (params.dtw == "small.en") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL_EN;
+        if (a.deadline != b.deadline) {
+            return a.deadline < b.deadline;
         }
-        if (params.dtw == "medium") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM;
+        return a.seq < b.seq;
+    }
+
+    // wait for a slot
+    void acquire(sched_ticket & ticket) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        ticket.seq = seq++;
+        waiting.push_back(&ticket);
+
+        dispatch();
+        cv.notify_all();
+
+        cv.wait(lock, [&]() { return ticket.granted; });
+    }
+
+    void release(sched_ticket & ticket) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            ticket.granted = false;
+            n_running--;
+
+            dispatch();
         }
-        if (params.dtw == "medium.en") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM_EN;
+
+        cv.notify_all();
+    }
+
+    // called by a running request between two windows - returns true if it was paused
+    bool yield(sched_ticket & ticket) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (waiting.empty() || n_paused >= n_preempt) {
+            return false;
         }
-        if (params.dtw == "large.v1") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V1;
+
+        const auto best = std::min_element(waiting.begin(), waiting.end(),
+                [](const sched_ticket * a, const sched_ticket * b) { return before(*a, *b); });
+
+        if (!before(**best, ticket)) {
+            return false;
         }
-        if (params.dtw == "large.v2") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V2;
+
+        ticket.granted = false;
+        ticket.paused  = true;
+        ticket.n_preempted++;
+
+        n_running--;
+        n_paused++;
+        waiting.push_back(&ticket);
+
+        dispatch();
+        cv.notify_all();
+
+        cv.wait(lock, [&]() { return ticket.granted; });
+
+        return true;
+    }
+
+    // give the free slots to the best ranked waiting requests - the caller notifies cv
+    void dispatch() {
+        while (n_running < n_slots && !waiting.empty()) {
+            auto best = std::min_element(waiting.begin(), waiting.end(),
+                    [](const sched_ticket * a, const sched_ticket * b) { return before(*a, *b); });
+
+            sched_ticket & ticket = **best;
+            waiting.erase(best);
+
+            if (ticket.paused) {
+                ticket.paused = false;
+                n_paused--;
+            }
+
+            ticket.granted = true;
+            n_running++;
         }
-        if (params.dtw == "large.v3") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3;
+    }
+};
+
+// [EXPERIMENTAL] model registry
+//
+// The server holds any number of models, each registered under a name. Requests hold a reference to the model
+// they run on, so that a model replaced with /load or evicted from memory is freed only once the last request
+// that uses it has finished.
+
+// [EXPERIMENTAL] parakeet states of one model - a request waits for a free state, so that up to n_max requests
+// run on the model at the same time
+struct parakeet_pool {
+    parakeet_context * ctx = nullptr;
+
+    int n_max  = 0;
+    int n_used = 0;
+
+    size_t state_size = 0; // bytes allocated by one state
+
+    std::vector<parakeet_state *> idle;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // returns nullptr if a state cannot be created
+    parakeet_state * acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        cv.wait(lock, [&]() { return n_used < n_max; });
+
+        parakeet_state * state = nullptr;
+        if (!idle.empty()) {
+            state = idle.back();
+            idle.pop_back();
+        } else {
+            state = parakeet_init_state(ctx);
+            if (state == nullptr) {
+                return nullptr;
+            }
+            state_size = parakeet_get_state_memory_size(state);
         }
-        if (params.dtw == "large.v3.turbo") {
-            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3_TURBO;
+
+        n_used++;
+
+        return state;
+    }
+
+    void release(parakeet_state * state) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // the encoder graph of long audio grows with its length - keep track of the largest state
+            state_size = std::max(state_size, parakeet_get_state_memory_size(state));
+
+            idle.push_back(state);
+            n_used--;
         }
 
-        if (cparams.dtw_aheads_preset == WHISPER_AHEADS_NONE) {
-            fprintf(stderr, "error: unknown DTW preset '%s'\n", params.dtw.c_str());
-            return 3;
+        cv.notify_one();
+    }
+
+    // free the idle states - no state can be in use
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto * state : idle) {
+            parakeet_free_state(state);
         }
+        idle.clear();
     }
+};
 
-    std::unique_ptr<httplib::Server> svr = std::make_unique<httplib::Server>();
-    std::atomic<server_state> state{SERVER_STATE_LOADING_MODEL};
+struct server_model {
+    std::string name;
+    std::string path;
 
-    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    model_backend backend = MODEL_BACKEND_WHISPER;
 
-    if (ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize whisper context\n");
-        return 3;
-    }
+    whisper_context  * ctx  = nullptr;
+    parakeet_context * pctx = nullptr;
 
-    // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-    whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
-    state.store(SERVER_STATE_READY);
+    size_t size = 0; // size of the model file, used as the memory estimate for the budget
 
+    // modification time of the model file when it was loaded - with the size, it tells apart the files that were
+    // loaded from the same path in the keys of the result cache
+    int64_t mtime = 0;
 
-    svr->set_default_headers({{"Server", "whisper.cpp"},
-                             {"Access-Control-Allow-Origin", "*"},
-                             {"Access-Control-Allow-Headers", "content-type, authorization"}});
+    // the default state of the whisper context is used by one request at a time
+    std::mutex mutex;
 
-    std::string const default_content = R"(
-    <html>
-    <head>
-        <title>Whisper.cpp Server</title>
-        <meta charset="utf-8">
-        <meta name="viewport" content="width=device-width">
-        <style>
-        body {
-            font-family: sans-serif;
-        }
-        form {
-            display: flex;
-            flex-direction: column;
-            align-items: flex-start;
+    // states of the realtime sessions on this model
+    state_pool pool;
+
+    // states of the /inference requests that can be paused by the scheduler
+    state_pool requests;
+
+    // the slots of the /inference requests on this model
+    request_scheduler sched;
+
+    // states of the parakeet requests on this model
+    parakeet_pool ppool;
+
+    ~server_model() {
+        pool.reset(nullptr);
+        requests.reset(nullptr);
+        ppool.reset();
+
+        if (ctx) {
+            whisper_free(ctx);
         }
-        label {
-            margin-bottom: 0.5rem;
+        if (pctx) {
+            parakeet_free(pctx);
+        }
+    }
+};
+
+struct stream_session {
+    std::mutex mutex;
+
+    std::shared_ptr<server_model> model;
+
+    whisper_state  * state  = nullptr;
+    whisper_stream * stream = nullptr; // nullptr once the session is closed
+
+    // the full params of the stream reference the strings of these params
+    whisper_params params;
+
+    bool f32 = false; // f32le samples instead of s16le
+
+    // segments committed during the current push
+    json committed = json::array();
+
+    std::chrono::steady_clock::time_point t_last;
+};
+
+void stream_commit_callback(struct whisper_context * /*ctx*/, struct whisper_stream * /*stream*/, const char * text, int64_t t0, int64_t t1, void * user_data) {
+    auto * session = (stream_session *) user_data;
+
+    session->committed.push_back(json{
+        {"text",  text},
+        {"start", t0 * 0.01},
+        {"end",   t1 * 0.01},
+    });
+}
+
+// the caller must hold the mutex of the session
+void stream_session_close(stream_session & session) {
+    if (session.stream == nullptr) {
+        return;
+    }
+
+    whisper_stream_free(session.stream);
+    session.stream = nullptr;
+
+    session.model->pool.release(session.state);
+    session.state = nullptr;
+
+    session.model.reset();
+}
+
+struct model_slot {
+    std::string path;
+
+    model_backend backend = MODEL_BACKEND_WHISPER;
+
+    std::shared_ptr<server_model> model; // nullptr while the model is not in memory
+
+    std::chrono::steady_clock::time_point t_last;
+
+    // serializes the loads into this slot
+    std::mutex load_mutex;
+};
+
+struct model_registry {
+    whisper_context_params  cparams;
+    parakeet_context_params pcparams;
+
+    std::string openvino_encode_device;
+
+    int    n_streams         = 0;
+    int    n_requests        = 0; // request states per whisper model
+    int    n_sched_slots     = 1; // running requests per whisper model
+    int    n_sched_preempt   = 0; // paused requests per whisper model
+    int    n_parakeet_states = 0;
+    size_t budget            = 0; // bytes of loaded models, 0 - unlimited
+
+    std::string default_name;
+
+    std::map<std::string, std::shared_ptr<model_slot>> slots;
+    std::mutex mutex;
+
+    // register a model without loading it
+    void add(const std::string & name, const std::string & path, model_backend backend) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto & slot = slots[name];
+        if (!slot) {
+            slot = std::make_shared<model_slot>();
+        }
+        slot->path    = path;
+        slot->backend = backend;
+    }
+
+    bool has(const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return slots.find(name) != slots.end();
+    }
+
+    // the model registered under name, loaded first if it is not in memory
+    // returns nullptr if the name is unknown or the model fails to load
+    std::shared_ptr<server_model> acquire(const std::string & name) {
+        std::shared_ptr<model_slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = slots.find(name);
+            if (it == slots.end()) {
+                return nullptr;
+            }
+
+            slot = it->second;
+            slot->t_last = std::chrono::steady_clock::now();
+            if (slot->model) {
+                return slot->model;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock_load(slot->load_mutex);
+
+        std::string path;
+        model_backend backend;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (slot->model) {
+                return slot->model;
+            }
+            path    = slot->path;
+            backend = slot->backend;
+        }
+
+        auto model = load_file(name, path, backend);
+        if (!model) {
+            return nullptr;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot->model = model;
+        }
+
+        evict(name);
+
+        return model;
+    }
+
+    // load path and register it under name - an existing model with that name is replaced only once the new one
+    // is ready, and requests that are still running on it finish first
+    bool load(const std::string & name, const std::string & path, model_backend backend) {
+        std::shared_ptr<model_slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto & s = slots[name];
+            if (!s) {
+                s = std::make_shared<model_slot>();
+            }
+            slot = s;
+        }
+
+        std::lock_guard<std::mutex> lock_load(slot->load_mutex);
+
+        auto model = load_file(name, path, backend);
+
+        std::shared_ptr<server_model> model_old;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!model) {
+                // keep the previous model, forget the name if it never had one
+                if (slot->path.empty()) {
+                    slots.erase(name);
+                }
+                return false;
+            }
+
+            model_old = std::move(slot->model);
+
+            slot->path    = path;
+            slot->backend = backend;
+            slot->model   = model;
+            slot->t_last  = std::chrono::steady_clock::now();
+        }
+
+        evict(name);
+
+        return true;
+    }
+
+    // unload idle models, least recently used first, until the loaded models fit in the budget
+    // the default model and the model named keep are never unloaded
+    void evict(const std::string & keep) {
+        std::vector<std::shared_ptr<server_model>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (budget == 0) {
+                return;
+            }
+
+            size_t total = 0;
+            for (const auto & it : slots) {
+                if (it.second->model) {
+                    total += it.second->model->size;
+                }
+            }
+
+            while (total > budget) {
+                model_slot * lru = nullptr;
+                for (const auto & it : slots) {
+                    auto & slot = *it.second;
+
+                    // a model is idle if only the registry references it
+                    if (!slot.model || slot.model.use_count() > 1 || it.first == keep || it.first == default_name) {
+                        continue;
+                    }
+                    if (lru == nullptr || slot.t_last < lru->t_last) {
+                        lru = &slot;
+                    }
+                }
+
+                if (lru == nullptr) {
+                    break;
+                }
+
+                fprintf(stderr, "%s: unloading model '%s' (%zu MB)\n", __func__, lru->model->name.c_str(), lru->model->size/1024/1024);
+
+                total -= lru->model->size;
+                evicted.push_back(std::move(lru->model));
+            }
+        }
+
+        // the contexts are freed here, without holding the lock
+    }
+
+    json list() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        json models = json::array();
+        for (const auto & it : slots) {
+            const auto & slot = *it.second;
+
+            models.push_back(json{
+                {"name",    it.first},
+                {"path",    slot.path},
+                {"backend", model_backend_str(slot.backend)},
+                {"loaded",  slot.model != nullptr},
+                {"in_use",  slot.model != nullptr && slot.model.use_count() > 1},
+                {"size",    slot.model ? slot.model->size : 0},
+                {"default", it.first == default_name},
+            });
+        }
+
+        return models;
+    }
+
+    std::vector<std::shared_ptr<server_model>> loaded() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::vector<std::shared_ptr<server_model>> result;
+        for (const auto & it : slots) {
+            if (it.second->model) {
+                result.push_back(it.second->model);
+            }
+        }
+
+        return result;
+    }
+
+    // unload all models - no request can be running
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        slots.clear();
+    }
+
+    std::shared_ptr<server_model> load_file(const std::string & name, const std::string & path, model_backend backend) {
+        fprintf(stderr, "%s: loading %s model '%s' from '%s'\n", __func__, model_backend_str(backend), name.c_str(), path.c_str());
+
+        auto model = std::make_shared<server_model>();
+
+        model->name    = name;
+        model->path    = path;
+        model->backend = backend;
+
+        if (backend == MODEL_BACKEND_PARAKEET) {
+            // the requests run on the states of the pool, the context does not need its own
+            model->pctx = parakeet_init_from_file_with_params_no_state(path.c_str(), pcparams);
+            if (model->pctx == nullptr) {
+                fprintf(stderr, "%s: failed to load model '%s' from '%s'\n", __func__, name.c_str(), path.c_str());
+                return nullptr;
+            }
+
+            model->ppool.ctx   = model->pctx;
+            model->ppool.n_max = n_parakeet_states;
+        } else {
+            model->ctx = whisper_init_from_file_with_params(path.c_str(), cparams);
+            if (model->ctx == nullptr) {
+                fprintf(stderr, "%s: failed to load model '%s' from '%s'\n", __func__, name.c_str(), path.c_str());
+                return nullptr;
+            }
+
+            // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
+            whisper_ctx_init_openvino_encoder(model->ctx, nullptr, openvino_encode_device.c_str(), nullptr);
+
+            model->pool.ctx   = model->ctx;
+            model->pool.n_max = n_streams;
+
+            model->requests.ctx   = model->ctx;
+            model->requests.n_max = n_requests;
+
+            model->sched.n_slots   = n_sched_slots;
+            model->sched.n_preempt = n_sched_preempt;
+        }
+
+        std::error_code ec;
+        model->size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            model->size = 0;
+        }
+
+        const auto mtime = std::filesystem::last_write_time(path, ec);
+        model->mtime = ec ? 0 : (int64_t) mtime.time_since_epoch().count();
+
+        return model;
+    }
+};
+
+// [EXPERIMENTAL] result cache
+//
+// Transcripts are cached under a hash of the decoded audio and of the params that affect the decoding, so that
+// resubmitted audio is answered without inference - in any response format, since those are rendered from the
+// transcript. Entries are kept in memory up to a size bound and, with a cache directory, also written to disk.
+
+uint64_t hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t hash_fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+
+    return k;
+}
+
+// 64-bit hash of a buffer, mixed one word at a time in the style of MurmurHash3
+uint64_t hash_bytes(const void * data, size_t size, uint64_t seed = 0) {
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+
+    const uint8_t * p = (const uint8_t *) data;
+
+    uint64_t h = seed;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t k;
+        memcpy(&k, p + i, sizeof(k));
+
+        k *= c1;
+        k  = hash_rotl(k, 31);
+        k *= c2;
+
+        h ^= k;
+        h  = hash_rotl(h, 27)*5 + 0x52dce729;
+    }
+
+    uint64_t k = 0;
+    for (size_t j = 0; i + j < size; ++j) {
+        k |= uint64_t(p[i + j]) << (8*j);
+    }
+    k *= c1;
+    k  = hash_rotl(k, 31);
+    k *= c2;
+    h ^= k;
+
+    return hash_fmix(h ^ size);
+}
+
+std::string hash_hex(uint64_t h) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) h);
+
+    return buf;
+}
+
+// everything that changes the transcript - the response format and the diarization are applied when rendering
+std::string get_cache_key(const server_model & model, const whisper_params & params, const std::vector<float> & pcmf32) {
+    const json key = {
+        {"audio",                       hash_hex(hash_bytes(pcmf32.data(), pcmf32.size()*sizeof(float)))},
+        {"n_samples",                   pcmf32.size()},
+        {"model",                       model.name},
+        {"model_path",                  model.path},
+        {"model_size",                  model.size},
+        {"model_mtime",                 model.mtime},
+        {"n_processors",                params.n_processors},
+        {"offset_t_ms",                 params.offset_t_ms},
+        {"duration_ms",                 params.duration_ms},
+        {"max_context",                 params.max_context},
+        {"max_len",                     params.max_len},
+        {"split_on_word",               params.split_on_word},
+        {"best_of",                     params.best_of},
+        {"beam_size",                   params.beam_size},
+        {"audio_ctx",                   params.audio_ctx},
+        {"word_thold",                  params.word_thold},
+        {"entropy_thold",               params.entropy_thold},
+        {"logprob_thold",               params.logprob_thold},
+        {"temperature",                 params.temperature},
+        {"temperature_inc",             params.temperature_inc},
+        {"no_speech_thold",             params.no_speech_thold},
+        {"translate",                   params.translate},
+        {"language",                    params.language},
+        {"detect_language",             params.detect_language},
+        {"tinydiarize",                 params.tinydiarize},
+        {"print_special",               params.print_special},
+        {"no_timestamps",               params.no_timestamps},
+        {"token_timestamps",            params.token_timestamps},
+        {"suppress_nst",                params.suppress_nst},
+        {"no_context",                  params.no_context},
+        {"prompt",                      params.prompt},
+        {"carry_initial_prompt",        params.carry_initial_prompt},
+        {"vad",                         params.vad},
+        {"vad_model",                   params.vad_model},
+        {"vad_threshold",               params.vad_threshold},
+        {"vad_min_speech_duration_ms",  params.vad_min_speech_duration_ms},
+        {"vad_min_silence_duration_ms", params.vad_min_silence_duration_ms},
+        {"vad_max_speech_duration_s",   params.vad_max_speech_duration_s},
+        {"vad_speech_pad_ms",           params.vad_speech_pad_ms},
+        {"vad_samples_overlap",         params.vad_samples_overlap},
+    };
+
+    return key.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+// token texts can be partial UTF-8 sequences, so the disk entries are stored as CBOR, which does not validate them
+json transcript_to_json(const transcript & result) {
+    json segments = json::array();
+    for (const auto & segment : result.segments) {
+        json tokens = json::array();
+        for (const auto & token : segment.tokens) {
+            tokens.push_back(json::array({token.id, token.text, token.p, token.plog, token.t0, token.t1, token.t_dtw, token.word_start}));
+        }
+
+        segments.push_back(json{
+            {"text",           segment.text},
+            {"t0",             segment.t0},
+            {"t1",             segment.t1},
+            {"no_speech_prob", segment.no_speech_prob},
+            {"tokens",         tokens},
+        });
+    }
+
+    return json{
+        {"lang_id",          result.lang_id},
+        {"token_eot",        result.token_eot},
+        {"subword_tokens",   result.subword_tokens},
+        {"token_probs",      result.token_probs},
+        {"segments",         segments},
+        {"detected_lang_id", result.detected_lang_id},
+        {"lang_probs",       result.lang_probs},
+    };
+}
+
+transcript transcript_from_json(const json & j) {
+    transcript result;
+
+    result.lang_id          = j.at("lang_id");
+    result.token_eot        = j.at("token_eot");
+    result.subword_tokens   = j.value("subword_tokens", false); // not in the entries of older servers
+    result.token_probs      = j.value("token_probs",    true);
+    result.detected_lang_id = j.at("detected_lang_id");
+    result.lang_probs       = j.at("lang_probs").get<std::vector<float>>();
+
+    for (const auto & js : j.at("segments")) {
+        transcript_segment segment;
+
+        segment.text           = js.at("text");
+        segment.t0             = js.at("t0");
+        segment.t1             = js.at("t1");
+        segment.no_speech_prob = js.at("no_speech_prob");
+
+        for (const auto & jt : js.at("tokens")) {
+            segment.tokens.push_back({jt.at(0), jt.at(1), jt.at(2), jt.at(3), jt.at(4), jt.at(5), jt.at(6), jt.size() > 7 && jt.at(7).get<bool>()});
+        }
+
+        result.segments.push_back(std::move(segment));
+    }
+
+    return result;
+}
+
+struct result_cache {
+    size_t budget = 0; // bytes of cached transcripts in memory, 0 - disabled
+
+    std::string dir; // on-disk store, empty - memory only
+
+    size_t size = 0;
+
+    // most recently used first
+    std::list<std::pair<std::string, std::shared_ptr<const transcript>>> entries;
+    std::unordered_map<std::string, decltype(entries)::iterator> index;
+
+    std::mutex mutex;
+
+    bool enabled() const {
+        return budget > 0;
+    }
+
+    std::shared_ptr<const transcript> get(const std::string & key) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = index.find(key);
+            if (it != index.end()) {
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->second;
+            }
+        }
+
+        if (dir.empty()) {
+            return nullptr;
+        }
+
+        std::ifstream fin(get_path(key), std::ios::binary);
+        if (!fin) {
+            return nullptr;
+        }
+
+        const std::vector<uint8_t> data{std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+
+        std::shared_ptr<const transcript> result;
+        try {
+            const json j = json::from_cbor(data);
+
+            // the file name is only a hash of the key
+            if (j.at("key") != key) {
+                return nullptr;
+            }
+
+            result = std::make_shared<const transcript>(transcript_from_json(j.at("transcript")));
+        } catch (const std::exception & e) {
+            fprintf(stderr, "%s: ignoring invalid cache entry '%s': %s\n", __func__, get_path(key).c_str(), e.what());
+            return nullptr;
+        }
+
+        insert(key, result);
+
+        return result;
+    }
+
+    void put(const std::string & key, const std::shared_ptr<const transcript> & result) {
+        insert(key, result);
+
+        if (dir.empty()) {
+            return;
+        }
+
+        // write to a temporary file first, so that readers never see a partial entry
+        const std::string path = get_path(key);
+        const std::string path_tmp = generate_temp_filename(dir, "whisper-cache", ".tmp");
+
+        const std::vector<uint8_t> data = json::to_cbor(json{
+            {"key",        key},
+            {"transcript", transcript_to_json(*result)},
+        });
+
+        {
+            std::ofstream fout(path_tmp, std::ios::binary);
+            fout.write((const char *) data.data(), data.size());
+            if (!fout) {
+                fprintf(stderr, "%s: failed to write cache entry '%s'\n", __func__, path_tmp.c_str());
+                std::remove(path_tmp.c_str());
+                return;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(path_tmp, path, ec);
+        if (ec) {
+            fprintf(stderr, "%s: failed to write cache entry '%s': %s\n", __func__, path.c_str(), ec.message().c_str());
+            std::remove(path_tmp.c_str());
+        }
+    }
+
+    std::string get_path(const std::string & key) const {
+        return (std::filesystem::path(dir) / (hash_hex(hash_bytes(key.data(), key.size())) + ".cbor")).string();
+    }
+
+    static size_t get_size(const std::string & key, const transcript & result) {
+        size_t n = key.size() + sizeof(transcript) + result.lang_probs.size()*sizeof(float);
+        for (const auto & segment : result.segments) {
+            n += sizeof(segment) + segment.text.size();
+            for (const auto & token : segment.tokens) {
+                n += sizeof(token) + token.text.size();
+            }
+        }
+
+        return n;
+    }
+
+    void insert(const std::string & key, const std::shared_ptr<const transcript> & result) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            size -= get_size(key, *it->second->second);
+            entries.erase(it->second);
+            index.erase(it);
+        }
+
+        entries.emplace_front(key, result);
+        index[key] = entries.begin();
+        size += get_size(key, *result);
+
+        // evict the least recently used entries - the new entry is kept even if it is larger than the budget
+        while (size > budget && entries.size() > 1) {
+            const auto & last = entries.back();
+
+            size -= get_size(last.first, *last.second);
+            index.erase(last.first);
+            entries.pop_back();
+        }
+    }
+};
+
+// [EXPERIMENTAL] Prometheus metrics
+//
+// Served in the Prometheus text format by GET /metrics. Requests are recorded into fixed-bucket histograms made
+// of atomic counters, so recording does not take a lock. The per-stage times are the difference of the library
+// timings of the state of a request before and after it, which is accurate because a state is used by one
+// request at a time.
+
+const std::vector<double> metrics_buckets_seconds = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300 };
+const std::vector<double> metrics_buckets_rtf     = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2, 5 };
+const std::vector<double> metrics_buckets_count   = { 0, 1, 2, 3, 4, 5, 10 };
+
+struct metrics_histogram {
+    const std::vector<double> bounds; // upper bounds of the buckets, without +Inf
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts; // not cumulative, the last one is +Inf
+
+    std::atomic<uint64_t> count{0};
+    std::atomic<double>   sum{0.0};
+
+    explicit metrics_histogram(const std::vector<double> & bounds) : bounds(bounds), counts(new std::atomic<uint64_t>[bounds.size() + 1]) {
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+            counts[i] = 0;
+        }
+    }
+
+    void observe(double v) {
+        const size_t i = std::lower_bound(bounds.begin(), bounds.end(), v) - bounds.begin();
+
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+
+        double cur = sum.load(std::memory_order_relaxed);
+        while (!sum.compare_exchange_weak(cur, cur + v, std::memory_order_relaxed)) {
+        }
+    }
+
+    void write(std::stringstream & ss, const std::string & name, const std::string & labels) const {
+        const std::string sep = labels.empty() ? "" : ",";
+
+        uint64_t n = 0;
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+            n += counts[i].load(std::memory_order_relaxed);
+
+            ss << name << "_bucket{" << labels << sep << "le=\"";
+            if (i < bounds.size()) {
+                ss << bounds[i];
+            } else {
+                ss << "+Inf";
+            }
+            ss << "\"} " << n << "\n";
+        }
+
+        const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+
+        ss << name << "_sum"   << braces << " " << sum.load(std::memory_order_relaxed)   << "\n";
+        ss << name << "_count" << braces << " " << count.load(std::memory_order_relaxed) << "\n";
+    }
+};
+
+// the metrics of the requests served by one backend
+struct backend_metrics {
+    const std::string name;
+
+    std::atomic<uint64_t> n_requests  {0};
+    std::atomic<uint64_t> n_failed    {0};
+    std::atomic<uint64_t> n_cache_hits{0};
+    std::atomic<uint64_t> n_samples   {0}; // audio transcribed
+    std::atomic<uint64_t> n_fallbacks {0};
+    std::atomic<uint64_t> n_preempted {0}; // times a request was paused by the scheduler
+
+    std::atomic<int32_t> n_waiting{0}; // requests waiting for their model
+    std::atomic<int32_t> n_running{0};
+
+    metrics_histogram queue_wait{metrics_buckets_seconds};
+    metrics_histogram processing{metrics_buckets_seconds};
+    metrics_histogram rtf       {metrics_buckets_rtf};
+    metrics_histogram fallbacks {metrics_buckets_count};
+
+    // time spent in each stage of the library per request
+    std::map<std::string, metrics_histogram> stages;
+
+    backend_metrics(const std::string & name, const std::vector<std::string> & stage_names) : name(name) {
+        for (const auto & stage : stage_names) {
+            stages.emplace(std::piecewise_construct, std::forward_as_tuple(stage), std::forward_as_tuple(metrics_buckets_seconds));
+        }
+    }
+
+    void observe_stage(const std::string & stage, int64_t us_before, int64_t us_after) {
+        stages.at(stage).observe(std::max<int64_t>(0, us_after - us_before)*1e-6);
+    }
+
+    void observe(const whisper_timings & t0, const whisper_timings & t1) {
+        observe_stage("mel",    t0.t_mel_us,    t1.t_mel_us);
+        observe_stage("encode", t0.t_encode_us, t1.t_encode_us);
+        observe_stage("decode", t0.t_decode_us, t1.t_decode_us);
+        observe_stage("batchd", t0.t_batchd_us, t1.t_batchd_us);
+        observe_stage("prompt", t0.t_prompt_us, t1.t_prompt_us);
+        observe_stage("sample", t0.t_sample_us, t1.t_sample_us);
+
+        const int n_fail = std::max(0, (t1.n_fail_p + t1.n_fail_h) - (t0.n_fail_p + t0.n_fail_h));
+
+        fallbacks.observe(n_fail);
+        n_fallbacks.fetch_add(n_fail, std::memory_order_relaxed);
+    }
+
+    void observe(const parakeet_timings & t0, const parakeet_timings & t1) {
+        observe_stage("mel",     t0.t_mel_us,     t1.t_mel_us);
+        observe_stage("encode",  t0.t_encode_us,  t1.t_encode_us);
+        observe_stage("decode",  t0.t_decode_us,  t1.t_decode_us);
+        observe_stage("predict", t0.t_predict_us, t1.t_predict_us);
+        observe_stage("sample",  t0.t_sample_us,  t1.t_sample_us);
+    }
+
+    // a finished request - the audio is n_samples long and took t_ms to transcribe
+    void observe_request(size_t n_samples_req, double t_ms) {
+        const double t_audio = double(n_samples_req)/WHISPER_SAMPLE_RATE;
+
+        n_samples.fetch_add(n_samples_req, std::memory_order_relaxed);
+
+        processing.observe(t_ms*1e-3);
+        if (t_audio > 0.0) {
+            rtf.observe(t_ms*1e-3/t_audio);
+        }
+    }
+};
+
+// increments a gauge for the lifetime of the object
+struct metrics_gauge_guard {
+    std::atomic<int32_t> & value;
+
+    explicit metrics_gauge_guard(std::atomic<int32_t> & value) : value(value) {
+        value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~metrics_gauge_guard() {
+        value.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+struct server_metrics {
+    backend_metrics whisper {"whisper",  { "mel", "encode", "decode", "batchd", "prompt", "sample" }};
+    backend_metrics parakeet{"parakeet", { "mel", "encode", "decode", "predict", "sample" }};
+
+    // time from the arrival of a whisper request to its result, per scheduler class
+    metrics_histogram latency_interactive{metrics_buckets_seconds};
+    metrics_histogram latency_batch      {metrics_buckets_seconds};
+
+    // the backends that are reported
+    std::vector<backend_metrics *> backends() {
+        return { &whisper, &parakeet };
+    }
+};
+
+void metrics_write_header(std::stringstream & ss, const std::string & name, const char * type, const char * help) {
+    ss << "# HELP " << name << " " << help << "\n";
+    ss << "# TYPE " << name << " " << type << "\n";
+}
+
+std::string metrics_label(const char * key, const std::string & value) {
+    // the names come from the command line and from requests
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+        }
+        if (c == '\n') {
+            escaped += "\\n";
+            continue;
+        }
+        escaped += c;
+    }
+
+    return std::string(key) + "=\"" + escaped + "\"";
+}
+
+std::string metrics_render(server_metrics & metrics, model_registry & models) {
+    std::stringstream ss;
+
+    const auto backends = metrics.backends();
+
+    const auto write_counter = [&](const std::string & name, const char * type, const char * help, const std::function<double(backend_metrics &)> & get) {
+        metrics_write_header(ss, name, type, help);
+        for (auto * backend : backends) {
+            ss << name << "{" << metrics_label("backend", backend->name) << "} " << get(*backend) << "\n";
+        }
+    };
+
+    write_counter("whisper_server_requests_total", "counter", "Transcription requests",
+            [](backend_metrics & b) { return double(b.n_requests.load()); });
+    write_counter("whisper_server_requests_failed_total", "counter", "Transcription requests that failed or were aborted",
+            [](backend_metrics & b) { return double(b.n_failed.load()); });
+    write_counter("whisper_server_cache_hits_total", "counter", "Transcription requests served from the result cache",
+            [](backend_metrics & b) { return double(b.n_cache_hits.load()); });
+    write_counter("whisper_server_audio_seconds_total", "counter", "Seconds of audio transcribed",
+            [](backend_metrics & b) { return double(b.n_samples.load())/WHISPER_SAMPLE_RATE; });
+    write_counter("whisper_server_fallbacks_total", "counter", "Temperature fallbacks while decoding",
+            [](backend_metrics & b) { return double(b.n_fallbacks.load()); });
+    write_counter("whisper_server_preemptions_total", "counter", "Times a request was paused for a higher priority one",
+            [](backend_metrics & b) { return double(b.n_preempted.load()); });
+    write_counter("whisper_server_requests_waiting", "gauge", "Transcription requests waiting for their model",
+            [](backend_metrics & b) { return double(b.n_waiting.load()); });
+    write_counter("whisper_server_requests_running", "gauge", "Transcription requests running on their model",
+            [](backend_metrics & b) { return double(b.n_running.load()); });
+
+    const auto write_histogram = [&](const std::string & name, const char * help, metrics_histogram backend_metrics::*member) {
+        metrics_write_header(ss, name, "histogram", help);
+        for (auto * backend : backends) {
+            (backend->*member).write(ss, name, metrics_label("backend", backend->name));
+        }
+    };
+
+    write_histogram("whisper_server_queue_wait_seconds", "Time spent waiting for the model",     &backend_metrics::queue_wait);
+    write_histogram("whisper_server_processing_seconds", "Time spent transcribing",              &backend_metrics::processing);
+    write_histogram("whisper_server_real_time_factor",   "Processing time over audio duration",  &backend_metrics::rtf);
+    write_histogram("whisper_server_fallbacks",          "Temperature fallbacks per request",    &backend_metrics::fallbacks);
+
+    metrics_write_header(ss, "whisper_server_request_seconds", "histogram", "Time from the arrival of a request to its result per scheduler class");
+    metrics.latency_interactive.write(ss, "whisper_server_request_seconds", metrics_label("class", request_class_str(REQUEST_CLASS_INTERACTIVE)));
+    metrics.latency_batch      .write(ss, "whisper_server_request_seconds", metrics_label("class", request_class_str(REQUEST_CLASS_BATCH)));
+
+    metrics_write_header(ss, "whisper_server_stage_seconds", "histogram", "Time spent in each processing stage per request");
+    for (auto * backend : backends) {
+        for (const auto & it : backend->stages) {
+            it.second.write(ss, "whisper_server_stage_seconds", metrics_label("backend", backend->name) + "," + metrics_label("stage", it.first));
+        }
+    }
+
+    // model and state pool gauges
+    const auto loaded = models.loaded();
+
+    metrics_write_header(ss, "whisper_server_model_size_bytes", "gauge", "Size of the loaded models");
+    for (const auto & model : loaded) {
+        ss << "whisper_server_model_size_bytes{" << metrics_label("model", model->name) << "} " << model->size << "\n";
+    }
+
+    // the realtime sessions of whisper models and the requests of parakeet models
+    const auto write_pool = [&](const std::shared_ptr<server_model> & model, const std::function<void(int, size_t, int, size_t)> & write) {
+        if (model->backend == MODEL_BACKEND_PARAKEET) {
+            std::lock_guard<std::mutex> lock(model->ppool.mutex);
+            write(model->ppool.n_used, model->ppool.idle.size(), model->ppool.n_max, model->ppool.state_size);
+        } else {
+            std::lock_guard<std::mutex> lock(model->pool.mutex);
+            write(model->pool.n_used, model->pool.idle.size(), model->pool.n_max, model->pool.state_size);
+        }
+    };
+
+    metrics_write_header(ss, "whisper_server_pool_states", "gauge", "States of the state pool");
+    for (const auto & model : loaded) {
+        write_pool(model, [&](int n_used, size_t n_idle, int n_max, size_t /*state_size*/) {
+            const std::string label = metrics_label("model", model->name);
+
+            ss << "whisper_server_pool_states{" << label << ",state=\"used\"} " << n_used << "\n";
+            ss << "whisper_server_pool_states{" << label << ",state=\"idle\"} " << n_idle << "\n";
+            ss << "whisper_server_pool_states{" << label << ",state=\"max\"} "  << n_max  << "\n";
+        });
+    }
+
+    metrics_write_header(ss, "whisper_server_state_memory_bytes", "gauge", "Memory allocated by one state of the pool");
+    for (const auto & model : loaded) {
+        write_pool(model, [&](int /*n_used*/, size_t /*n_idle*/, int /*n_max*/, size_t state_size) {
+            ss << "whisper_server_state_memory_bytes{" << metrics_label("model", model->name) << "} " << state_size << "\n";
+        });
+    }
+
+    return ss.str();
+}
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    ggml_backend_load_all();
+
+    whisper_params params;
+    server_params sparams;
+
+    if (whisper_params_parse(argc, argv, params, sparams) == false) {
+        whisper_print_usage(argc, argv, params, sparams);
+        return 1;
+    }
+
+    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
+        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
+        whisper_print_usage(argc, argv, params, sparams);
+        exit(0);
+    }
+
+    if (params.diarize && params.tinydiarize) {
+        fprintf(stderr, "error: cannot use both --diarize and --tinydiarize\n");
+        whisper_print_usage(argc, argv, params, sparams);
+        exit(0);
+    }
+
+    if (sparams.ffmpeg_converter) {
+        check_ffmpeg_availibility();
+    }
+    // whisper init
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.gpu_device = params.gpu_device;
+    cparams.flash_attn = params.flash_attn;
+
+    if (!params.dtw.empty()) {
+        cparams.dtw_token_timestamps = true;
+        cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
+
+        if (params.dtw == "tiny") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY;
+        }
+        if (params.dtw == "tiny.en") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY_EN;
+        }
+        if (params.dtw == "base") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE;
+        }
+        if (params.dtw == "base.en") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE_EN;
+        }
+        if (params.dtw == "small") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL;
+        }
+        if (params.dtw == "small.en") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL_EN;
+        }
+        if (params.dtw == "medium") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM;
+        }
+        if (params.dtw == "medium.en") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM_EN;
+        }
+        if (params.dtw == "large.v1") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V1;
+        }
+        if (params.dtw == "large.v2") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V2;
+        }
+        if (params.dtw == "large.v3") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3;
+        }
+        if (params.dtw == "large.v3.turbo") {
+            cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3_TURBO;
+        }
+
+        if (cparams.dtw_aheads_preset == WHISPER_AHEADS_NONE) {
+            fprintf(stderr, "error: unknown DTW preset '%s'\n", params.dtw.c_str());
+            return 3;
+        }
+    }
+
+    cparams.numa = numa_strategy_from_str(params.numa);
+
+    if (cparams.numa == GGML_NUMA_STRATEGY_COUNT) {
+        fprintf(stderr, "error: unsupported NUMA strategy '%s'\n", params.numa.c_str());
+        return 3;
+    }
+
+    std::unique_ptr<httplib::Server> svr = std::make_unique<httplib::Server>();
+    std::atomic<server_state> state{SERVER_STATE_LOADING_MODEL};
+
+    model_registry models;
+
+    struct parakeet_context_params pcparams = parakeet_context_default_params();
+
+    pcparams.use_gpu    = params.use_gpu;
+    pcparams.gpu_device = params.gpu_device;
+    pcparams.numa       = cparams.numa;
+
+    models.cparams                = cparams;
+    models.pcparams               = pcparams;
+    models.openvino_encode_device = params.openvino_encode_device;
+    models.n_streams              = sparams.n_streams;
+    models.n_requests             = std::max(1, sparams.sched_slots) + std::max(0, sparams.sched_preempt);
+    models.n_sched_slots          = std::max(1, sparams.sched_slots);
+    models.n_sched_preempt        = std::max(0, sparams.sched_preempt);
+    models.n_parakeet_states      = std::max(1, sparams.n_parakeet_states);
+    models.budget                 = size_t(sparams.models_budget)*1024*1024;
+    models.default_name           = sparams.model_name;
+
+    if (!models.load(sparams.model_name, params.model, sparams.backend)) {
+        fprintf(stderr, "error: failed to initialize %s context\n", model_backend_str(sparams.backend));
+        return 3;
+    }
+
+    for (const auto & it : sparams.models) {
+        models.add(std::get<0>(it), std::get<1>(it), std::get<2>(it));
+    }
+
+    state.store(SERVER_STATE_READY);
+
+
+    svr->set_default_headers({{"Server", "whisper.cpp"},
+                             {"Access-Control-Allow-Origin", "*"},
+                             {"Access-Control-Allow-Headers", "content-type, authorization"}});
+
+    std::string const default_content = R"(
+    <html>
+    <head>
+        <title>Whisper.cpp Server</title>
+        <meta charset="utf-8">
+        <meta name="viewport" content="width=device-width">
+        <style>
+        body {
+            font-family: sans-serif;
+        }
+        form {
+            display: flex;
+            flex-direction: column;
+            align-items: flex-start;
+        }
+        label {
+            margin-bottom: 0.5rem;
         }
         input, select {
             margin-bottom: 1rem;
@@ -783,7 +2318,8 @@ int main(int argc, char ** argv) {
         <pre>
     curl 127.0.0.1:)" + std::to_string(sparams.port) + R"(/load \
     -H "Content-Type: multipart/form-data" \
-    -F model="&lt;path-to-model-file&gt;"
+    -F model="&lt;path-to-model-file&gt;" \
+    -F name="&lt;model-name&gt;"
         </pre>
 
         <div>
@@ -814,6 +2350,76 @@ int main(int argc, char ** argv) {
     // store default params so we can reset after each inference request
     whisper_params default_params = params;
 
+    // [EXPERIMENTAL] result cache
+    result_cache cache;
+
+    cache.budget = size_t(sparams.cache_size)*1024*1024;
+    cache.dir    = sparams.cache_dir;
+
+    if (cache.enabled() && !cache.dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(cache.dir, ec);
+        if (ec) {
+            fprintf(stderr, "error: failed to create the cache directory '%s': %s\n", cache.dir.c_str(), ec.message().c_str());
+            return 1;
+        }
+    }
+
+    // [EXPERIMENTAL] Prometheus metrics
+    server_metrics metrics;
+
+    // [EXPERIMENTAL] realtime sessions
+    std::map<std::string, std::shared_ptr<stream_session>> sessions;
+    std::mutex sessions_mutex;
+
+    std::mt19937_64 session_rng{std::random_device{}()};
+
+    // the model selected with the 'model' field of the request, nullptr and an error response if there is none
+    auto get_model = [&](const Request & req, Response & res) -> std::shared_ptr<server_model> {
+        const std::string name = req.has_file("model") ? req.get_file_value("model").content : models.default_name;
+
+        if (!models.has(name)) {
+            fprintf(stderr, "error: unknown model '%s'\n", name.c_str());
+            res.status = 400;
+            res.set_content(json{{"error", "unknown model '" + name + "'"}}.dump(), "application/json");
+            return nullptr;
+        }
+
+        auto model = models.acquire(name);
+        if (model == nullptr) {
+            res.status = 500;
+            res.set_content(json{{"error", "failed to load model '" + name + "'"}}.dump(), "application/json");
+            return nullptr;
+        }
+
+        return model;
+    };
+
+    // close the sessions that were abandoned by their clients - the caller must hold sessions_mutex
+    auto close_idle_sessions = [&]() {
+        const auto t_now = std::chrono::steady_clock::now();
+
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            auto & session = *it->second;
+
+            std::unique_lock<std::mutex> lock_session(session.mutex, std::try_to_lock);
+            if (lock_session.owns_lock() && t_now - session.t_last > std::chrono::seconds(sparams.stream_timeout)) {
+                fprintf(stderr, "close_idle_sessions: closing idle stream session %s\n", it->first.c_str());
+                stream_session_close(session);
+                it = sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    };
+
+    auto get_session = [&](const Request & req) -> std::shared_ptr<stream_session> {
+        std::lock_guard<std::mutex> lock(sessions_mutex);
+
+        auto it = sessions.find(req.path_params.at("id"));
+        return it == sessions.end() ? nullptr : it->second;
+    };
+
     // this is only called if no index.html is found in the public --path
     svr->Get(sparams.request_path + "/", [&](const Request &, Response &res){
         res.set_content(default_content, "text/html");
@@ -824,9 +2430,6 @@ int main(int argc, char ** argv) {
     });
 
     svr->Post(sparams.request_path + sparams.inference_path, [&](const Request &req, Response &res){
-        // acquire whisper model mutex lock
-        std::lock_guard<std::mutex> lock(whisper_mutex);
-
         // first check user requested fields of the request
         if (!req.has_file("file"))
         {
@@ -838,6 +2441,8 @@ int main(int argc, char ** argv) {
         }
         auto audio_file = req.get_file_value("file");
 
+        const auto t_arrival = std::chrono::steady_clock::now();
+
         whisper_params params = default_params;
         get_req_parameters(req, params);
 
@@ -848,8 +2453,11 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (sparams.ffmpeg_converter) {
-            // if file is not wav, convert to wav
+        // decode in process - this does not need the model, so it runs before taking the lock
+        bool is_decoded = ::read_audio_data(audio_file.content.data(), audio_file.content.size(), pcmf32, pcmf32s, params.diarize);
+
+        if (!is_decoded && sparams.ffmpeg_converter) {
+            // last resort for formats that cannot be decoded in process: the ffmpeg executable
             // write to temporary file
             const std::string temp_filename = generate_temp_filename(sparams.tmp_dir, "whisper-server", ".wav");
             std::ofstream temp_file{temp_filename, std::ios::binary};
@@ -876,167 +2484,350 @@ int main(int argc, char ** argv) {
             }
             // remove temp file
             std::remove(temp_filename.c_str());
-        } else {
-            if (!::read_audio_data(audio_file.content.data(), audio_file.content.size(), pcmf32, pcmf32s, params.diarize)) {
-                fprintf(stderr, "error: failed to read audio data\n");
-                const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
+
+            is_decoded = true;
+        }
+
+        if (!is_decoded) {
+            fprintf(stderr, "error: failed to read audio data\n");
+            const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
+            res.status = 400;
+            res.set_content(error_resp, "application/json");
+            return;
+        }
+
+        printf("Successfully loaded %s\n", filename.c_str());
+
+        // the model stays alive until this request is done, even if it is replaced or evicted meanwhile
+        auto model = get_model(req, res);
+        if (model == nullptr) {
+            return;
+        }
+
+        const bool is_parakeet = model->backend == MODEL_BACKEND_PARAKEET;
+
+        auto & bmetrics = is_parakeet ? metrics.parakeet : metrics.whisper;
+        bmetrics.n_requests.fetch_add(1, std::memory_order_relaxed);
+
+        whisper_context * ctx = model->ctx;
+
+        // resolve the language options first, they are part of the cache key
+        if (!is_parakeet && !whisper_is_multilingual(ctx)) {
+            if (params.language != "en" || params.translate) {
+                params.language = "en";
+                params.translate = false;
+                fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+            }
+        }
+        if (params.detect_language) {
+            params.language = "auto";
+        }
+
+        // [EXPERIMENTAL] scheduler class - short audio is interactive unless the request says otherwise
+        sched_ticket ticket;
+
+        ticket.cls = pcmf32.size() <= size_t(sparams.sched_interactive_s)*WHISPER_SAMPLE_RATE ? REQUEST_CLASS_INTERACTIVE : REQUEST_CLASS_BATCH;
+
+        if (req.has_file("priority")) {
+            const std::string priority = req.get_file_value("priority").content;
+            if (priority == request_class_str(REQUEST_CLASS_INTERACTIVE)) {
+                ticket.cls = REQUEST_CLASS_INTERACTIVE;
+            } else if (priority == request_class_str(REQUEST_CLASS_BATCH)) {
+                ticket.cls = REQUEST_CLASS_BATCH;
+            } else {
+                fprintf(stderr, "error: unknown priority '%s'\n", priority.c_str());
                 res.status = 400;
-                res.set_content(error_resp, "application/json");
+                res.set_content("{\"error\":\"unknown priority\"}", "application/json");
                 return;
             }
         }
+        if (req.has_file("deadline_ms")) {
+            ticket.deadline = t_arrival + std::chrono::milliseconds(std::stoi(req.get_file_value("deadline_ms").content));
+        }
 
-        printf("Successfully loaded %s\n", filename.c_str());
+        // parakeet models do not detect the language, but compute the token probabilities only when requested
+        const bool need_lang_probs  = !is_parakeet && params.response_format == vjson_format && !params.no_language_probabilities;
+        const bool need_token_probs =  is_parakeet && params.response_format == vjson_format;
 
-        // print system information
-        {
-            fprintf(stderr, "\n");
-            fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
-                    params.n_threads*params.n_processors, std::thread::hardware_concurrency(), whisper_print_system_info());
+        std::string cache_key;
+        std::shared_ptr<const transcript> result;
+
+        if (cache.enabled()) {
+            cache_key = get_cache_key(*model, params, pcmf32);
+            result    = cache.get(cache_key);
+
+            // the language and token probabilities are only computed when they are requested
+            if (result && need_lang_probs && result->lang_probs.empty()) {
+                result = nullptr;
+            }
+            if (result && need_token_probs && !result->token_probs) {
+                result = nullptr;
+            }
+
+            res.set_header("X-Cache", result ? "hit" : "miss");
         }
 
-        // print some info about the processing
-        {
-            fprintf(stderr, "\n");
-            if (!whisper_is_multilingual(ctx)) {
-                if (params.language != "en" || params.translate) {
-                    params.language = "en";
-                    params.translate = false;
-                    fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+        // tell the backend to abort if the HTTP connection closed
+        const auto abort_callback = [](void *user_data) {
+            // user_data is a pointer to our Request
+            auto req_ptr = static_cast<const httplib::Request*>(user_data);
+            return req_ptr->is_connection_closed();
+        };
+
+        const auto set_failed = [&]() {
+            bmetrics.n_failed.fetch_add(1, std::memory_order_relaxed);
+
+            // handle failure or early abort
+            if (req.is_connection_closed()) {
+                // log client disconnect
+                fprintf(stderr, "client disconnected, aborted processing\n");
+                res.status = 499; // Client Closed Request (nginx convention)
+                res.set_content("{\"error\":\"client disconnected\"}", "application/json");
+                return;
+            }
+            fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+            res.status = 500; // Internal Server Error
+            const std::string error_resp = "{\"error\":\"failed to process audio\"}";
+            res.set_content(error_resp, "application/json");
+        };
+
+        if (result) {
+            printf("Serving %s from the cache\n", filename.c_str());
+            bmetrics.n_cache_hits.fetch_add(1, std::memory_order_relaxed);
+        } else if (is_parakeet) {
+            const int64_t t_wait_us = ggml_time_us();
+
+            // wait for a free state of the model - up to --parakeet-states requests run on it at the same time
+            parakeet_state * pstate = nullptr;
+            {
+                metrics_gauge_guard waiting(bmetrics.n_waiting);
+                pstate = model->ppool.acquire();
+            }
+
+            if (pstate == nullptr) {
+                fprintf(stderr, "error: failed to initialize parakeet state\n");
+                bmetrics.n_failed.fetch_add(1, std::memory_order_relaxed);
+                res.status = 500;
+                res.set_content("{\"error\":\"failed to initialize parakeet state\"}", "application/json");
+                return;
+            }
+
+            const int64_t t_start_us = ggml_time_us();
+            bmetrics.queue_wait.observe((t_start_us - t_wait_us)*1e-6);
+
+            metrics_gauge_guard running(bmetrics.n_running);
+
+            std::unique_ptr<parakeet_timings> timings_before(parakeet_get_timings_from_state(pstate));
+
+            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, parakeet ...\n",
+                    __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE, params.n_threads);
+
+            printf("Running parakeet inference on %s\n", filename.c_str());
+
+            parakeet_full_params pparams = parakeet_full_default_params(PARAKEET_SAMPLING_GREEDY);
+
+            pparams.n_threads   = params.n_threads;
+            pparams.no_context  = true;
+            pparams.token_probs = need_token_probs;
+
+            pparams.abort_callback           = abort_callback;
+            pparams.abort_callback_user_data = (void*)&req;
+
+            // audio longer than the audio context of the model is encoded at once with a dynamic encoder graph
+            if (parakeet_full_with_state(model->pctx, pstate, pparams, pcmf32.data(), pcmf32.size()) != 0) {
+                model->ppool.release(pstate);
+                set_failed();
+                return;
+            }
+
+            bmetrics.observe_request(pcmf32.size(), (ggml_time_us() - t_start_us)*1e-3);
+
+            std::unique_ptr<parakeet_timings> timings_after(parakeet_get_timings_from_state(pstate));
+            if (timings_before && timings_after) {
+                bmetrics.observe(*timings_before, *timings_after);
+            }
+
+            result = std::make_shared<const transcript>(get_transcript(model->pctx, pstate, need_token_probs));
+
+            model->ppool.release(pstate);
+
+            if (cache.enabled()) {
+                cache.put(cache_key, result);
+            }
+        } else {
+            const int64_t t_wait_us = ggml_time_us();
+
+            // several processors and VAD need the default state of the context, the other requests run on a state
+            // of the request pool, so that a paused request does not hold up the requests on the same model
+            const bool use_default_state = params.n_processors > 1 || params.vad;
+
+            // acquire whisper model mutex lock before the slot, so that waiting for it does not take up a slot
+            std::unique_lock<std::mutex> lock(model->mutex, std::defer_lock);
+            {
+                metrics_gauge_guard waiting(bmetrics.n_waiting);
+                if (use_default_state) {
+                    lock.lock();
                 }
+                model->sched.acquire(ticket);
             }
-            if (params.detect_language) {
-                params.language = "auto";
+
+            // there are as many request states as requests that are running or paused
+            whisper_state * wstate = nullptr;
+            if (!use_default_state) {
+                wstate = model->requests.acquire();
+                if (wstate == nullptr) {
+                    model->sched.release(ticket);
+                    fprintf(stderr, "error: failed to initialize whisper state\n");
+                    bmetrics.n_failed.fetch_add(1, std::memory_order_relaxed);
+                    res.status = 500;
+                    res.set_content("{\"error\":\"failed to initialize whisper state\"}", "application/json");
+                    return;
+                }
             }
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
-                    params.n_threads, params.n_processors,
-                    params.language.c_str(),
-                    params.translate ? "translate" : "transcribe",
-                    params.tinydiarize ? "tdrz = 1, " : "",
-                    params.no_timestamps ? 0 : 1);
 
-            fprintf(stderr, "\n");
-        }
+            const int64_t t_start_us = ggml_time_us();
+            bmetrics.queue_wait.observe((t_start_us - t_wait_us)*1e-6);
 
-        // run the inference
-        {
-            printf("Running whisper.cpp inference on %s\n", filename.c_str());
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
-
-            wparams.print_realtime   = false;
-            wparams.print_progress   = params.print_progress;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.print_special    = params.print_special;
-            wparams.translate        = params.translate;
-            wparams.language         = params.language.c_str();
-            wparams.detect_language  = params.detect_language;
-            wparams.n_threads        = params.n_threads;
-            wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
-            wparams.offset_ms        = params.offset_t_ms;
-            wparams.duration_ms      = params.duration_ms;
-
-            wparams.thold_pt         = params.word_thold;
-            wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
-            wparams.split_on_word    = params.split_on_word;
-            wparams.audio_ctx        = params.audio_ctx;
-
-            wparams.debug_mode       = params.debug_mode;
-
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-
-            wparams.initial_prompt   = params.prompt.c_str();
-            wparams.carry_initial_prompt = params.carry_initial_prompt;
-
-            wparams.greedy.best_of        = params.best_of;
-            wparams.beam_search.beam_size = params.beam_size;
-
-            wparams.temperature      = params.temperature;
-            wparams.no_speech_thold  = params.no_speech_thold;
-            wparams.temperature_inc  = params.temperature_inc;
-            wparams.entropy_thold    = params.entropy_thold;
-            wparams.logprob_thold    = params.logprob_thold;
-
-            wparams.no_timestamps    = params.no_timestamps;
-            wparams.token_timestamps = params.token_timestamps;
-            wparams.no_context       = params.no_context;
-
-            wparams.suppress_nst     = params.suppress_nst;
-
-            wparams.vad              = params.vad;
-            wparams.vad_model_path   = params.vad_model.c_str();
-
-            wparams.vad_params.threshold               = params.vad_threshold;
-            wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
-            wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
-            wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
-            wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
-            wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
-
-            whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
-
-            // this callback is called on each new segment
-            if (params.print_realtime) {
-                wparams.new_segment_callback           = whisper_print_segment_callback;
-                wparams.new_segment_callback_user_data = &user_data;
+            metrics_gauge_guard running(bmetrics.n_running);
+
+            // the stage times of this request are the difference to the timings before it
+            std::unique_ptr<whisper_timings> timings_before(wstate ? whisper_get_timings_from_state(wstate) : whisper_get_timings(ctx));
+
+            // print system information
+            {
+                fprintf(stderr, "\n");
+                fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
+                        params.n_threads*params.n_processors, std::thread::hardware_concurrency(), whisper_print_system_info());
             }
 
-            if (wparams.print_progress) {
-                wparams.progress_callback           = whisper_print_progress_callback;
-                wparams.progress_callback_user_data = &user_data;
+            // print some info about the processing
+            {
+                fprintf(stderr, "\n");
+                fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, lang = %s, task = %s, %stimestamps = %d ...\n",
+                        __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+                        params.n_threads, params.n_processors,
+                        params.language.c_str(),
+                        params.translate ? "translate" : "transcribe",
+                        params.tinydiarize ? "tdrz = 1, " : "",
+                        params.no_timestamps ? 0 : 1);
+
+                fprintf(stderr, "\n");
             }
 
-            // tell whisper to abort if the HTTP connection closed
-            wparams.abort_callback = [](void *user_data) {
-                // user_data is a pointer to our Request
-                auto req_ptr = static_cast<const httplib::Request*>(user_data);
-                return req_ptr->is_connection_closed();
-            };
-            wparams.abort_callback_user_data = (void*)&req;
-
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
-                // handle failure or early abort
-                if (req.is_connection_closed()) {
-                    // log client disconnect
-                    fprintf(stderr, "client disconnected, aborted processing\n");
-                    res.status = 499; // Client Closed Request (nginx convention)
-                    res.set_content("{\"error\":\"client disconnected\"}", "application/json");
+            // run the inference
+            {
+                printf("Running whisper.cpp inference on %s\n", filename.c_str());
+                whisper_full_params wparams = get_full_params(params);
+
+                whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
+
+                // this callback is called on each new segment
+                if (params.print_realtime) {
+                    wparams.new_segment_callback           = whisper_print_segment_callback;
+                    wparams.new_segment_callback_user_data = &user_data;
+                }
+
+                if (wparams.print_progress) {
+                    wparams.progress_callback           = whisper_print_progress_callback;
+                    wparams.progress_callback_user_data = &user_data;
+                }
+
+                wparams.abort_callback           = abort_callback;
+                wparams.abort_callback_user_data = (void*)&req;
+
+                // yield to better ranked requests before each window - a request on the default state is not
+                // paused, as it would hold the mutex of the model while it waits, and with several processors the
+                // windows of the chunks are decoded in parallel
+                struct sched_yield_data {
+                    request_scheduler * sched;
+                    sched_ticket      * ticket;
+                } yield_data = { &model->sched, &ticket };
+
+                if (!use_default_state) {
+                    wparams.encoder_begin_callback = [](struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, void * user_data) {
+                        auto * data = (sched_yield_data *) user_data;
+                        data->sched->yield(*data->ticket);
+                        return true;
+                    };
+                    wparams.encoder_begin_callback_user_data = &yield_data;
+                }
+
+                const int ret = wstate ?
+                    whisper_full_with_state(ctx, wstate, wparams, pcmf32.data(), pcmf32.size()) :
+                    whisper_full_parallel  (ctx,         wparams, pcmf32.data(), pcmf32.size(), params.n_processors);
+
+                bmetrics.n_preempted.fetch_add(ticket.n_preempted, std::memory_order_relaxed);
+
+                if (ret != 0) {
+                    if (wstate) {
+                        model->requests.release(wstate);
+                    }
+                    model->sched.release(ticket);
+                    set_failed();
                     return;
                 }
-                fprintf(stderr, "%s: failed to process audio\n", argv[0]);
-                res.status = 500; // Internal Server Error
-                const std::string error_resp = "{\"error\":\"failed to process audio\"}";
-                res.set_content(error_resp, "application/json");
-                return;
+
+                if (ticket.n_preempted > 0) {
+                    printf("Request %s was paused %d times\n", filename.c_str(), ticket.n_preempted);
+                }
+            }
+
+            bmetrics.observe_request(pcmf32.size(), (ggml_time_us() - t_start_us)*1e-3);
+
+            std::unique_ptr<whisper_timings> timings_after(wstate ? whisper_get_timings_from_state(wstate) : whisper_get_timings(ctx));
+            if (timings_before && timings_after) {
+                bmetrics.observe(*timings_before, *timings_after);
+            }
+
+            auto result_new = std::make_shared<transcript>(get_transcript(ctx, wstate));
+
+            // Only compute language probabilities if requested (expensive operation)
+            if (need_lang_probs) {
+                result_new->lang_probs.resize(whisper_lang_max_id() + 1, 0.0f);
+                result_new->detected_lang_id = wstate ?
+                    whisper_lang_auto_detect_with_state(ctx, wstate, 0, params.n_threads, result_new->lang_probs.data()) :
+                    whisper_lang_auto_detect           (ctx,         0, params.n_threads, result_new->lang_probs.data());
             }
+
+            if (wstate) {
+                model->requests.release(wstate);
+            }
+            model->sched.release(ticket);
+
+            result = result_new;
+
+            if (cache.enabled()) {
+                cache.put(cache_key, result);
+            }
+        }
+
+        if (!is_parakeet) {
+            const double t_latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_arrival).count();
+            (ticket.cls == REQUEST_CLASS_INTERACTIVE ? metrics.latency_interactive : metrics.latency_batch).observe(t_latency);
         }
 
         // return results to user
         if (params.response_format == text_format)
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(*result, params, pcmf32s);
             res.set_content(results.c_str(), "text/html; charset=utf-8");
         }
         else if (params.response_format == srt_format)
         {
             std::stringstream ss;
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = result->segments.size();
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const auto & segment = result->segments[i];
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
                 {
-                    speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+                    speaker = estimate_diarization_speaker(pcmf32s, segment.t0, segment.t1);
                 }
 
                 ss << i + 1 + params.offset_n << "\n";
-                ss << to_timestamp(t0, true) << " --> " << to_timestamp(t1, true) << "\n";
-                ss << speaker << text << "\n\n";
+                ss << to_timestamp(segment.t0, true) << " --> " << to_timestamp(segment.t1, true) << "\n";
+                ss << speaker << segment.text << "\n\n";
             }
             res.set_content(ss.str(), "application/x-subrip");
         } else if (params.response_format == vtt_format) {
@@ -1044,38 +2835,33 @@ int main(int argc, char ** argv) {
 
             ss << "WEBVTT\n\n";
 
-            const int n_segments = whisper_full_n_segments(ctx);
-            for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            for (const auto & segment : result->segments) {
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
                 {
-                    speaker = estimate_diarization_speaker(pcmf32s, t0, t1, true);
+                    speaker = estimate_diarization_speaker(pcmf32s, segment.t0, segment.t1, true);
                     speaker.insert(0, "<v Speaker");
                     speaker.append(">");
                 }
 
-                ss << to_timestamp(t0) << " --> " << to_timestamp(t1) << "\n";
-                ss << speaker << text << "\n\n";
+                ss << to_timestamp(segment.t0) << " --> " << to_timestamp(segment.t1) << "\n";
+                ss << speaker << segment.text << "\n\n";
             }
             res.set_content(ss.str(), "text/vtt");
         } else if (params.response_format == vjson_format) {
             /* try to match openai/whisper's Python format */
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(*result, params, pcmf32s);
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
-                {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
+                {"language", result->lang_id < 0 ? json(nullptr) : json(whisper_lang_str_full(result->lang_id))},
                 {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()}
             };
-            // Only compute language probabilities if requested (expensive operation)
-            if (!params.no_language_probabilities) {
-                std::vector<float> lang_probs(whisper_lang_max_id() + 1, 0.0f);
-                const auto detected_lang_id = whisper_lang_auto_detect(ctx, 0, params.n_threads, lang_probs.data());
+            if (!result->lang_probs.empty() && !params.no_language_probabilities) {
+                const auto & lang_probs = result->lang_probs;
+                const auto detected_lang_id = result->detected_lang_id;
                 jres["detected_language"] = whisper_lang_str_full(detected_lang_id);
                 jres["detected_language_probability"] = lang_probs[detected_lang_id];
                 jres["language_probabilities"] = json::object();
@@ -1086,49 +2872,53 @@ int main(int argc, char ** argv) {
                     }
                 }
             }
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = result->segments.size();
             for (int i = 0; i < n_segments; ++i)
             {
+                const auto & seg = result->segments[i];
+
                 json segment = json{
                     {"id", i},
-                    {"text", whisper_full_get_segment_text(ctx, i)},
+                    {"text", seg.text},
                 };
 
                 if (!params.no_timestamps) {
-                    segment["start"] = whisper_full_get_segment_t0(ctx, i) * 0.01;
-                    segment["end"] = whisper_full_get_segment_t1(ctx, i) * 0.01;
+                    segment["start"] = seg.t0 * 0.01;
+                    segment["end"] = seg.t1 * 0.01;
                 }
 
                 if (params.diarize && pcmf32s.size() == 2) {
                     segment["speaker"] = estimate_diarization_speaker(
                         pcmf32s,
-                        whisper_full_get_segment_t0(ctx, i),
-                        whisper_full_get_segment_t1(ctx, i),
+                        seg.t0,
+                        seg.t1,
                         true);
                 }
 
                 float total_logprob = 0;
-                const int n_tokens = whisper_full_n_tokens(ctx, i);
+                const int n_tokens = seg.tokens.size();
                 for (int j = 0; j < n_tokens; ++j) {
-                    whisper_token_data token = whisper_full_get_token_data(ctx, i, j);
-                    if (token.id >= whisper_token_eot(ctx)) {
+                    const transcript_token & token = seg.tokens[j];
+                    if (token.id >= result->token_eot) {
                         continue;
                     }
 
                     segment["tokens"].push_back(token.id);
-                    std::string word_text = whisper_full_get_token_text(ctx, i, j);
+                    std::string word_text = token.text;
                     int64_t word_t1 = token.t1;
 
-                    while (j + 1 < n_tokens && utf8_trailing_bytes_needed(word_text) > 0) {
-                        const whisper_token_data next_token = whisper_full_get_token_data(ctx, i, j + 1);
+                    // subword tokens are merged up to the start of the next word
+                    while (j + 1 < n_tokens && (utf8_trailing_bytes_needed(word_text) > 0 ||
+                                (result->subword_tokens && !seg.tokens[j + 1].word_start))) {
+                        const transcript_token & next_token = seg.tokens[j + 1];
                         // Keep verbose_json tokens free of EOT ids, matching the pre-merge server behavior.
-                        if (next_token.id >= whisper_token_eot(ctx)) {
+                        if (next_token.id >= result->token_eot) {
                             break;
                         }
 
                         ++j;
                         segment["tokens"].push_back(next_token.id);
-                        word_text += whisper_full_get_token_text(ctx, i, j);
+                        word_text += next_token.text;
                         if (next_token.t1 > -1) {
                             word_t1 = next_token.t1;
                         }
@@ -1136,10 +2926,13 @@ int main(int argc, char ** argv) {
                     }
 
                     json word = json{{"word", word_text}};
-                    if (!params.no_timestamps && params.token_timestamps) {
+                    // the parakeet decoder always computes the token timestamps
+                    if (!params.no_timestamps && (params.token_timestamps || result->subword_tokens)) {
                         word["start"] = token.t0 * 0.01;
                         word["end"] = word_t1 * 0.01;
-                        word["t_dtw"] = token.t_dtw;
+                        if (!result->subword_tokens) {
+                            word["t_dtw"] = token.t_dtw;
+                        }
                     }
                     word["probability"] = token.p;
                     total_logprob += token.plog;
@@ -1151,7 +2944,7 @@ int main(int argc, char ** argv) {
 
                 // TODO compression_ratio and no_speech_prob are not implemented yet
                 // segment["compression_ratio"] = 0;
-                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob(ctx, i);
+                segment["no_speech_prob"] = seg.no_speech_prob;
 
                 jres["segments"].push_back(segment);
             }
@@ -1161,7 +2954,7 @@ int main(int argc, char ** argv) {
         // TODO add more output formats
         else
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(*result, params, pcmf32s);
             json jres = json{
                 {"text", results}
             };
@@ -1169,9 +2962,162 @@ int main(int argc, char ** argv) {
                             "application/json");
         }
     });
+    svr->Post(sparams.request_path + "/stream", [&](const Request &req, Response &res){
+        // the idle sessions return their states to the pool before this one takes one
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            close_idle_sessions();
+        }
+
+        // the model can be loaded from disk here, so the sessions are not locked while the session is set up
+        auto session = std::make_shared<stream_session>();
+
+        session->params = default_params;
+        get_req_parameters(req, session->params);
+
+        if (req.has_file("format")) {
+            const std::string format = req.get_file_value("format").content;
+            if (format != "s16le" && format != "f32le") {
+                res.status = 400;
+                res.set_content("{\"error\":\"unsupported sample format, use s16le or f32le\"}", "application/json");
+                return;
+            }
+            session->f32 = format == "f32le";
+        }
+
+        whisper_stream_params stream_params = whisper_stream_default_params();
+        if (req.has_file("step_ms")) {
+            stream_params.step_ms = std::stoi(req.get_file_value("step_ms").content);
+        }
+        stream_params.commit_callback           = stream_commit_callback;
+        stream_params.commit_callback_user_data = session.get();
+
+        session->model = get_model(req, res);
+        if (session->model == nullptr) {
+            return;
+        }
+
+        if (session->model->backend != MODEL_BACKEND_WHISPER) {
+            fprintf(stderr, "error: realtime sessions need a whisper model\n");
+            session->model = nullptr;
+            res.status = 400;
+            res.set_content("{\"error\":\"realtime sessions need a whisper model\"}", "application/json");
+            return;
+        }
+
+        session->state = session->model->pool.acquire();
+        if (session->state == nullptr) {
+            res.status = 503;
+            res.set_content("{\"error\":\"too many stream sessions\"}", "application/json");
+            return;
+        }
+
+        session->stream = whisper_stream_init_with_state(session->model->ctx, session->state, get_full_params(session->params), stream_params);
+        session->t_last = std::chrono::steady_clock::now();
+
+        char id[17];
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+
+            snprintf(id, sizeof(id), "%016llx", (unsigned long long) session_rng());
+            sessions[id] = session;
+        }
+
+        res.set_content(json{
+            {"id", id},
+            {"sample_rate", WHISPER_SAMPLE_RATE},
+            {"format", session->f32 ? "f32le" : "s16le"},
+        }.dump(), "application/json");
+    });
+
+    svr->Post(sparams.request_path + "/stream/:id", [&](const Request &req, Response &res){
+        auto session = get_session(req);
+        if (session == nullptr) {
+            res.status = 404;
+            res.set_content("{\"error\":\"unknown stream session\"}", "application/json");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->stream == nullptr) {
+            res.status = 404;
+            res.set_content("{\"error\":\"unknown stream session\"}", "application/json");
+            return;
+        }
+
+        std::vector<float> pcmf32;
+        if (session->f32) {
+            pcmf32.resize(req.body.size()/sizeof(float));
+            memcpy(pcmf32.data(), req.body.data(), pcmf32.size()*sizeof(float));
+        } else {
+            pcmf32.resize(req.body.size()/sizeof(int16_t));
+            for (size_t i = 0; i < pcmf32.size(); ++i) {
+                int16_t v;
+                memcpy(&v, req.body.data() + i*sizeof(int16_t), sizeof(int16_t));
+                pcmf32[i] = float(v)/32768.0f;
+            }
+        }
+
+        session->committed = json::array();
+        session->t_last    = std::chrono::steady_clock::now();
+
+        if (whisper_stream_push(session->stream, pcmf32.data(), pcmf32.size()) < 0) {
+            res.status = 500;
+            res.set_content("{\"error\":\"failed to process audio\"}", "application/json");
+            return;
+        }
+
+        res.set_content(json{
+            {"committed", session->committed},
+            {"unstable",  whisper_stream_get_unstable_text(session->stream)},
+        }.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+    });
+
+    svr->Delete(sparams.request_path + "/stream/:id", [&](const Request &req, Response &res){
+        auto session = get_session(req);
+        if (session == nullptr) {
+            res.status = 404;
+            res.set_content("{\"error\":\"unknown stream session\"}", "application/json");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            sessions.erase(req.path_params.at("id"));
+        }
+
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->stream == nullptr) {
+            res.status = 404;
+            res.set_content("{\"error\":\"unknown stream session\"}", "application/json");
+            return;
+        }
+
+        session->committed = json::array();
+
+        const bool ok = whisper_stream_flush(session->stream) >= 0;
+
+        json jres = json{
+            {"committed", session->committed},
+            {"text",      whisper_stream_get_text(session->stream)},
+        };
+
+        stream_session_close(*session);
+
+        if (!ok) {
+            res.status = 500;
+            res.set_content("{\"error\":\"failed to process audio\"}", "application/json");
+            return;
+        }
+
+        res.set_content(jres.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+    });
+
+    // loads that run in the background - the finished ones are removed when a new one starts
+    std::vector<std::future<void>> loaders;
+    std::mutex loaders_mutex;
+
     svr->Post(sparams.request_path + "/load", [&](const Request &req, Response &res){
-        std::lock_guard<std::mutex> lock(whisper_mutex);
-        state.store(SERVER_STATE_LOADING_MODEL);
         if (!req.has_file("model"))
         {
             fprintf(stderr, "error: no 'model' field in the request\n");
@@ -1190,26 +3136,49 @@ int main(int argc, char ** argv) {
             return;
         }
 
-        // clean up
-        whisper_free(ctx);
+        // the name to register the model under - the current model with that name serves requests until the
+        // new one is loaded
+        const std::string name = req.has_file("name") ? req.get_file_value("name").content : models.default_name;
 
-        // whisper init
-        ctx = whisper_init_from_file_with_params(model.c_str(), cparams);
+        model_backend backend = MODEL_BACKEND_WHISPER;
+        if (req.has_file("backend") && !model_backend_from_str(req.get_file_value("backend").content, backend)) {
+            fprintf(stderr, "error: unknown backend '%s'\n", req.get_file_value("backend").content.c_str());
+            res.status = 400;
+            res.set_content("{\"error\":\"unknown backend\"}", "application/json");
+            return;
+        }
+
+        if (req.has_file("async") && parse_str_to_bool(req.get_file_value("async").content)) {
+            std::lock_guard<std::mutex> lock(loaders_mutex);
+            loaders.erase(std::remove_if(loaders.begin(), loaders.end(), [](const std::future<void> & loader) {
+                return loader.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            }), loaders.end());
 
-        // TODO perhaps load prior model here instead of exit
-        if (ctx == nullptr) {
-            fprintf(stderr, "error: model init  failed, no model loaded must exit\n");
-            exit(1);
+            loaders.push_back(std::async(std::launch::async, [&models, name, model, backend]() {
+                models.load(name, model, backend);
+            }));
+
+            res.status = 202;
+            res.set_content("Loading in the background", "application/text");
+            return;
         }
 
-        // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-        whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+        if (!models.load(name, model, backend)) {
+            res.status = 500;
+            res.set_content("{\"error\":\"failed to load model\"}", "application/json");
+            return;
+        }
 
-        state.store(SERVER_STATE_READY);
         const std::string success = "Load was successful!";
         res.set_content(success, "application/text");
+    });
+
+    svr->Get(sparams.request_path + "/models", [&](const Request &, Response &res){
+        res.set_content(json{{"models", models.list()}}.dump(), "application/json");
+    });
 
-        // check if the model is in the file system
+    svr->Get(sparams.request_path + "/metrics", [&](const Request &, Response &res){
+        res.set_content(metrics_render(metrics, models), "text/plain; version=0.0.4");
     });
 
     svr->Get(sparams.request_path + "/health", [&](const Request &, Response &res){
@@ -1284,10 +3253,43 @@ int main(int argc, char ** argv) {
     SetConsoleCtrlHandler(reinterpret_cast<PHANDLER_ROUTINE>(console_ctrl_handler), true);
 #endif
 
+    // the sessions are also closed while no new ones are opened, so that their states return to the pool
+    bool sweeper_stop = false;
+    std::condition_variable sweeper_cv;
+    std::thread sweeper([&]() {
+        std::unique_lock<std::mutex> lock(sessions_mutex);
+        while (!sweeper_cv.wait_for(lock, std::chrono::seconds(1), [&]() { return sweeper_stop; })) {
+            close_idle_sessions();
+        }
+    });
+
     // clean up function, to be called before exit
     auto clean_up = [&]() {
-        whisper_print_timings(ctx);
-        whisper_free(ctx);
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            sweeper_stop = true;
+        }
+        sweeper_cv.notify_one();
+        sweeper.join();
+
+        for (auto & it : sessions) {
+            std::lock_guard<std::mutex> lock_session(it.second->mutex);
+            stream_session_close(*it.second);
+        }
+        sessions.clear();
+
+        for (auto & loader : loaders) {
+            loader.wait();
+        }
+
+        // the parakeet requests run on the states of the pool, the context has no timings of its own
+        if (auto model = models.acquire(models.default_name)) {
+            if (model->ctx) {
+                whisper_print_timings(model->ctx);
+            }
+        }
+
+        models.clear();
     };
 
     std::thread t([&] {
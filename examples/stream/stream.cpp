@@ -7,8 +7,10 @@
 #include "common-whisper.h"
 #include "whisper.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
+#include <deque>
 #include <fstream>
 #include <string>
 #include <thread>
@@ -28,6 +30,12 @@ struct whisper_params {
     float vad_thold    = 0.6f;
     float freq_thold   = 100.0f;
 
+    // [EXPERIMENTAL] Silero VAD endpointing
+    float   vad_threshold     = 0.5f;
+    int32_t vad_min_speech_ms = 250; // shorter utterances are dropped as noise
+    int32_t vad_hangover_ms   = 500; // silence that ends an utterance
+    int32_t vad_pad_ms        = 200; // audio kept before the start and after the end of the speech
+
     bool translate     = false;
     bool no_fallback   = false;
     bool print_special = false;
@@ -37,10 +45,12 @@ struct whisper_params {
     bool save_audio    = false; // save audio to wav file
     bool use_gpu       = true;
     bool flash_attn    = true;
+    bool local_agree   = false;
 
     std::string language  = "en";
     std::string model     = "models/ggml-base.en.bin";
     std::string fname_out;
+    std::string vad_model;
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -75,6 +85,12 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")    { params.flash_attn    = true; }
         else if (arg == "-nfa"  || arg == "--no-flash-attn") { params.flash_attn    = false; }
+        else if (arg == "-la"   || arg == "--local-agree")   { params.local_agree   = true; }
+        else if (arg == "-vm"   || arg == "--vad-model")     { params.vad_model     = argv[++i]; }
+        else if (arg == "-vt"   || arg == "--vad-threshold") { params.vad_threshold = std::stof(argv[++i]); }
+        else if (arg == "-vspd" || arg == "--vad-min-speech-duration-ms") { params.vad_min_speech_ms = std::stoi(argv[++i]); }
+        else if (arg == "-vho"  || arg == "--vad-hangover-ms")            { params.vad_hangover_ms   = std::stoi(argv[++i]); }
+        else if (arg == "-vp"   || arg == "--vad-speech-pad-ms")          { params.vad_pad_ms        = std::stoi(argv[++i]); }
 
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
@@ -114,6 +130,14 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn    [%-7s] enable flash attention during inference\n",        params.flash_attn ? "true" : "false");
     fprintf(stderr, "  -nfa,     --no-flash-attn [%-7s] disable flash attention during inference\n",       params.flash_attn ? "false" : "true");
+    fprintf(stderr, "  -la,      --local-agree   [%-7s] [EXPERIMENTAL] commit text once consecutive steps agree\n", params.local_agree ? "true" : "false");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "[EXPERIMENTAL] Silero VAD endpointing (with --step 0):\n");
+    fprintf(stderr, "  -vm FNAME, --vad-model FNAME               [%-7s] VAD model path, transcribe each utterance once it ends\n", params.vad_model.c_str());
+    fprintf(stderr, "  -vt N,     --vad-threshold N               [%-7.2f] VAD threshold for speech\n",                            params.vad_threshold);
+    fprintf(stderr, "  -vspd N,   --vad-min-speech-duration-ms N  [%-7d] drop utterances with less speech as noise\n",             params.vad_min_speech_ms);
+    fprintf(stderr, "  -vho N,    --vad-hangover-ms N             [%-7d] silence in ms that ends an utterance\n",                   params.vad_hangover_ms);
+    fprintf(stderr, "  -vp N,     --vad-speech-pad-ms N           [%-7d] audio in ms kept before and after the speech\n",           params.vad_pad_ms);
     fprintf(stderr, "\n");
 }
 
@@ -136,6 +160,19 @@ int main(int argc, char ** argv) {
 
     const bool use_vad = n_samples_step <= 0; // sliding window mode uses VAD
 
+    if (use_vad && params.local_agree) {
+        fprintf(stderr, "error: --local-agree requires a positive --step\n");
+        return 1;
+    }
+
+    // [EXPERIMENTAL] with a VAD model, the sliding window mode transcribes each utterance once its end is detected
+    const bool use_vad_model = !params.vad_model.empty();
+
+    if (use_vad_model && !use_vad) {
+        fprintf(stderr, "error: --vad-model requires --step 0\n");
+        return 1;
+    }
+
     const int n_new_line = !use_vad ? std::max(1, params.length_ms / params.step_ms - 1) : 1; // number of steps to print new line
 
     params.no_timestamps  = !use_vad;
@@ -170,12 +207,33 @@ int main(int argc, char ** argv) {
         return 2;
     }
 
+    // [EXPERIMENTAL] the VAD keeps its LSTM state across the pushed audio, so only the new audio is evaluated
+    struct whisper_vad_context * vctx = nullptr;
+    if (use_vad_model) {
+        struct whisper_vad_context_params vcparams = whisper_vad_default_context_params();
+
+        vcparams.n_threads = params.n_threads;
+        vcparams.use_gpu   = params.use_gpu;
+
+        vctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vcparams);
+        if (vctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize VAD context\n");
+            return 2;
+        }
+    }
+
     std::vector<float> pcmf32    (n_samples_30s, 0.0f);
     std::vector<float> pcmf32_old;
     std::vector<float> pcmf32_new(n_samples_30s, 0.0f);
 
     std::vector<whisper_token> prompt_tokens;
 
+    // [EXPERIMENTAL] the library keeps the audio buffer and only the uncommitted text changes between steps
+    struct whisper_stream * stream = nullptr;
+
+    // length of the uncommitted text that is currently printed, in characters
+    int n_unstable = 0;
+
     // print some info about the processing
     {
         fprintf(stderr, "\n");
@@ -199,6 +257,8 @@ int main(int argc, char ** argv) {
 
         if (!use_vad) {
             fprintf(stderr, "%s: n_new_line = %d, no_context = %d\n", __func__, n_new_line, params.no_context);
+        } else if (use_vad_model) {
+            fprintf(stderr, "%s: using Silero VAD, will transcribe each utterance after %d ms of silence\n", __func__, params.vad_hangover_ms);
         } else {
             fprintf(stderr, "%s: using VAD, will transcribe on speech activity\n", __func__);
         }
@@ -236,6 +296,22 @@ int main(int argc, char ** argv) {
     auto t_last  = std::chrono::high_resolution_clock::now();
     const auto t_start = t_last;
 
+    // [EXPERIMENTAL] endpointing state
+    const int n_vad_window   = 512; // samples per VAD probability, the audio is passed to the VAD in whole windows
+    const int n_vad_hangover = (1e-3*params.vad_hangover_ms  )*WHISPER_SAMPLE_RATE;
+    const int n_vad_pad      = (1e-3*params.vad_pad_ms       )*WHISPER_SAMPLE_RATE;
+    const int n_vad_speech   = (1e-3*params.vad_min_speech_ms)*WHISPER_SAMPLE_RATE;
+
+    std::vector<float> vad_pending;   // new audio that does not fill a VAD window yet
+    std::vector<float> vad_preroll;   // the last n_vad_pad samples before the speech
+    std::vector<float> vad_utterance; // audio of the current utterance
+
+    std::deque<std::vector<float>> vad_utterances; // ended utterances that wait to be transcribed
+
+    bool vad_in_speech = false;
+    int  vad_n_speech  = 0; // samples of speech in the current utterance
+    int  vad_n_silence = 0; // samples of silence since the last speech
+
     // main audio loop
     while (is_running) {
         if (params.save_audio) {
@@ -289,6 +365,96 @@ int main(int argc, char ** argv) {
             memcpy(pcmf32.data() + n_samples_take, pcmf32_new.data(), n_samples_new*sizeof(float));
 
             pcmf32_old = pcmf32;
+        } else if (use_vad_model) {
+            // take the audio captured since the previous iteration
+            audio.get(params.length_ms, pcmf32_new);
+            audio.clear();
+
+            vad_pending.insert(vad_pending.end(), pcmf32_new.begin(), pcmf32_new.end());
+
+            const int n_feed = (vad_pending.size()/n_vad_window)*n_vad_window;
+            if (n_feed > 0) {
+                if (!whisper_vad_detect_speech_no_reset(vctx, vad_pending.data(), n_feed)) {
+                    fprintf(stderr, "%s: failed to detect speech\n", argv[0]);
+                    return 7;
+                }
+
+                const int     n_probs = whisper_vad_n_probs(vctx);
+                const float * probs   = whisper_vad_probs(vctx);
+
+                bool is_end = false;
+
+                for (int i = 0; i < n_probs; ++i) {
+                    const float * window = vad_pending.data() + i*n_vad_window;
+
+                    const bool is_speech = probs[i] >= params.vad_threshold;
+
+                    if (!vad_in_speech) {
+                        if (!is_speech) {
+                            vad_preroll.insert(vad_preroll.end(), window, window + n_vad_window);
+                            if ((int) vad_preroll.size() > n_vad_pad) {
+                                vad_preroll.erase(vad_preroll.begin(), vad_preroll.end() - n_vad_pad);
+                            }
+                            continue;
+                        }
+
+                        vad_in_speech = true;
+                        vad_utterance = std::move(vad_preroll);
+                        vad_preroll.clear();
+                        vad_n_speech  = 0;
+                        vad_n_silence = 0;
+                    }
+
+                    vad_utterance.insert(vad_utterance.end(), window, window + n_vad_window);
+
+                    if (is_speech) {
+                        vad_n_speech += n_vad_window;
+                        vad_n_silence = 0;
+                    } else {
+                        vad_n_silence += n_vad_window;
+                    }
+
+                    // the utterance ends after the hangover, or is split once it fills --length
+                    const bool is_silence = vad_n_silence >= n_vad_hangover;
+                    if (!is_silence && (int) vad_utterance.size() < n_samples_len) {
+                        continue;
+                    }
+
+                    if (is_silence) {
+                        // keep n_vad_pad samples of the trailing silence
+                        vad_utterance.resize(vad_utterance.size() - std::max(0, vad_n_silence - n_vad_pad));
+                        vad_in_speech = false;
+                    }
+
+                    // utterances with too little speech are noise
+                    if (vad_n_speech >= n_vad_speech) {
+                        vad_utterances.push_back(std::move(vad_utterance));
+                        is_end = true;
+                    }
+
+                    vad_utterance.clear();
+                    vad_n_speech  = 0;
+                    vad_n_silence = 0;
+                }
+
+                vad_pending.erase(vad_pending.begin(), vad_pending.begin() + n_feed);
+
+                if (is_end && !vad_in_speech) {
+                    whisper_vad_reset_state(vctx);
+                }
+            }
+
+            // one utterance is transcribed per iteration, so that the new audio keeps being fed to the VAD
+            if (vad_utterances.empty()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+                continue;
+            }
+
+            pcmf32 = std::move(vad_utterances.front());
+            vad_utterances.pop_front();
+
+            t_last = std::chrono::high_resolution_clock::now();
         } else {
             const auto t_now  = std::chrono::high_resolution_clock::now();
             const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
@@ -338,6 +504,54 @@ int main(int argc, char ** argv) {
             wparams.prompt_tokens    = params.no_context ? nullptr : prompt_tokens.data();
             wparams.prompt_n_tokens  = params.no_context ? 0       : prompt_tokens.size();
 
+            if (params.local_agree) {
+                if (stream == nullptr) {
+                    whisper_stream_params sparams = whisper_stream_default_params();
+
+                    sparams.step_ms = params.step_ms;
+                    sparams.commit_callback = [](struct whisper_context * /*ctx*/, struct whisper_stream * /*stream*/, const char * text, int64_t /*t0*/, int64_t /*t1*/, void * user_data) {
+                        printf("%s", text);
+
+                        auto & fout = *(std::ofstream *) user_data;
+                        if (fout.is_open()) {
+                            fout << text;
+                        }
+                    };
+                    sparams.commit_callback_user_data = &fout;
+
+                    stream = whisper_stream_init(ctx, wparams, sparams);
+                    if (stream == nullptr) {
+                        fprintf(stderr, "%s: failed to initialize the stream\n", argv[0]);
+                        return 6;
+                    }
+                }
+
+                // erase the uncommitted text of the previous step
+                if (n_unstable > 0) {
+                    printf("\33[%dD\33[K", n_unstable);
+                }
+
+                if (whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size()) < 0) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    return 6;
+                }
+
+                // print the uncommitted text dimmed
+                const std::string unstable = whisper_stream_get_unstable_text(stream);
+
+                n_unstable = 0;
+                for (const char c : unstable) {
+                    n_unstable += (c & 0xC0) != 0x80;
+                }
+
+                printf("\33[2m%s\33[0m", unstable.c_str());
+                fflush(stdout);
+
+                ++n_iter;
+
+                continue;
+            }
+
             if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 6;
@@ -430,8 +644,23 @@ int main(int argc, char ** argv) {
 
     audio.pause();
 
+    if (stream) {
+        if (n_unstable > 0) {
+            printf("\33[%dD\33[K", n_unstable);
+        }
+
+        whisper_stream_flush(stream);
+        whisper_stream_free(stream);
+
+        printf("\n");
+    }
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
+    if (vctx) {
+        whisper_vad_free(vctx);
+    }
+
     return 0;
 }
@@ -8,6 +8,7 @@
 
 #define GGML_FA_TILE_Q  64
 #define GGML_FA_TILE_KV 64
+#define GGML_FA_MULTI_Q 8  // max query rows that share a K/V pass in the small-batch path
 
 #ifdef __cplusplus
 
@@ -90,6 +91,7 @@ static std::pair<int64_t, int64_t> get_thread_range(const struct ggml_compute_pa
 struct ggml_fa_tile_config {
     static constexpr size_t Q  = GGML_FA_TILE_Q;
     static constexpr size_t KV = GGML_FA_TILE_KV;
+    static constexpr size_t MQ = GGML_FA_MULTI_Q;
 };
 
 #endif
@@ -2754,6 +2754,10 @@ static void ggml_threadpool_resume_locked(struct ggml_threadpool * threadpool) {
 }
 #endif
 
+int ggml_threadpool_get_n_threads(struct ggml_threadpool * threadpool) {
+    return threadpool->n_threads;
+}
+
 void ggml_threadpool_pause(struct ggml_threadpool * threadpool) {
 #ifndef GGML_USE_OPENMP
     ggml_mutex_lock(&threadpool->mutex);
@@ -2956,6 +2960,7 @@ struct ggml_cplan ggml_graph_plan(
 
                         // Tiled flash attention scratch (tile sizes defined in common.h)
                         // Per-thread: Q_q + KQ + mask + VKQ32 + V32 + K_f32 + padding
+                        // (also covers the small-batch path: GGML_FA_MULTI_Q*(DK + DV) + DV)
                         size_t prefill  = sizeof(float)*(GGML_FA_TILE_Q*DK + 2*GGML_FA_TILE_Q*GGML_FA_TILE_KV + GGML_FA_TILE_Q*DV + GGML_FA_TILE_KV*DV + GGML_FA_TILE_KV*DK)*n_tasks;
 
                         // Decode path: n_kv_chunks = n_tasks (one chunk per thread)
@@ -3024,27 +3029,28 @@ struct ggml_cplan ggml_graph_plan(
 }
 
 
-// Try to fuse the current node with subsequent nodes for better performance.
-// Returns the number of nodes skipped by fusion (>=1), or 0 if no fusion was applied.
 static bool ggml_cpu_disable_fusion = false;  // initialized once in ggml_cpu_init(), read-only afterwards
+static bool ggml_cpu_graph_deps     = false;  // initialized once in ggml_cpu_init(), read-only afterwards
 
-static int ggml_cpu_try_fuse_ops(
+// Check if the current node can be fused with subsequent nodes.
+// Returns the number of nodes that the fused op would skip (>=1), or 0 if no fusion applies.
+// The result only depends on the graph, so all threads agree on it.
+static int ggml_cpu_fuse_count(
         const struct ggml_cgraph * cgraph,
         const int node_n,
-        const struct ggml_compute_params * params,
         const struct ggml_cplan * cplan) {
 
     if (ggml_cpu_disable_fusion || cplan->use_ref) {
         return 0;
     }
 
-    struct ggml_tensor * node = cgraph->nodes[node_n];
+    const struct ggml_tensor * node = cgraph->nodes[node_n];
 
     if (node->op == GGML_OP_RMS_NORM) {
         // RMS_NORM + MUL fusion
         const enum ggml_op fuse_ops[] = { GGML_OP_RMS_NORM, GGML_OP_MUL };
         if (ggml_can_fuse(cgraph, node_n, fuse_ops, 2)) {
-            struct ggml_tensor * mul_node = cgraph->nodes[node_n + 1];
+            const struct ggml_tensor * mul_node = cgraph->nodes[node_n + 1];
             const struct ggml_tensor * mul_w = (mul_node->src[0] == node)
                 ? mul_node->src[1] : mul_node->src[0];
             if (node->src[0]->type  == GGML_TYPE_F32 &&
@@ -3053,7 +3059,76 @@ static int ggml_cpu_try_fuse_ops(
                 mul_w->ne[0]        == node->ne[0]   &&
                 mul_w->nb[0]        == sizeof(float)) {
 
-                ggml_compute_forward_rms_norm_mul_fused(params, node, mul_node);
+                return 1;
+            }
+        }
+    }
+
+    if (node->op == GGML_OP_NORM) {
+        // NORM + MUL + ADD fusion (layer norm with weight and bias)
+        const enum ggml_op fuse_ops[] = { GGML_OP_NORM, GGML_OP_MUL, GGML_OP_ADD };
+        if (ggml_can_fuse(cgraph, node_n, fuse_ops, 3)) {
+            const struct ggml_tensor * mul_node = cgraph->nodes[node_n + 1];
+            const struct ggml_tensor * add_node = cgraph->nodes[node_n + 2];
+            const struct ggml_tensor * mul_w = (mul_node->src[0] == node)
+                ? mul_node->src[1] : mul_node->src[0];
+            const struct ggml_tensor * add_b = (add_node->src[0] == mul_node)
+                ? add_node->src[1] : add_node->src[0];
+            if (node->src[0]->type  == GGML_TYPE_F32 &&
+                node->src[0]->nb[0] == sizeof(float) &&
+                add_node->type      == GGML_TYPE_F32 &&
+                add_node->nb[0]     == sizeof(float) &&
+                mul_w->type         == GGML_TYPE_F32 &&
+                mul_w->nb[0]        == sizeof(float) &&
+                ggml_can_repeat(mul_w, node)         &&
+                add_b->type         == GGML_TYPE_F32 &&
+                add_b->nb[0]        == sizeof(float) &&
+                ggml_can_repeat(add_b, node)         &&
+                mul_w->ne[0] == node->ne[0] && add_b->ne[0] == node->ne[0]) {
+
+                return 2;
+            }
+        }
+    }
+
+    if (node->op == GGML_OP_ADD) {
+        // ADD + GELU/SILU fusion (bias and activation)
+        const enum ggml_op fuse_ops[] = { GGML_OP_ADD, GGML_OP_UNARY };
+        if (ggml_can_fuse(cgraph, node_n, fuse_ops, 2)) {
+            const struct ggml_tensor * act_node = cgraph->nodes[node_n + 1];
+            const enum ggml_unary_op act = ggml_get_unary_op(act_node);
+            const struct ggml_tensor * src0 = node->src[0];
+            const struct ggml_tensor * src1 = node->src[1];
+            if ((act == GGML_UNARY_OP_GELU || act == GGML_UNARY_OP_SILU) &&
+                src0->type     == GGML_TYPE_F32   &&
+                src1->type     == GGML_TYPE_F32   &&
+                act_node->type == GGML_TYPE_F32   &&
+                src0->nb[0]     == sizeof(float)  &&
+                src1->nb[0]     == sizeof(float)  &&
+                act_node->nb[0] == sizeof(float)  &&
+                ggml_are_same_shape(src0, node)   &&
+                src1->ne[0] == src0->ne[0]) {
+
+                return 1;
+            }
+        }
+    }
+
+    if (node->op == GGML_OP_SCALE) {
+        // SCALE + ADD fusion (scaled residual)
+        const enum ggml_op fuse_ops[] = { GGML_OP_SCALE, GGML_OP_ADD };
+        if (ggml_can_fuse(cgraph, node_n, fuse_ops, 2)) {
+            const struct ggml_tensor * add_node = cgraph->nodes[node_n + 1];
+            const struct ggml_tensor * other = (add_node->src[0] == node)
+                ? add_node->src[1] : add_node->src[0];
+            if (node->src[0]->type == GGML_TYPE_F32 &&
+                other->type        == GGML_TYPE_F32 &&
+                add_node->type     == GGML_TYPE_F32 &&
+                ggml_is_contiguous(node->src[0])    &&
+                ggml_is_contiguous(other)           &&
+                ggml_is_contiguous(add_node)        &&
+                ggml_are_same_shape(other, add_node)) {
+
                 return 1;
             }
         }
@@ -3062,6 +3137,165 @@ static int ggml_cpu_try_fuse_ops(
     return 0;
 }
 
+// Try to fuse the current node with subsequent nodes for better performance.
+// Returns the number of nodes skipped by fusion (>=1), or 0 if no fusion was applied.
+static int ggml_cpu_try_fuse_ops(
+        const struct ggml_cgraph * cgraph,
+        const int node_n,
+        const struct ggml_compute_params * params,
+        const struct ggml_cplan * cplan) {
+
+    const int n_fused = ggml_cpu_fuse_count(cgraph, node_n, cplan);
+    if (n_fused == 0) {
+        return 0;
+    }
+
+    struct ggml_tensor * node = cgraph->nodes[node_n];
+
+    switch (node->op) {
+        case GGML_OP_RMS_NORM:
+            ggml_compute_forward_rms_norm_mul_fused(params, node, cgraph->nodes[node_n + 1]);
+            break;
+        case GGML_OP_NORM:
+            ggml_compute_forward_norm_mul_add_fused(params, node, cgraph->nodes[node_n + 1], cgraph->nodes[node_n + 2]);
+            break;
+        case GGML_OP_ADD:
+            ggml_compute_forward_add_unary_fused(params, node, cgraph->nodes[node_n + 1]);
+            break;
+        case GGML_OP_SCALE:
+            ggml_compute_forward_scale_add_fused(params, node, cgraph->nodes[node_n + 1]);
+            break;
+        default:
+            GGML_ABORT("fatal error");
+    }
+
+    return n_fused;
+}
+
+// Dependency-aware barrier elision (GGML_CPU_GRAPH_DEPS=1)
+//
+// By default, all threads synchronize after every node. For nodes that do not use the shared work buffer,
+// do not synchronize internally and split their rows statically between the threads, the barrier is only
+// needed when the node reads or overwrites memory that is written by one of the nodes computed since the
+// last barrier. Runs of such independent nodes (e.g. the Q, K and V bias adds, or the copies into the KV
+// cache) are therefore executed back-to-back, and each thread moves on to the next node as soon as it has
+// finished its own rows.
+
+#define GGML_CPU_MAX_DEPS_GROUP 16
+
+// true if the node can run without a preceding barrier: no use of wdata, no internal barriers or chunk counters
+static bool ggml_cpu_node_is_simple(const struct ggml_tensor * node) {
+    switch (node->op) {
+        case GGML_OP_ADD:
+        case GGML_OP_SUB:
+        case GGML_OP_MUL:
+        case GGML_OP_DIV:
+            return !ggml_is_quantized(node->src[0]->type) && !ggml_is_quantized(node->src[1]->type);
+        case GGML_OP_SCALE:
+        case GGML_OP_NORM:
+        case GGML_OP_RMS_NORM:
+            return node->src[0]->type == GGML_TYPE_F32;
+        case GGML_OP_UNARY:
+            return !ggml_is_quantized(node->src[0]->type);
+        case GGML_OP_DUP:
+        case GGML_OP_CPY:
+        case GGML_OP_CONT:
+            return !ggml_is_quantized(node->src[0]->type) && !ggml_is_quantized(node->type);
+        case GGML_OP_GET_ROWS:
+            return !ggml_is_quantized(node->src[0]->type);
+        default:
+            return false;
+    }
+}
+
+static bool ggml_cpu_tensors_overlap(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    if (a->data == NULL || b->data == NULL) {
+        // unknown location - assume the worst
+        return true;
+    }
+
+    const uint8_t * a0 = (const uint8_t *) a->data;
+    const uint8_t * b0 = (const uint8_t *) b->data;
+
+    return a0 < b0 + ggml_nbytes(b) && b0 < a0 + ggml_nbytes(a);
+}
+
+// true if no node in [a0, a1] writes memory that a node in [b0, b1] reads or writes, and vice versa
+static bool ggml_cpu_nodes_independent(const struct ggml_cgraph * cgraph, int a0, int a1, int b0, int b1) {
+    for (int i = a0; i <= a1; i++) {
+        const struct ggml_tensor * a = cgraph->nodes[i];
+
+        for (int j = b0; j <= b1; j++) {
+            const struct ggml_tensor * b = cgraph->nodes[j];
+
+            if (ggml_cpu_tensors_overlap(a, b)) {
+                return false;
+            }
+
+            for (int k = 0; k < GGML_MAX_SRC; k++) {
+                if (b->src[k] && ggml_cpu_tensors_overlap(a, b->src[k])) {
+                    return false;
+                }
+                if (a->src[k] && ggml_cpu_tensors_overlap(a->src[k], b)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// range of nodes [first, last] computed by a single ggml_compute_forward call (more than one node when fused)
+struct ggml_cpu_node_range {
+    int first;
+    int last;
+};
+
+// Returns true if the node range [node_n, node_n + n_fused] can start without waiting for the other threads.
+// On success, the range is appended to the group of nodes computed since the last barrier, otherwise the group
+// is reset to contain only this range. The decision only depends on the graph, so all threads agree on it.
+static bool ggml_cpu_deps_try_append(
+        const struct ggml_cgraph * cgraph,
+        struct ggml_cpu_node_range * group,
+        int * n_group,
+        int node_n,
+        int n_fused) {
+    const struct ggml_cpu_node_range range = { node_n, node_n + n_fused };
+
+    bool ok = *n_group > 0 && *n_group < GGML_CPU_MAX_DEPS_GROUP;
+
+    for (int i = range.first; ok && i <= range.last; i++) {
+        ok = ggml_cpu_node_is_simple(cgraph->nodes[i]);
+    }
+
+    for (int i = 0; ok && i < *n_group; i++) {
+        ok = ggml_cpu_nodes_independent(cgraph, group[i].first, group[i].last, range.first, range.last);
+    }
+
+    if (ok) {
+        group[(*n_group)++] = range;
+    } else {
+        group[0] = range;
+        *n_group = 1;
+    }
+
+    return ok;
+}
+
+// index of the next node that has to be computed after node_n, or -1 if there is none
+static int ggml_cpu_next_compute_node(const struct ggml_cgraph * cgraph, int node_n) {
+    for (int i = node_n + 1; i < cgraph->n_nodes; i++) {
+        const struct ggml_tensor * node = cgraph->nodes[i];
+
+        if (!ggml_op_is_empty(node->op) && (node->flags & GGML_TENSOR_FLAG_COMPUTE)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -3090,6 +3324,12 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     GGML_PRINT_DEBUG("thread #%d compute-start cplan %p last-graph %d\n", state->ith, (const void *)cplan, state->last_graph);
 #endif
 
+    // barrier elision relies on every thread visiting the same nodes, which an abort can break
+    const bool use_deps = ggml_cpu_graph_deps && params.nth > 1 && cplan->abort_callback == NULL;
+
+    struct ggml_cpu_node_range deps_group[GGML_CPU_MAX_DEPS_GROUP];
+    int n_deps_group = 0;
+
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
@@ -3117,6 +3357,22 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
             tp->ec    = GGML_STATUS_ABORTED;
         }
 
+        if (use_deps) {
+            const int next = ggml_cpu_next_compute_node(cgraph, node_n);
+            if (next < 0) {
+                // nothing left to compute - the final barrier below is enough
+                continue;
+            }
+
+            if (n_deps_group == 0) {
+                deps_group[n_deps_group++] = (struct ggml_cpu_node_range) { node_n - n_fused, node_n };
+            }
+
+            if (ggml_cpu_deps_try_append(cgraph, deps_group, &n_deps_group, next, ggml_cpu_fuse_count(cgraph, next, cplan))) {
+                continue;
+            }
+        }
+
         if (node_n + 1 < cgraph->n_nodes) {
             ggml_barrier(state->threadpool);
         }
@@ -3893,6 +4149,11 @@ void ggml_cpu_init(void) {
             ggml_cpu_disable_fusion = (env != NULL && atoi(env) == 1);
         }
 
+        {
+            const char * env = getenv("GGML_CPU_GRAPH_DEPS");
+            ggml_cpu_graph_deps = (env != NULL && atoi(env) == 1);
+        }
+
         is_first_call = false;
     }
 
@@ -2229,6 +2229,61 @@ static void ggml_compute_forward_gelu(
     }
 }
 
+// Fused ADD + GELU/SILU (bias and activation): computes dst = act(src0 + src1) in a single pass,
+// where src1 is broadcast over the rows of src0. All tensors are F32 with contiguous rows.
+void ggml_compute_forward_add_unary_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * dst_add,
+        ggml_tensor * dst_unary) {
+
+    GGML_ASSERT(dst_unary->src[0] == dst_add);
+
+    const ggml_tensor * src0 = dst_add->src[0];
+    const ggml_tensor * src1 = dst_add->src[1];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32 && dst_unary->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_are_same_shape(src0, dst_unary) && ggml_can_repeat(src1, src0));
+    GGML_ASSERT(src0->nb[0] == sizeof(float) && src1->nb[0] == sizeof(float) && dst_unary->nb[0] == sizeof(float));
+
+    const ggml_unary_op op = ggml_get_unary_op(dst_unary);
+
+    GGML_ASSERT(op == GGML_UNARY_OP_GELU || op == GGML_UNARY_OP_SILU);
+
+    const ggml_tensor * dst = dst_unary;
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nr = ggml_nrows(src0);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        const int64_t i03 = ir/(ne02*ne01);
+        const int64_t i02 = (ir - i03*ne02*ne01)/ne01;
+        const int64_t i01 = (ir - i03*ne02*ne01 - i02*ne01);
+
+        const float * x = (const float *) ((const char *) src0->data + i03*nb03 + i02*nb02 + i01*nb01);
+        const float * b = (const float *) ((const char *) src1->data + (i03 % ne13)*nb13 + (i02 % ne12)*nb12 + (i01 % ne11)*nb11);
+              float * y = (float *)       ((char *)       dst->data  + i03*nb3 + i02*nb2 + i01*nb1);
+
+        ggml_vec_add_f32(ne00, y, x, b);
+
+        if (op == GGML_UNARY_OP_GELU) {
+            ggml_vec_gelu_f32(ne00, y, y);
+        } else {
+            ggml_vec_silu_f32(ne00, y, y);
+        }
+    }
+}
+
 // ggml_compute_fill
 
 static void ggml_compute_forward_fill_f32(const ggml_compute_params * params, ggml_tensor * dst) {
@@ -3695,11 +3750,29 @@ static void ggml_compute_forward_geglu_quick(
 
 // ggml_compute_forward_norm
 
+// fusion kinds that can be combined with the norm computation in a single pass.
+enum ggml_norm_fuse_op {
+    GGML_NORM_FUSE_OP_NONE,
+    GGML_NORM_FUSE_OP_MUL_ADD,
+};
+
+template <ggml_norm_fuse_op FUSE_OP>
 static void ggml_compute_forward_norm_f32(
         const ggml_compute_params * params,
-        ggml_tensor * dst) {
+        ggml_tensor * dst_norm,
+        ggml_tensor * dst_mul = nullptr,
+        ggml_tensor * dst_add = nullptr) {
 
-    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src0 = dst_norm->src[0];
+    const ggml_tensor * w    = nullptr;
+    const ggml_tensor * b    = nullptr;
+    ggml_tensor       * dst  = dst_norm;
+
+    if constexpr (FUSE_OP == GGML_NORM_FUSE_OP_MUL_ADD) {
+        w   = (dst_mul->src[0] == dst_norm) ? dst_mul->src[1] : dst_mul->src[0];
+        b   = (dst_add->src[0] == dst_mul)  ? dst_add->src[1] : dst_add->src[0];
+        dst = dst_add;
+    }
 
     GGML_ASSERT(ggml_are_same_shape(src0, dst));
 
@@ -3709,7 +3782,7 @@ static void ggml_compute_forward_norm_f32(
     GGML_TENSOR_UNARY_OP_LOCALS
 
     float eps;
-    memcpy(&eps, dst->op_params, sizeof(float));
+    memcpy(&eps, dst_norm->op_params, sizeof(float));
 
     GGML_ASSERT(eps >= 0.0f);
 
@@ -3738,8 +3811,20 @@ static void ggml_compute_forward_norm_f32(
 #endif //GGML_USE_ACCELERATE
 
                     const float scale = 1.0f/sqrtf(variance + eps);
-                    ggml_vec_scale_f32(ne00, yf, scale);
+
+                    if constexpr (FUSE_OP == GGML_NORM_FUSE_OP_MUL_ADD) {
+                        const float * wf = (const float *) ((const char *) w->data + (i01 % w->ne[1])*w->nb[1] + (i02 % w->ne[2])*w->nb[2] + (i03 % w->ne[3])*w->nb[3]);
+                        const float * bf = (const float *) ((const char *) b->data + (i01 % b->ne[1])*b->nb[1] + (i02 % b->ne[2])*b->nb[2] + (i03 % b->ne[3])*b->nb[3]);
+
+                        for (int64_t i00 = 0; i00 < ne00; i00++) {
+                            yf[i00] = (yf[i00]*scale)*wf[i00] + bf[i00];
+                        }
+                    } else {
+                        ggml_vec_scale_f32(ne00, yf, scale);
+                    }
                 } else {
+                    GGML_ASSERT(FUSE_OP == GGML_NORM_FUSE_OP_NONE);
+
                     float sum = 0.0;
                     for (int64_t i00 = 0; i00 < ne00; i00++) {
                         sum += *(const float *) (x + i00*nb00);
@@ -3773,7 +3858,32 @@ void ggml_compute_forward_norm(
     switch (src0->type) {
         case GGML_TYPE_F32:
             {
-                ggml_compute_forward_norm_f32(params, dst);
+                ggml_compute_forward_norm_f32<GGML_NORM_FUSE_OP_NONE>(params, dst);
+            } break;
+        default:
+            {
+                GGML_ABORT("fatal error");
+            }
+    }
+}
+
+// Fused NORM + MUL + ADD (layer norm with weight and bias): computes dst = norm(src0) * w + b in a single pass.
+// The caller must make sure that src0 and dst are F32 with contiguous rows.
+void ggml_compute_forward_norm_mul_add_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * dst_norm,
+        ggml_tensor * dst_mul,
+        ggml_tensor * dst_add) {
+
+    GGML_ASSERT(dst_mul->src[0] == dst_norm || dst_mul->src[1] == dst_norm);
+    GGML_ASSERT(dst_add->src[0] == dst_mul  || dst_add->src[1] == dst_mul);
+
+    const ggml_tensor * src0 = dst_norm->src[0];
+
+    switch (src0->type) {
+        case GGML_TYPE_F32:
+            {
+                ggml_compute_forward_norm_f32<GGML_NORM_FUSE_OP_MUL_ADD>(params, dst_norm, dst_mul, dst_add);
             } break;
         default:
             {
@@ -4635,6 +4745,53 @@ void ggml_compute_forward_scale(
     }
 }
 
+// Fused SCALE + ADD: computes dst = other + (s*x + b) in a single pass, where x is the input of the scale
+// and other is the second operand of the add. All tensors are F32, contiguous and have the same shape.
+void ggml_compute_forward_scale_add_fused(
+        const ggml_compute_params * params,
+        ggml_tensor * dst_scale,
+        ggml_tensor * dst_add) {
+
+    GGML_ASSERT(dst_add->src[0] == dst_scale || dst_add->src[1] == dst_scale);
+
+    const ggml_tensor * src0  = dst_scale->src[0];
+    const ggml_tensor * other = (dst_add->src[0] == dst_scale) ? dst_add->src[1] : dst_add->src[0];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F32 && other->type == GGML_TYPE_F32 && dst_add->type == GGML_TYPE_F32);
+    GGML_ASSERT(ggml_is_contiguous(src0) && ggml_is_contiguous(other) && ggml_is_contiguous(dst_add));
+    GGML_ASSERT(ggml_are_same_shape(src0, dst_add) && ggml_are_same_shape(other, dst_add));
+
+    float s;
+    float b;
+
+    memcpy(&s, (float *) dst_scale->op_params + 0, sizeof(float));
+    memcpy(&b, (float *) dst_scale->op_params + 1, sizeof(float));
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int nc = dst_add->ne[0];
+    const int nr = ggml_nrows(dst_add);
+
+    // rows per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // row range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    for (int i1 = ir0; i1 < ir1; i1++) {
+        const float * x = (const float *) ((const char *) src0->data  + i1*src0->nb[1]);
+        const float * o = (const float *) ((const char *) other->data + i1*other->nb[1]);
+              float * y = (float *)       ((char *)       dst_add->data + i1*dst_add->nb[1]);
+
+        // dst may alias one of the inputs, so this is done element-wise
+        for (int i = 0; i < nc; i++) {
+            y[i] = o[i] + (x[i]*s + b);
+        }
+    }
+}
+
 // ggml_compute_forward_set
 
 static void ggml_compute_forward_set_f32(
@@ -8703,6 +8860,252 @@ static void ggml_compute_forward_flash_attn_ext_f16_one_chunk(
     }
 }
 
+// Small-batch variant of ggml_compute_forward_flash_attn_ext_f16_one_chunk for a few query rows per head, e.g. one
+// token per beam during beam search. The rows of the same head are processed together, so each K/V row is read
+// once for all of them instead of once per query row. The arithmetic of each row is the same as in one_chunk.
+static void ggml_compute_forward_flash_attn_ext_f16_multi_q(
+        const ggml_compute_params * params,
+        ggml_tensor * dst,
+        int ir0, int ir1) {
+    const ggml_tensor * q     = dst->src[0];
+    const ggml_tensor * k     = dst->src[1];
+    const ggml_tensor * v     = dst->src[2];
+    const ggml_tensor * mask  = dst->src[3];
+    const ggml_tensor * sinks = dst->src[4];
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int64_t DK = nek0;
+    const int64_t DV = nev0;
+
+    GGML_ASSERT(ne0 == DV);
+    GGML_ASSERT(ne2 == neq1);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(neq0 == DK);
+    GGML_ASSERT(nev0 == DV);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    // broadcast factors
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    const int64_t rv2 = neq2/nev2;
+    const int64_t rv3 = neq3/nev3;
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    ggml_type         const k_vec_dot_type = ggml_get_type_traits_cpu(k->type)->vec_dot_type;
+    ggml_from_float_t const q_to_vec_dot   = ggml_get_type_traits_cpu(k_vec_dot_type)->from_float;
+    ggml_vec_dot_t    const kq_vec_dot     = ggml_get_type_traits_cpu(k->type)->vec_dot;
+    ggml_to_float_t   const v_to_float     = ggml_get_type_traits(v->type)->to_float;
+
+    GGML_ASSERT((                            q_to_vec_dot) && "fattn: unsupported K-type");
+    GGML_ASSERT((v->type == GGML_TYPE_F32 || v_to_float  ) && "fattn: unsupported V-type");
+
+    static constexpr int MQ = ggml_fa_tile_config::MQ;
+
+    const bool v_is_f16 = v->type == GGML_TYPE_F16;
+
+    int ith = params->ith;
+
+    // Per-thread scratch layout (fits in the tiled flash attention scratch):
+    // VKQ:  MQ * DV (FP32 or FP16 VKQ accumulators)
+    // Q_q:  MQ * DK (Q rows converted to the vec dot type of K)
+    // V32:  DV      (FP32 buffer for converted V rows)
+    float * base = (float *) params->wdata + ith*(MQ*(DK + DV) + DV + CACHE_LINE_SIZE_F32);
+
+    float * VKQ32 = base;
+    char  * Q_q   = (char *) (base + MQ*DV);
+    float * V32   = base + MQ*(DK + DV);
+
+    const size_t q_row_size = ggml_row_size(k_vec_dot_type, DK);
+
+    int ir = ir0;
+    while (ir < ir1) {
+        // q indices of the first row in the group
+        const int iq3 = ir/(neq2*neq1);
+        const int iq2 = (ir - iq3*neq2*neq1)/neq1;
+        const int iq1 = (ir - iq3*neq2*neq1 - iq2*neq1);
+
+        // rows of the same head share the K/V rows
+        const int n_rows = MIN(MQ, MIN((int)(ir1 - ir), (int)(neq1 - iq1)));
+
+        const uint32_t h = iq2; // head index
+        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+        float S[MQ];
+        float M[MQ];
+
+        const ggml_fp16_t * mp[MQ];
+
+        for (int r = 0; r < n_rows; ++r) {
+            S[r] = 0.0f;
+            M[r] = -INFINITY;
+
+            if (v_is_f16) {
+                memset(VKQ32 + r*DV, 0, DV*sizeof(ggml_fp16_t));
+            } else {
+                memset(VKQ32 + r*DV, 0, DV*sizeof(float));
+            }
+
+            mp[r] = mask ? (ggml_fp16_t *)((char *) mask->data + (iq1 + r)*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+
+            const float * pq = (const float *) ((char *) q->data + ((iq1 + r)*nbq1 + iq2*nbq2 + iq3*nbq3));
+            q_to_vec_dot(pq, Q_q + r*q_row_size, DK);
+        }
+
+        // k indices
+        const int ik3 = iq3 / rk3;
+        const int ik2 = iq2 / rk2;
+
+        // v indices
+        const int iv3 = iq3 / rv3;
+        const int iv2 = iq2 / rv2;
+
+        for (int64_t ic = 0; ic < nek1; ++ic) {
+            const char * k_data = (const char *) k->data + ( ic*nbk1 + ik2*nbk2 + ik3*nbk3);
+            const char * v_data = (const char *) v->data + ( ic*nbv1 + iv2*nbv2 + iv3*nbv3);
+
+            bool v_converted = false;
+
+            for (int r = 0; r < n_rows; ++r) {
+                const float mv = mp[r] ? slope*GGML_CPU_FP16_TO_FP32(mp[r][ic]) : 0.0f;
+                if (mv == -INFINITY) {
+                    continue;
+                }
+
+                float s; // KQ value
+
+                kq_vec_dot(DK, &s, 0, k_data, 0, Q_q + r*q_row_size, 0, 1);
+
+                s = s*scale; // scale KQ value
+
+                if (logit_softcap != 0.0f) {
+                    s = logit_softcap*tanhf(s);
+                }
+
+                s += mv; // apply mask
+
+                const float Mold = M[r];
+
+                float ms = 1.0f; // upon new higher max val, scale VKQ and KQ sum with this value
+                float vs = 1.0f; // post-softmax KQ value, expf(s - M)
+
+                if (s > M[r]) {
+                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
+                    M[r] = s;
+                    ms = expf(Mold - M[r]);
+                } else {
+                    // no new maximum, ms == 1.0f, vs != 1.0f
+                    vs = expf(s - M[r]);
+                }
+
+                if (v_is_f16) {
+                    ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + r*DV);
+
+                    if (ms != 1.0f) {
+                        ggml_vec_scale_f16(DV, VKQ16, ms);
+                    }
+                    ggml_vec_mad_f16(DV, VKQ16, (const ggml_fp16_t *) v_data, vs);
+                } else {
+                    if (ms != 1.0f) {
+                        ggml_vec_scale_f32(DV, VKQ32 + r*DV, ms);
+                    }
+
+                    if (v_to_float) {
+                        if (!v_converted) {
+                            v_to_float(v_data, V32, DV);
+                            v_converted = true;
+                        }
+                        ggml_vec_mad_f32(DV, VKQ32 + r*DV, V32, vs);
+                    } else {
+                        // V is F32
+                        ggml_vec_mad_f32(DV, VKQ32 + r*DV, (const float *) v_data, vs);
+                    }
+                }
+
+                S[r] = S[r]*ms + vs; // scale and increment sum with partial sum
+            }
+        }
+
+        for (int r = 0; r < n_rows; ++r) {
+            float * VKQ = VKQ32 + r*DV;
+
+            if (v_is_f16) {
+                // convert in place, back to front so that the FP16 values are read before they are overwritten
+                const ggml_fp16_t * VKQ16 = (const ggml_fp16_t *) VKQ;
+                for (int64_t d = DV - 1; d >= 0; --d) {
+                    VKQ[d] = GGML_CPU_FP16_TO_FP32(VKQ16[d]);
+                }
+            }
+
+            if (sinks) {
+                const float s = ((float *)((char *) sinks->data))[h];
+
+                float ms = 1.0f;
+                float vs = 1.0f;
+
+                if (s > M[r]) {
+                    ms = expf(M[r] - s);
+                    M[r] = s;
+                    ggml_vec_scale_f32(DV, VKQ, ms);
+                } else {
+                    vs = expf(s - M[r]);
+                }
+
+                S[r] = S[r]*ms + vs;
+            }
+
+            // V /= S
+            const float S_inv = S[r] == 0.0f ? 0.0f : 1.0f/S[r];
+            ggml_vec_scale_f32(DV, VKQ, S_inv);
+
+            // dst indices
+            const int i1 = iq1 + r;
+            const int i2 = iq2;
+            const int i3 = iq3;
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ, nb1);
+        }
+
+        ir += n_rows;
+    }
+}
+
 static void ggml_compute_forward_flash_attn_ext_tiled(
         const ggml_compute_params * params,
         ggml_tensor * dst,
@@ -9182,6 +9585,10 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 #endif
         use_tiled &= (DV % f32_epr == 0);
 #endif
+
+        // a few query rows per head (e.g. one token per beam) - share the K/V reads between the rows
+        const bool use_multi_q = !use_ref && !use_tiled && neq1 > 1;
+
         int current_chunk = ith;
 
         while (current_chunk < nchunk) {
@@ -9190,6 +9597,8 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
             if (use_tiled) {
                 ggml_compute_forward_flash_attn_ext_tiled(params, dst, ir0, ir1);
+            } else if (use_multi_q) {
+                ggml_compute_forward_flash_attn_ext_f16_multi_q(params, dst, ir0, ir1);
             } else {
                 ggml_compute_forward_flash_attn_ext_f16_one_chunk(params, dst, ir0, ir1, 0, nek1, nullptr, 0);
             }
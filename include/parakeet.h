@@ -48,6 +48,15 @@ extern "C" {
     struct parakeet_context_params {
         bool  use_gpu;
         int   gpu_device;  // CUDA device
+
+        // [EXPERIMENTAL] precompute the product of the token embeddings and the input weights of the first
+        // predictor LSTM layer at load time, so that each prediction step gathers one row instead of doing a
+        // matrix-vector product. The table has (n_vocab + 1) x (4 * n_pred_dim) elements.
+        bool           pred_lut;
+        enum ggml_type pred_lut_type; // GGML_TYPE_F32 or GGML_TYPE_F16
+
+        // [EXPERIMENTAL] NUMA strategy of the CPU backend (see whisper_context_params.numa)
+        enum ggml_numa_strategy numa;
     };
 
     typedef struct parakeet_token_data {
@@ -91,6 +100,16 @@ extern "C" {
 
     PARAKEET_API struct parakeet_state * parakeet_init_state(struct parakeet_context * ctx);
 
+    // [EXPERIMENTAL] Compute the graphs of a state on a caller-owned ggml threadpool (see whisper_attach_threadpool())
+    // The threadpool is paused when parakeet_full_with_state() returns. Pass NULL to detach it.
+    PARAKEET_API void parakeet_attach_threadpool(
+        struct parakeet_context * ctx,
+              ggml_threadpool_t   threadpool);
+
+    PARAKEET_API void parakeet_attach_threadpool_with_state(
+          struct parakeet_state * state,
+              ggml_threadpool_t   threadpool);
+
     // Frees all allocated memory
     PARAKEET_API void parakeet_free      (struct parakeet_context * ctx);
     PARAKEET_API void parakeet_free_state(struct parakeet_state * state);
@@ -194,12 +213,38 @@ extern "C" {
     struct parakeet_timings {
         float sample_ms;
         float encode_ms;
-        float decode_ms;
+        float decode_ms;  // joint network
+        float predict_ms; // prediction network
+        float mel_ms;     // total
+
+        // number of runs the per-run times are averaged over
+        int32_t n_sample;
+        int32_t n_encode;
+        int32_t n_decode;
+        int32_t n_predict;
+
+        // totals in microseconds - exact, so that the time between two snapshots can be computed
+        int64_t t_mel_us;
+        int64_t t_sample_us;
+        int64_t t_encode_us;
+        int64_t t_decode_us;
+        int64_t t_predict_us;
     };
     PARAKEET_API struct parakeet_timings * parakeet_get_timings(struct parakeet_context * ctx);
+    PARAKEET_API struct parakeet_timings * parakeet_get_timings_from_state(struct parakeet_state * state);
     PARAKEET_API void parakeet_print_timings(struct parakeet_context * ctx);
     PARAKEET_API void parakeet_reset_timings(struct parakeet_context * ctx);
 
+    // Bytes allocated by a state for its buffers and compute graphs
+    PARAKEET_API size_t parakeet_get_state_memory_size(struct parakeet_state * state);
+
+    // [EXPERIMENTAL] Tracing
+    // Record begin/end events of the processing stages into per-thread buffers and write them in the
+    // Chrome trace event format. Tracing is global to the library and disabled by default.
+    PARAKEET_API void parakeet_trace_set_enabled(bool enabled);
+    PARAKEET_API void parakeet_trace_clear(void);
+    PARAKEET_API bool parakeet_trace_dump(const char * fname);
+
     // Print system information
     PARAKEET_API const char * parakeet_print_system_info(void);
 
@@ -263,6 +308,10 @@ extern "C" {
         // called each time before ggml computation starts
         ggml_abort_callback abort_callback;
         void * abort_callback_user_data;
+
+        // read back the full row of log-probabilities of the joint network (parakeet_get_logits)
+        // parakeet_token_data.p/plog are always set - when false, they come from reductions in the joint graph
+        bool token_probs;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see parakeet_free_context_params() & parakeet_free_params()
@@ -126,6 +126,22 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        // KV cache data types for the decoder self-attention and cross-attention (F16, Q8_0 or Q4_0)
+        // quantized caches reduce the memory of each state at the cost of some accuracy
+        enum ggml_type type_k_self;
+        enum ggml_type type_v_self;
+        enum ggml_type type_k_cross;
+        enum ggml_type type_v_cross;
+
+        // [EXPERIMENTAL] keep the allocated decoder graph and replay it while the batch size and the KV cache window
+        // do not change - the graph is then only rebuilt when the number of used KV cells crosses the padding
+        bool decode_graph_reuse;
+
+        // [EXPERIMENTAL] NUMA strategy of the CPU backend, selected once per process by the first context that sets it
+        // with GGML_NUMA_STRATEGY_DISTRIBUTE the pages of the model weights are also interleaved over all nodes, so that
+        // the threads on every node read the weights with the same average latency
+        enum ggml_numa_strategy numa;
     };
 
     typedef struct whisper_token_data {
@@ -264,6 +280,20 @@ extern "C" {
                     const char * device,
                     const char * cache_dir);
 
+    // [EXPERIMENTAL] Compute the graphs of a state on a ggml threadpool (see ggml_threadpool_new()).
+    // The cpumask, strict placement, priority and poll level of the threadpool apply to all CPU computations of the
+    // state, which use at most ggml_threadpool_get_n_threads() threads. The threadpool is paused when
+    // whisper_full_with_state() returns.
+    // The threadpool is owned by the caller and must outlive its use. It can be shared by states that do not compute
+    // at the same time. Pass NULL to go back to the threads of the CPU backend.
+    WHISPER_API void whisper_attach_threadpool(
+        struct whisper_context * ctx,
+             ggml_threadpool_t   threadpool);
+
+    WHISPER_API void whisper_attach_threadpool_with_state(
+          struct whisper_state * state,
+             ggml_threadpool_t   threadpool);
+
     // Frees all allocated memory
     WHISPER_API void whisper_free      (struct whisper_context * ctx);
     WHISPER_API void whisper_free_state(struct whisper_state * state);
@@ -441,11 +471,46 @@ extern "C" {
         float decode_ms;
         float batchd_ms;
         float prompt_ms;
+        float mel_ms;   // total
+        float conv_ms;  // per encoder call, part of encode_ms
+        float cross_ms; // per encoder call, part of encode_ms
+        float dtw_ms;   // total
+
+        // number of runs the per-run times are averaged over
+        int32_t n_sample;
+        int32_t n_encode;
+        int32_t n_decode;
+        int32_t n_batchd;
+        int32_t n_prompt;
+
+        int32_t n_fail_p; // temperature fallbacks due to the log probability threshold
+        int32_t n_fail_h; // temperature fallbacks due to the entropy threshold
+
+        // totals in microseconds - exact, so that the time between two snapshots can be computed
+        int64_t t_mel_us;
+        int64_t t_sample_us;
+        int64_t t_encode_us;
+        int64_t t_decode_us;
+        int64_t t_batchd_us;
+        int64_t t_prompt_us;
     };
     WHISPER_API struct whisper_timings * whisper_get_timings(struct whisper_context * ctx);
+    WHISPER_API struct whisper_timings * whisper_get_timings_from_state(struct whisper_state * state);
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Bytes allocated by a state for its KV caches and compute buffers
+    WHISPER_API size_t whisper_get_state_memory_size(struct whisper_state * state);
+
+    // [EXPERIMENTAL] Tracing
+    // Record begin/end events of the processing stages (mel, encode, graph build/alloc/compute, sampling, ...)
+    // from all threads into per-thread buffers and write them in the Chrome trace event format.
+    // The output can be viewed with chrome://tracing or https://ui.perfetto.dev
+    // Tracing is global to the library and disabled by default.
+    WHISPER_API void whisper_trace_set_enabled(bool enabled);
+    WHISPER_API void whisper_trace_clear(void);
+    WHISPER_API bool whisper_trace_dump(const char * fname);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -588,6 +653,27 @@ extern "C" {
         const char * vad_model_path;              // Path to VAD model
 
         whisper_vad_params vad_params;
+
+        // [EXPERIMENTAL] speculative decoding with a smaller draft model
+        // The draft model proposes up to n_draft tokens which the main model verifies in a single batched
+        // decoder pass. The draft model must share the vocabulary of the main model (e.g. tiny/base for
+        // large-v2). Only used for greedy decoding at temperature 0 with a single decoder - the output is
+        // determined by the main model's logits, so it matches regular greedy decoding.
+        struct {
+            struct whisper_context * ctx;     // draft model (nullptr = disabled)
+            struct whisper_state   * state;   // draft state (nullptr = use the default state of ctx)
+            int                      n_draft; // max number of tokens to draft per step
+        } speculative;
+
+        // [EXPERIMENTAL] incremental temperature fallback
+        // early_exit: fail a decoder as soon as its last 32 tokens do not pass entropy_thold or logprob_thold,
+        //             instead of decoding the rest of the window before the checks are made
+        // resume:     on fallback, keep the longest segment-aligned prefix of the failed attempt whose average
+        //             log probability passes logprob_thold and continue from it at the next temperature
+        struct {
+            bool early_exit;
+            bool resume;
+        } fallback;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -692,6 +778,71 @@ extern "C" {
     WHISPER_API int64_t whisper_full_get_vad_segment_t1           (struct whisper_context * ctx, int i);
     WHISPER_API int64_t whisper_full_get_vad_segment_t1_from_state(struct whisper_state * state, int i);
 
+    //
+    // [EXPERIMENTAL] Streaming transcription
+    //
+    // The stream owns the audio buffer, its log mel spectrogram and a whisper_state. Audio is appended with
+    // whisper_stream_push() and the buffer is decoded again each time step_ms of new audio is available.
+    // A token is committed once n_agree consecutive hypotheses agree on it (LocalAgreement) - only the text
+    // after the last committed token can still change. The audio of committed segments is dropped from the
+    // buffer and their text is used as the prompt for the following decodes.
+    //
+    // All times are in centiseconds from the start of the stream.
+    //
+
+    struct whisper_stream;
+
+    // Called with the text of the tokens committed by a single whisper_stream_push() or whisper_stream_flush() call
+    typedef void (*whisper_stream_commit_callback)(struct whisper_context * ctx, struct whisper_stream * stream, const char * text, int64_t t0, int64_t t1, void * user_data);
+
+    struct whisper_stream_params {
+        int step_ms;       // decode the buffer again after this much new audio
+        int trim_ms;       // drop the audio of committed segments once the buffer is longer than this
+        int max_buffer_ms; // commit the current hypothesis if the buffer grows longer than this
+        int n_agree;       // number of consecutive hypotheses that must agree before a token is committed
+
+        whisper_stream_commit_callback commit_callback;
+        void * commit_callback_user_data;
+    };
+
+    WHISPER_API struct whisper_stream_params whisper_stream_default_params(void);
+
+    // The full params are used for every decode. The prompt, the offsets and the token timestamps are
+    // managed by the stream and the new segment / progress callbacks are not called.
+    // The context must outlive the stream.
+    WHISPER_API struct whisper_stream * whisper_stream_init(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+          struct whisper_stream_params   sparams);
+
+    // Same as whisper_stream_init(), but decodes with the provided state instead of creating one
+    // The state is not freed by whisper_stream_free() and must not be used elsewhere while the stream exists
+    WHISPER_API struct whisper_stream * whisper_stream_init_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+          struct whisper_stream_params   sparams);
+
+    WHISPER_API void whisper_stream_free(struct whisper_stream * stream);
+
+    // Append audio to the stream and decode the buffer if enough new audio is available
+    // Returns the number of newly committed tokens, or a negative value on failure
+    WHISPER_API int whisper_stream_push(
+                struct whisper_stream * stream,
+                          const float * samples,
+                                  int   n_samples);
+
+    // Decode the remaining audio and commit the whole hypothesis (e.g. at the end of an utterance)
+    // The stream can be used again afterwards
+    // Returns the number of newly committed tokens, or a negative value on failure
+    WHISPER_API int whisper_stream_flush(struct whisper_stream * stream);
+
+    // All text committed so far
+    WHISPER_API const char * whisper_stream_get_text(struct whisper_stream * stream);
+
+    // The uncommitted text of the latest hypothesis
+    WHISPER_API const char * whisper_stream_get_unstable_text(struct whisper_stream * stream);
+
     //
     // Voice Activity Detection (VAD)
     //
@@ -726,6 +877,9 @@ extern "C" {
     // Reset LSTM hidden/cell states to zero.
     WHISPER_API void whisper_vad_reset_state(struct whisper_vad_context * vctx);
 
+    // [EXPERIMENTAL] Compute the VAD graph on a ggml threadpool (see whisper_attach_threadpool()).
+    WHISPER_API void whisper_vad_attach_threadpool(struct whisper_vad_context * vctx, ggml_threadpool_t threadpool);
+
     WHISPER_API int     whisper_vad_n_probs(struct whisper_vad_context * vctx);
     WHISPER_API float * whisper_vad_probs  (struct whisper_vad_context * vctx);
 
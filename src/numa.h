@@ -0,0 +1,125 @@
+#pragma once
+
+// [EXPERIMENTAL] NUMA placement for the CPU backend
+//
+// The thread placement strategies are implemented by the CPU backend (ggml_numa_init). The helpers here
+// select the strategy once per process and place the host memory of the model according to it.
+//
+// This header is included by both whisper.cpp and parakeet.cpp - everything lives in an anonymous
+// namespace so that each library keeps its own copy.
+
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#if defined(__gnu_linux__)
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// from <numaif.h> - we do not link libnuma
+constexpr int numa_mpol_interleave = 3;
+
+typedef void (*numa_init_t)(enum ggml_numa_strategy numa);
+typedef bool (*numa_is_t)(void);
+
+ggml_backend_reg_t numa_cpu_reg() {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+
+    return dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
+}
+
+// select the NUMA strategy of the CPU backend - only the first call with a strategy other than
+// GGML_NUMA_STRATEGY_DISABLED has an effect
+void numa_init(enum ggml_numa_strategy numa) {
+    if (numa == GGML_NUMA_STRATEGY_DISABLED) {
+        return;
+    }
+
+    static std::once_flag once;
+
+    std::call_once(once, [numa]() {
+        ggml_backend_reg_t reg = numa_cpu_reg();
+        if (reg == nullptr) {
+            return;
+        }
+
+        auto * init_fn = (numa_init_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_numa_init");
+        if (init_fn) {
+            init_fn(numa);
+        }
+    });
+}
+
+// true if the CPU backend detected more than one NUMA node
+bool numa_is_numa() {
+    ggml_backend_reg_t reg = numa_cpu_reg();
+    if (reg == nullptr) {
+        return false;
+    }
+
+    auto * is_numa_fn = (numa_is_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_is_numa");
+
+    return is_numa_fn && is_numa_fn();
+}
+
+int numa_n_nodes() {
+    int n_nodes = 0;
+
+#if defined(__gnu_linux__)
+    char path[256];
+    struct stat st;
+
+    while (n_nodes < 64) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n_nodes);
+        if (stat(path, &st) != 0) {
+            break;
+        }
+        n_nodes++;
+    }
+#endif
+
+    return n_nodes;
+}
+
+// spread the pages of a host buffer round-robin over all NUMA nodes
+// the policy applies only to pages that are faulted in afterwards, so call this before writing to the buffer
+bool numa_interleave(ggml_backend_buffer_t buf) {
+#if defined(__gnu_linux__)
+    if (!ggml_backend_buffer_is_host(buf)) {
+        return false;
+    }
+
+    const int n_nodes = numa_n_nodes();
+    if (n_nodes < 2) {
+        return false;
+    }
+
+    const uintptr_t page  = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t) ggml_backend_buffer_get_base(buf);
+    const uintptr_t end   = begin + ggml_backend_buffer_get_size(buf);
+
+    // mbind works on whole pages - the partial pages at both ends keep the default policy
+    const uintptr_t p0 = (begin + page - 1) & ~(page - 1);
+    const uintptr_t p1 = end & ~(page - 1);
+
+    if (p1 <= p0) {
+        return false;
+    }
+
+    const unsigned long mask = n_nodes < 64 ? (1ul << n_nodes) - 1 : ~0ul;
+
+    return syscall(SYS_mbind, (void *) p0, p1 - p0, numa_mpol_interleave, &mask, 8*sizeof(mask), 0) == 0;
+#else
+    (void) buf;
+    return false;
+#endif
+}
+
+} // namespace
@@ -1,5 +1,7 @@
 #include "parakeet.h"
 #include "parakeet-arch.h"
+#include "numa.h"
+#include "trace.h"
 
 #include "ggml.h"
 #include "ggml-cpp.h"
@@ -181,19 +183,40 @@ static bool ggml_graph_compute_helper(
     return ggml_backend_graph_compute(backend.get(), graph) == GGML_STATUS_SUCCESS;
 }
 
+typedef void (*ggml_backend_cpu_set_threadpool_t)(ggml_backend_t backend, ggml_threadpool_t threadpool);
+typedef int  (*ggml_threadpool_get_n_threads_t)(ggml_threadpool_t threadpool);
+typedef void (*ggml_threadpool_pause_t)(ggml_threadpool_t threadpool);
+
+// threadpool - the graphs of a state are computed on the attached threadpool (if any) with at most as many threads as
+// the threadpool has, otherwise the CPU backend uses its own threads
 static bool ggml_graph_compute_helper(
       ggml_backend_sched_t   sched,
         struct ggml_cgraph * graph,
                        int   n_threads,
+         ggml_threadpool_t   threadpool,
                       bool   sched_reset = true) {
+    TRACE_SCOPE_ARG("graph_compute", ggml_graph_n_nodes(graph));
+
     for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
         ggml_backend_dev_t dev = ggml_backend_get_device(backend);
         ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
 
+        int n_threads_cur = n_threads;
+
+        auto * fn_set_threadpool = (ggml_backend_cpu_set_threadpool_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
+        if (fn_set_threadpool && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            fn_set_threadpool(backend, threadpool);
+
+            auto * fn_get_n_threads = (ggml_threadpool_get_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_get_n_threads");
+            if (threadpool && fn_get_n_threads) {
+                n_threads_cur = std::min(n_threads_cur, fn_get_n_threads(threadpool));
+            }
+        }
+
         auto * fn_set_n_threads = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
         if (fn_set_n_threads) {
-            fn_set_n_threads(backend, n_threads);
+            fn_set_n_threads(backend, n_threads_cur);
         }
     }
 
@@ -206,6 +229,17 @@ static bool ggml_graph_compute_helper(
     return t;
 }
 
+// let the workers of a threadpool sleep until the next graph is computed on it
+static void ggml_threadpool_pause_helper(ggml_threadpool_t threadpool) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
+
+    auto * fn_pause = (ggml_threadpool_pause_t) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_pause");
+    if (threadpool && fn_pause) {
+        fn_pause(threadpool);
+    }
+}
+
 // TODO: move these functions to ggml-base with support for ggml-backend?
 
 
@@ -344,6 +378,9 @@ struct parakeet_lsmt_layer {
 struct parakeet_prediction_network {
     struct ggml_tensor * embed_w = nullptr;
 
+    // optional lookup table embed_w x lstm_layer[0].ih_w, [4 * n_pred_dim, n_vocab + 1]
+    struct ggml_tensor * embed_ih = nullptr;
+
     std::vector<parakeet_lsmt_layer> lstm_layer;
 };
 
@@ -427,10 +464,14 @@ struct parakeet_state {
 
     std::vector<ggml_backend_t> backends;
 
+    // [EXPERIMENTAL] owned by the caller - see parakeet_attach_threadpool_with_state()
+    ggml_threadpool_t threadpool = nullptr;
+
     parakeet_sched sched_encode;
     parakeet_sched sched_decode;
 
     // outputs from encoder stages
+    // enc_out holds the encoder output already projected by the joint encoder layer: [n_pred_dim, n_frames]
     struct ggml_tensor * enc_out     = nullptr;
     struct ggml_tensor * pred_out    = nullptr;
 
@@ -445,8 +486,17 @@ struct parakeet_state {
     std::vector<float> inp_mel;
     std::vector<float> inp_mask;
 
+    // log-probabilities of the last joint call - only computed when token probabilities are requested
     std::vector<float> logits;
 
+    // greedy result of the last joint call
+    int32_t joint_token        = 0;
+    int32_t joint_duration_idx = 0;
+
+    // probability and log-probability of joint_token, from the reductions computed by the joint graph
+    float joint_token_p    = 0.0f;
+    float joint_token_plog = 0.0f;
+
     std::vector<parakeet_segment> result_all;
 
     std::vector<parakeet_token>      decoded_tokens;
@@ -789,7 +839,7 @@ static bool parakeet_pred_state_init(
 static bool parakeet_enc_state_init(
                struct parakeet_state & pstate,
                       ggml_backend_t   backend,
-                                 int   n_audio_state,
+                                 int   n_joint,
                                  int   n_frames_max) {
     pstate.enc_out_buf.resize(ggml_tensor_overhead());
 
@@ -805,7 +855,7 @@ static bool parakeet_enc_state_init(
         return false;
     }
 
-    pstate.enc_out = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_audio_state, n_frames_max);
+    pstate.enc_out = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_joint, n_frames_max);
     pstate.enc_out_buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
     if (!pstate.enc_out_buffer) {
         PARAKEET_LOG_ERROR("%s: failed to allocate memory for enc_out tensor\n", __func__);
@@ -1008,6 +1058,108 @@ static ggml_backend_buffer_type_t select_weight_buft(const parakeet_hparams & hp
 
 // see the convert-parakeet-to-ggml.py script for details
 //
+// compute prediction.embed_ih = lstm_layer[0].ih_w x embed_w on the CPU and store it next to embed_w
+static bool parakeet_model_init_pred_lut(parakeet_model & model, ggml_type type) {
+    if (type != GGML_TYPE_F32 && type != GGML_TYPE_F16) {
+        PARAKEET_LOG_ERROR("%s: unsupported lookup table type %s (use f32 or f16)\n", __func__, ggml_type_name(type));
+        return false;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    ggml_tensor * embed_w = model.prediction.embed_w;
+    ggml_tensor * ih_w    = model.prediction.lstm_layer[0].ih_w;
+
+    const int64_t n_embd   = embed_w->ne[0];
+    const int64_t n_rows   = embed_w->ne[1];
+    const int64_t n_gates  = ih_w->ne[1];
+
+    // host copies of the weights - the embeddings are dequantized since they are the src1 of the matmul
+    std::vector<uint8_t> ih_data(ggml_nbytes(ih_w));
+    std::vector<uint8_t> embed_data(ggml_nbytes(embed_w));
+    ggml_backend_tensor_get(ih_w,    ih_data.data(),    0, ih_data.size());
+    ggml_backend_tensor_get(embed_w, embed_data.data(), 0, embed_data.size());
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 4*ggml_tensor_overhead() + ggml_graph_overhead() + ggml_nbytes(ih_w) +
+                          (n_embd*n_rows + n_gates*n_rows)*sizeof(float) + 1024,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+
+    ggml_context * ctx0 = ggml_init(params);
+    if (!ctx0) {
+        PARAKEET_LOG_ERROR("%s: failed to allocate the lookup table compute context\n", __func__);
+        return false;
+    }
+
+    ggml_tensor * w = ggml_new_tensor_2d(ctx0, ih_w->type, n_embd, n_gates);
+    memcpy(w->data, ih_data.data(), ih_data.size());
+
+    ggml_tensor * x = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_embd, n_rows);
+    if (embed_w->type == GGML_TYPE_F32) {
+        memcpy(x->data, embed_data.data(), embed_data.size());
+    } else {
+        ggml_get_type_traits(embed_w->type)->to_float(embed_data.data(), (float *) x->data, n_embd*n_rows);
+    }
+
+    ggml_tensor * cur = ggml_mul_mat(ctx0, w, x);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_build_forward_expand(gf, cur);
+
+    if (!ggml_graph_compute_helper(gf, std::min(8, (int) std::thread::hardware_concurrency()), nullptr, nullptr)) {
+        PARAKEET_LOG_ERROR("%s: failed to compute the lookup table\n", __func__);
+        ggml_free(ctx0);
+        return false;
+    }
+
+    // the table is placed in the same buffer type as the embeddings that it replaces
+    ggml_backend_buffer_type_t buft = ggml_backend_buffer_get_type(embed_w->buffer);
+
+    struct ggml_init_params params_lut = {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx = ggml_init(params_lut);
+    if (!ctx) {
+        PARAKEET_LOG_ERROR("%s: failed to create the lookup table context\n", __func__);
+        ggml_free(ctx0);
+        return false;
+    }
+    model.ctxs.emplace_back(ctx);
+
+    ggml_tensor * lut = ggml_new_tensor_2d(ctx, type, n_gates, n_rows);
+    ggml_set_name(lut, "pred_embed_ih");
+
+    ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+    if (!buf) {
+        PARAKEET_LOG_ERROR("%s: failed to allocate the lookup table\n", __func__);
+        ggml_free(ctx0);
+        return false;
+    }
+    model.buffers.emplace_back(buf);
+
+    if (type == GGML_TYPE_F32) {
+        ggml_backend_tensor_set(lut, cur->data, 0, ggml_nbytes(lut));
+    } else {
+        std::vector<ggml_fp16_t> tmp(n_gates*n_rows);
+        ggml_fp32_to_fp16_row((const float *) cur->data, tmp.data(), tmp.size());
+        ggml_backend_tensor_set(lut, tmp.data(), 0, ggml_nbytes(lut));
+    }
+
+    ggml_free(ctx0);
+
+    model.prediction.embed_ih = lut;
+
+    PARAKEET_LOG_INFO("%s: predictor lookup table (%s) = %7.2f MB, computed in %.2f ms\n", __func__,
+            ggml_type_name(type), ggml_nbytes(lut)/1e6, (ggml_time_us() - t_start_us)/1000.0);
+
+    return true;
+}
+
 static bool parakeet_model_load(struct parakeet_model_loader * loader, parakeet_context & wctx) {
     PARAKEET_LOG_INFO("%s: loading model\n", __func__);
 
@@ -1412,6 +1564,11 @@ static bool parakeet_model_load(struct parakeet_model_loader * loader, parakeet_
 
             size_t size_main = ggml_backend_buffer_get_size(buf);
             PARAKEET_LOG_INFO("%s: %12s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf), size_main / 1e6);
+
+            // [EXPERIMENTAL] the weights are not written yet, so the pages will be faulted in on all nodes
+            if (wctx.params.numa == GGML_NUMA_STRATEGY_DISTRIBUTE && numa_is_numa() && numa_interleave(buf)) {
+                PARAKEET_LOG_INFO("%s: %12s interleaved over %d NUMA nodes\n", __func__, ggml_backend_buffer_name(buf), numa_n_nodes());
+            }
         }
     }
 
@@ -1511,6 +1668,12 @@ static bool parakeet_model_load(struct parakeet_model_loader * loader, parakeet_
         }
     }
 
+    if (wctx.params.pred_lut) {
+        if (!parakeet_model_init_pred_lut(wctx.model, wctx.params.pred_lut_type)) {
+            return false;
+        }
+    }
+
     auto & buffers = wctx.model.buffers;
     for (auto & buf : buffers) {
         ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
@@ -1963,7 +2126,14 @@ static struct ggml_cgraph * parakeet_build_graph_encode(parakeet_context & pctx,
     ggml_set_name(cur, "encoder_out");
     pstate.n_frames = cur->ne[1];
 
-    struct ggml_tensor * enc_out_view = ggml_view_2d(ctx0, pstate.enc_out, n_state, pstate.n_frames, pstate.enc_out->nb[1], 0);
+    // Project all frames to the joint network hidden dimension at once. The joint network is evaluated
+    // per emitted token and TDT can visit the same frame several times, so doing this per joint call
+    // would repeat the same matrix-vector product.
+    cur = ggml_mul_mat(ctx0, model.joint.enc_w, cur);
+    cur = ggml_add(ctx0, cur, model.joint.enc_b);
+    ggml_set_name(cur, "enc_proj");
+
+    struct ggml_tensor * enc_out_view = ggml_view_2d(ctx0, pstate.enc_out, cur->ne[0], pstate.n_frames, pstate.enc_out->nb[1], 0);
     ggml_build_forward_expand(gf, ggml_cpy(ctx0, cur, enc_out_view));
 
     ggml_free(ctx0);
@@ -1978,6 +2148,8 @@ static bool parakeet_encode_internal(
               const int   n_threads,
     ggml_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    TRACE_SCOPE_ARG("encode", mel_offset);
+
     const int64_t t_start_us = ggml_time_us();
 
     auto & sched = pstate.sched_encode.sched;
@@ -2089,7 +2261,7 @@ static bool parakeet_encode_internal(
         ggml_backend_tensor_set(rel_pos_t, pos.data(), 0, pos.size() * sizeof(float));
     }
 
-    if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+    if (!ggml_graph_compute_helper(sched, gf, n_threads, pstate.threadpool)) {
         return false;
     }
 
@@ -2119,7 +2291,7 @@ static bool parakeet_ensure_encode_sched(
         pstate.enc_out_buffer = nullptr;
         pstate.enc_out = nullptr;
 
-        if (!parakeet_enc_state_init(pstate, pstate.backends[0], pctx.model.hparams.n_audio_state, n_frames_max)) {
+        if (!parakeet_enc_state_init(pstate, pstate.backends[0], pctx.model.hparams.n_pred_dim, n_frames_max)) {
             pstate.sched_encode_n_audio_ctx = 0;
             pstate.n_audio_ctx = prev_n_audio_ctx;
             return false;
@@ -2146,18 +2318,21 @@ static struct ggml_tensor * parakeet_build_graph_lstm_layer(
          struct ggml_cgraph * gf,
          struct ggml_tensor * x_t,       // the current input token embedding
          struct ggml_tensor * w_ih,      // input to hidden weights (4 weight tensors packed)
+         struct ggml_tensor * inp_gates, // precomputed w_ih x x_t (optional, see embed_ih)
          struct ggml_tensor * w_hh,      // hidden to hidden weights (4 weight tensors packed)
          struct ggml_tensor * b_h,       // folded ih+hh bias (4 bias tensors packed)
          struct ggml_tensor * h_state,   // this layers hidden state
          struct ggml_tensor * c_state,   // this layers cell state
                         int   li) {      // layer index (for tensor naming)
 
-    ggml_format_name(x_t, "lstm_layer_%d_x_t", li);
     ggml_format_name(h_state, "lstm_layer_%d_h_state", li);
     ggml_format_name(c_state, "lstm_layer_%d_c_state", li);
 
     // The 4 gates (i, f, o, c) are packed in the same weight tensor.
-    struct ggml_tensor * inp_gates = ggml_mul_mat(ctx0, w_ih, x_t);
+    if (inp_gates == nullptr) {
+        ggml_format_name(x_t, "lstm_layer_%d_x_t", li);
+        inp_gates = ggml_mul_mat(ctx0, w_ih, x_t);
+    }
 
     // Hidden-to-Hidden Projections are also packed in the same weight tensor.
     // b_h holds the folded ih+hh bias (see parakeet_model_load), so it is
@@ -2233,13 +2408,20 @@ static struct ggml_cgraph * parakeet_build_graph_prediction(
     ggml_set_name(token, "token_inp");
     ggml_set_input(token);
 
-    struct ggml_tensor * token_embd = ggml_get_rows(ctx0, model.prediction.embed_w, token);
+    struct ggml_tensor * inpL = nullptr;
 
-    struct ggml_tensor * inpL = token_embd;
+    // With the lookup table the input gates of the first layer are a single row gather.
+    struct ggml_tensor * inp_gates = nullptr;
+    if (model.prediction.embed_ih) {
+        inp_gates = ggml_get_rows(ctx0, model.prediction.embed_ih, token);
+    } else {
+        inpL = ggml_get_rows(ctx0, model.prediction.embed_w, token);
+    }
 
     for (int il = 0; il < hparams.n_pred_layers; ++il) {
         inpL = parakeet_build_graph_lstm_layer(ctx0, gf, inpL,
                 model.prediction.lstm_layer[il].ih_w,
+                il == 0 ? inp_gates : nullptr,
                 model.prediction.lstm_layer[il].hh_w,
                 model.prediction.lstm_layer[il].b_h,
                 pstate.lstm_state.layer[il].h_state,
@@ -2283,15 +2465,11 @@ static struct ggml_cgraph * parakeet_build_graph_joint(
     struct ggml_tensor * pred = pstate.pred_out;
     ggml_format_name(pred, "pred");
 
+    // The encoder output was already projected to the joint network hidden dimension by the encoder graph.
     const int t_idx = batch.i_time[0];
-    struct ggml_tensor * enc_out = ggml_view_1d(ctx0, pstate.enc_out, hparams.n_audio_state,
+    struct ggml_tensor * enc = ggml_view_1d(ctx0, pstate.enc_out, hparams.n_pred_dim,
             (size_t) t_idx * pstate.enc_out->nb[1]);
-    ggml_format_name(enc_out, "enc_out_view");
-
-    // Project the encoder output to the joint network hidden dimension.
-    struct ggml_tensor * enc  = ggml_mul_mat(ctx0, model.joint.enc_w, enc_out);
-    enc = ggml_add(ctx0, enc, model.joint.enc_b);
-    ggml_set_name(enc, "enc");
+    ggml_format_name(enc, "enc_out_view");
 
     struct ggml_tensor * joint = ggml_add(ctx0, enc, pred);
     ggml_set_name(joint, "joint");
@@ -2302,12 +2480,42 @@ static struct ggml_cgraph * parakeet_build_graph_joint(
     ggml_set_output(logits);
     ggml_set_name(logits, "logits");
 
-    struct ggml_tensor * probs = ggml_soft_max(ctx0, logits);
-    struct ggml_tensor * log_probs = ggml_log(ctx0, probs);
-    ggml_set_output(log_probs);
-    ggml_format_name(log_probs, "log_probs");
+    // Greedy decoding only needs the argmax of the token logits (vocab + blank) and of the duration
+    // logits, so these are computed in the graph and only two integers have to be read back. The
+    // softmax is monotonic, so the argmax of the logits is the argmax of the probabilities.
+    const int n_token_logits = hparams.n_vocab + 1;
+
+    struct ggml_tensor * token_argmax = ggml_argmax(ctx0, ggml_view_1d(ctx0, logits, n_token_logits, 0));
+    ggml_set_output(token_argmax);
+    ggml_set_name(token_argmax, "token_argmax");
+
+    struct ggml_tensor * duration_argmax = ggml_argmax(ctx0, ggml_view_1d(ctx0, logits, hparams.n_tdt_durations,
+                n_token_logits*ggml_element_size(logits)));
+    ggml_set_output(duration_argmax);
+    ggml_set_name(duration_argmax, "duration_argmax");
+
+    // The probabilities of the greedy token only need the max and the sum of exp(logit - max) of the token
+    // and the duration logits - the max is the logit at the argmax, so the row is never read back for them.
+    auto build_exp_sum = [&](struct ggml_tensor * x, struct ggml_tensor * idx, int n, const char * name_max, const char * name_sum) {
+        struct ggml_tensor * max = ggml_get_rows(ctx0, ggml_reshape_2d(ctx0, x, 1, n), idx);
+        ggml_set_output(max);
+        ggml_set_name(max, name_max);
+
+        struct ggml_tensor * sum = ggml_sum(ctx0, ggml_exp(ctx0, ggml_sub(ctx0, x, ggml_reshape_1d(ctx0, max, 1))));
+        ggml_set_output(sum);
+        ggml_set_name(sum, name_sum);
+
+        ggml_build_forward_expand(gf, max);
+        ggml_build_forward_expand(gf, sum);
+    };
+
+    build_exp_sum(ggml_view_1d(ctx0, logits, n_token_logits, 0),
+            token_argmax, n_token_logits, "token_max", "token_sum");
+    build_exp_sum(ggml_view_1d(ctx0, logits, hparams.n_tdt_durations, n_token_logits*ggml_element_size(logits)),
+            duration_argmax, hparams.n_tdt_durations, "duration_max", "duration_sum");
 
-    ggml_build_forward_expand(gf, log_probs);
+    ggml_build_forward_expand(gf, token_argmax);
+    ggml_build_forward_expand(gf, duration_argmax);
 
     ggml_free(ctx0);
 
@@ -2321,6 +2529,7 @@ static bool parakeet_predict(
                const int   n_threads,
      ggml_abort_callback   abort_callback,
                    void  * abort_callback_data) {
+    TRACE_SCOPE_ARG("predict", batch.n_tokens);
 
     const int n_tokens   = batch.n_tokens;
 
@@ -2347,7 +2556,7 @@ static bool parakeet_predict(
         }
 
         const int64_t t_compute_start_us = ggml_time_us();
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, pstate.threadpool)) {
             return false;
         }
         pstate.t_predict_compute_us += ggml_time_us() - t_compute_start_us;
@@ -2359,22 +2568,33 @@ static bool parakeet_predict(
     return !(abort_callback && abort_callback(abort_callback_data));
 }
 
+// runs the joint network for the frame batch.i_time[0] and stores the greedy token and duration index in
+// pstate.joint_token/joint_duration_idx and the probability of the token in pstate.joint_token_p/plog.
+// The full row of log-probabilities is only read back and computed into pstate.logits when output_probs is set.
 static bool parakeet_joint(
          parakeet_context & pctx,
            parakeet_state & pstate,
      const parakeet_batch & batch,
                 const int   n_threads,
+                     bool   output_probs,
       ggml_abort_callback   abort_callback,
                      void * abort_callback_data) {
+    TRACE_SCOPE_ARG("joint", batch.n_tokens);
+
     const int64_t t_start_us = ggml_time_us();
 
     const auto & model   = pctx.model;
     const auto & hparams = model.hparams;
-    const int n_tokens   = batch.n_tokens;
 
     auto & logits_out = pstate.logits;
 
     struct ggml_tensor * logits;
+    struct ggml_tensor * token_argmax;
+    struct ggml_tensor * duration_argmax;
+    struct ggml_tensor * token_max;
+    struct ggml_tensor * token_sum;
+    struct ggml_tensor * duration_max;
+    struct ggml_tensor * duration_sum;
 
     {
         auto & sched = pstate.sched_decode.sched;
@@ -2386,21 +2606,60 @@ static bool parakeet_joint(
             return false;
         }
 
-        logits = ggml_graph_node(gf, -1);
+        logits          = ggml_graph_get_tensor(gf, "logits");
+        token_argmax    = ggml_graph_get_tensor(gf, "token_argmax");
+        duration_argmax = ggml_graph_get_tensor(gf, "duration_argmax");
+        token_max       = ggml_graph_get_tensor(gf, "token_max");
+        token_sum       = ggml_graph_get_tensor(gf, "token_sum");
+        duration_max    = ggml_graph_get_tensor(gf, "duration_max");
+        duration_sum    = ggml_graph_get_tensor(gf, "duration_sum");
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, pstate.threadpool)) {
             return false;
         }
+    }
+
+    ggml_backend_tensor_get(token_argmax,    &pstate.joint_token,        0, sizeof(int32_t));
+    ggml_backend_tensor_get(duration_argmax, &pstate.joint_duration_idx, 0, sizeof(int32_t));
+
+    {
+        float t_max, t_sum, d_max, d_sum;
 
+        ggml_backend_tensor_get(token_max,    &t_max, 0, sizeof(float));
+        ggml_backend_tensor_get(token_sum,    &t_sum, 0, sizeof(float));
+        ggml_backend_tensor_get(duration_max, &d_max, 0, sizeof(float));
+        ggml_backend_tensor_get(duration_sum, &d_sum, 0, sizeof(float));
+
+        // log-sum-exp of the token logits, of the duration logits and of the whole row
+        const float lse_t = t_max + logf(t_sum);
+        const float lse_d = d_max + logf(d_sum);
+        const float lse   = std::max(lse_t, lse_d) + log1pf(expf(-fabsf(lse_t - lse_d)));
+
+        // the token is the argmax, so its logit is t_max - p is normalized over the tokens, plog over the whole row
+        pstate.joint_token_p    = 1.0f/t_sum;
+        pstate.joint_token_plog = t_max - lse;
     }
 
-    const int n_logits = hparams.n_vocab + hparams.n_tdt_durations + 1; // one for the blank token
-    logits_out.resize(n_tokens * n_logits);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
+    if (output_probs) {
+        const int n_logits = hparams.n_vocab + hparams.n_tdt_durations + 1; // one for the blank token
+        logits_out.resize(n_logits);
+        ggml_backend_tensor_get(logits, logits_out.data(), 0, sizeof(float)*n_logits);
+
+        // log-softmax over the whole row
+        float max = -INFINITY;
+        for (int i = 0; i < n_logits; ++i) {
+            max = std::max(max, logits_out[i]);
+        }
+
+        double sum = 0.0;
+        for (int i = 0; i < n_logits; ++i) {
+            sum += expf(logits_out[i] - max);
+        }
+
+        const float log_sum = max + logf(sum);
+        for (int i = 0; i < n_logits; ++i) {
+            logits_out[i] -= log_sum;
         }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_logits*i), sizeof(float)*(n_logits*i), sizeof(float)*n_logits);
     }
 
     if (batch.n_tokens == 1) {
@@ -2470,14 +2729,21 @@ static parakeet_token_data create_token_data(
                           int   duration_idx,
                           int   duration_value,
                           int   frame_index,
-                        float   token_logit,
+                         bool   has_probs,
                           int   n_vocab_logits) {
 
-    float token_sum = 0.0f;
-    for (int i = 0; i < n_vocab_logits; ++i) {
-        token_sum += expf(pstate.logits[i]);
+    // use the full row when pstate.logits holds the log-probabilities of the last joint call, otherwise the
+    // reductions of the joint graph
+    float token_p    = pstate.joint_token_p;
+    float token_plog = pstate.joint_token_plog;
+    if (has_probs) {
+        float token_sum = 0.0f;
+        for (int i = 0; i < n_vocab_logits; ++i) {
+            token_sum += expf(pstate.logits[i]);
+        }
+        token_plog = pstate.logits[token_id];
+        token_p    = expf(token_plog) / token_sum;
     }
-    float token_p = expf(token_logit) / token_sum;
 
     parakeet_token_data token_data;
     token_data.id = token_id;
@@ -2485,7 +2751,7 @@ static parakeet_token_data create_token_data(
     token_data.duration_value = duration_value;
     token_data.frame_index = frame_index;
     token_data.p = token_p;
-    token_data.plog = token_logit;
+    token_data.plog = token_plog;
     token_data.t0 = frame_index * pctx.model.hparams.subsampling_factor;
     token_data.t1 = (frame_index + duration_value) * pctx.model.hparams.subsampling_factor;
     token_data.is_word_start = is_word_start_token(pctx.vocab, token_id);
@@ -2499,6 +2765,8 @@ static bool parakeet_decode(
                 parakeet_batch & batch,
                      const int   n_threads,
     const parakeet_full_params * params = nullptr) {
+    TRACE_SCOPE_ARG("decode", pstate.n_frames);
+
     const auto & hparams       = pctx.model.hparams;
     const auto & tdt_durations = pctx.model.tdt_durations;
 
@@ -2507,6 +2775,7 @@ static bool parakeet_decode(
     const int  blank_id                 = pctx.vocab.token_blank;
     const int  n_vocab_logits           = blank_id + 1;
     const int  max_tokens_per_timestep = hparams.n_max_tokens;
+    const bool output_probs            = params && params->token_probs;
 
     // time index into the encoder frame (current time frame)
     int t = 0;
@@ -2544,7 +2813,7 @@ static bool parakeet_decode(
         // The joint network outputs logits for all the tokens in the vocabulary
         // plus the blank token, and also n_duration logits for the duration
         // tokens which contain information about how many frames to skip/advance forward.
-        if (!parakeet_joint(pctx, pstate, batch, n_threads,
+        if (!parakeet_joint(pctx, pstate, batch, n_threads, output_probs,
                 params ? params->abort_callback           : nullptr,
                 params ? params->abort_callback_user_data : nullptr)) {
             return false;
@@ -2552,27 +2821,15 @@ static bool parakeet_decode(
 
         const int64_t t_start_sample_us = ggml_time_us();
 
-        // find the best token (greedy).
+        // the best token (greedy) and the max index of the duration logits
+        // were computed by the joint graph.
         // TODO: implement beam search?
-        int best_token = 0;
-        float max_logit = -1e10f;
-        for (int i = 0; i < n_vocab_logits; ++i) {
-            if (pstate.logits[i] > max_logit) {
-                max_logit = pstate.logits[i];
-                best_token = i;
-            }
-        }
+        const int best_token        = pstate.joint_token;
+        const int best_duration_idx = pstate.joint_duration_idx;
+
+        GGML_ASSERT(best_token        >= 0 && best_token        < n_vocab_logits);
+        GGML_ASSERT(best_duration_idx >= 0 && best_duration_idx < n_tdt_durations);
 
-        // find the max index of the duration logits, and look up that index
-        // value in the tdt_durations array to get the actual duration value.
-        int best_duration_idx = 0;
-        float best_duration_logit = -1e10f;
-        for (int i = 0; i < n_tdt_durations; ++i) {
-            if (pstate.logits[n_vocab_logits + i] > best_duration_logit) {
-                best_duration_logit = pstate.logits[n_vocab_logits + i];
-                best_duration_idx = i;
-            }
-        }
         // look up that max duration index value in the tdt_durations array to
         // get the actual duration value.
         int duration = tdt_durations[best_duration_idx];
@@ -2596,7 +2853,7 @@ static bool parakeet_decode(
 
         parakeet_token_data token_data = create_token_data(
             pctx, pstate, best_token, best_duration_idx, duration, t,
-            max_logit, n_vocab_logits);
+            output_probs, n_vocab_logits);
 
         pstate.decoded_token_data.push_back(token_data);
 
@@ -2957,11 +3214,11 @@ struct parakeet_state * parakeet_init_state(parakeet_context * ctx) {
     state->batch = parakeet_batch_init(batch_size);
 
     {
-        const int n_audio_state    = ctx->model.hparams.n_audio_state;
+        const int n_joint          = ctx->model.hparams.n_pred_dim;
         const int subsampl_factor  = ctx->model.hparams.subsampling_factor;
         const int n_frames_max     = (batch_size + subsampl_factor - 1) / subsampl_factor;
 
-        if (!parakeet_enc_state_init(*state, state->backends[0], n_audio_state, n_frames_max)) {
+        if (!parakeet_enc_state_init(*state, state->backends[0], n_joint, n_frames_max)) {
             PARAKEET_LOG_ERROR("%s: parakeet_enc_state_init() failed\n", __func__);
             parakeet_free_state(state);
             return nullptr;
@@ -3041,6 +3298,9 @@ struct parakeet_context_params parakeet_context_default_params() {
     struct parakeet_context_params result = {
         /*.use_gpu              =*/ true,
         /*.gpu_device           =*/ 0,
+        /*.pred_lut             =*/ false,
+        /*.pred_lut_type        =*/ GGML_TYPE_F16,
+        /*.numa                 =*/ GGML_NUMA_STRATEGY_DISABLED,
     };
     return result;
 }
@@ -3134,6 +3394,8 @@ struct parakeet_context * parakeet_init_with_params_no_state(struct parakeet_mod
     PARAKEET_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     PARAKEET_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
+    numa_init(params.numa);
+
     parakeet_context * ctx = new parakeet_context;
     ctx->params = params;
 
@@ -3207,6 +3469,14 @@ struct parakeet_context * parakeet_init_with_params(struct parakeet_model_loader
     return ctx;
 }
 
+void parakeet_attach_threadpool_with_state(struct parakeet_state * state, ggml_threadpool_t threadpool) {
+    state->threadpool = threadpool;
+}
+
+void parakeet_attach_threadpool(struct parakeet_context * ctx, ggml_threadpool_t threadpool) {
+    parakeet_attach_threadpool_with_state(ctx->state, threadpool);
+}
+
 void parakeet_free_state(struct parakeet_state * state) {
     if (state) {
         ggml_backend_buffer_free(state->lstm_state.buffer);
@@ -3255,6 +3525,8 @@ void parakeet_free_params(struct parakeet_full_params * params) {
 }
 
 int parakeet_pcm_to_mel_with_state(struct parakeet_context * ctx, struct parakeet_state * state, const float * samples, int n_samples, int n_threads) {
+    TRACE_SCOPE_ARG("mel", n_samples);
+
     if (!log_mel_spectrogram(*state,
                 samples,
                 n_samples,
@@ -3430,17 +3702,68 @@ parakeet_token parakeet_token_blank(struct parakeet_context * ctx) {
     return ctx->vocab.token_blank;
 }
 
+void parakeet_trace_set_enabled(bool enabled) {
+    trace_set_enabled(enabled);
+}
+
+void parakeet_trace_clear(void) {
+    trace_clear();
+}
+
+bool parakeet_trace_dump(const char * fname) {
+    if (!trace_dump(fname, "parakeet")) {
+        PARAKEET_LOG_ERROR("%s: failed to write trace to '%s'\n", __func__, fname);
+        return false;
+    }
+
+    return true;
+}
+
 struct parakeet_timings * parakeet_get_timings(struct parakeet_context * ctx) {
     if (ctx->state == nullptr) {
         return nullptr;
     }
+    return parakeet_get_timings_from_state(ctx->state);
+}
+
+struct parakeet_timings * parakeet_get_timings_from_state(struct parakeet_state * state) {
     parakeet_timings * timings = new parakeet_timings;
-    timings->sample_ms = 1e-3f * ctx->state->t_sample_us / std::max(1, ctx->state->n_sample);
-    timings->encode_ms = 1e-3f * ctx->state->t_encode_us / std::max(1, ctx->state->n_encode);
-    timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
+    timings->sample_ms = 1e-3f * state->t_sample_us / std::max(1, state->n_sample);
+    timings->encode_ms = 1e-3f * state->t_encode_us / std::max(1, state->n_encode);
+    timings->decode_ms = 1e-3f * state->t_decode_us / std::max(1, state->n_decode);
+    timings->predict_ms = 1e-3f * state->t_predict_us / std::max(1, state->n_predict);
+    timings->mel_ms     = 1e-3f * state->t_mel_us;
+    timings->n_sample   = state->n_sample;
+    timings->n_encode   = state->n_encode;
+    timings->n_decode   = state->n_decode;
+    timings->n_predict  = state->n_predict;
+    timings->t_mel_us     = state->t_mel_us;
+    timings->t_sample_us  = state->t_sample_us;
+    timings->t_encode_us  = state->t_encode_us;
+    timings->t_decode_us  = state->t_decode_us;
+    timings->t_predict_us = state->t_predict_us;
     return timings;
 }
 
+size_t parakeet_get_state_memory_size(struct parakeet_state * state) {
+    size_t size = 0;
+
+    for (ggml_backend_buffer_t buf : { state->enc_out_buffer, state->pred_out_buffer, state->lstm_state.buffer }) {
+        if (buf) {
+            size += ggml_backend_buffer_get_size(buf);
+        }
+    }
+
+    if (state->sched_encode.sched) {
+        size += parakeet_sched_size(state->sched_encode);
+    }
+    if (state->sched_decode.sched) {
+        size += parakeet_sched_size(state->sched_decode);
+    }
+
+    return size;
+}
+
 void parakeet_print_timings(struct parakeet_context * ctx) {
     const int64_t t_end_us = ggml_time_us();
 
@@ -3544,6 +3867,7 @@ struct parakeet_full_params parakeet_full_default_params(enum parakeet_sampling_
         /*.encoder_begin_callback_user_data =*/ nullptr,
         /*.abort_callback                   =*/ nullptr,
         /*.abort_callback_user_data         =*/ nullptr,
+        /*.token_probs                      =*/ false,
     };
 
     return result;
@@ -3573,6 +3897,14 @@ int parakeet_full_with_state(
     struct parakeet_full_params   params,
                     const float * samples,
                            int    n_samples) {
+    TRACE_SCOPE("full");
+
+    // [EXPERIMENTAL] pause the attached threadpool between requests
+    struct threadpool_pause_guard {
+        ggml_threadpool_t threadpool;
+        ~threadpool_pause_guard() { ggml_threadpool_pause_helper(threadpool); }
+    } pause_guard = { state->threadpool };
+
     state->result_all.clear();
 
     if (params.no_context) {
@@ -3657,7 +3989,7 @@ int parakeet_full_with_state(
         if (!text.empty()) {
             parakeet_segment seg;
             seg.t0     = 0;
-            seg.t1     = state->n_frames;
+            seg.t1     = n_mel_total; // mel frames, like the token timestamps
             seg.text   = text;
             seg.tokens = result_tokens;
             state->result_all.push_back(std::move(seg));
@@ -0,0 +1,193 @@
+#pragma once
+
+// [EXPERIMENTAL] lightweight scoped tracing with Chrome trace export
+//
+// Each thread appends complete events (name, begin, end, argument) to its own fixed-size buffer, so
+// recording does not take any locks. A thread takes a buffer from the registry on its first event and
+// hands it back when it exits, so that short-lived threads (e.g. the sampling workers that are created on
+// every decoder step) reuse the buffers of finished threads. The buffers are only read when the trace is
+// written out. When tracing is disabled, a traced scope costs a single branch.
+//
+// This header is included by both whisper.cpp and parakeet.cpp - everything lives in an anonymous
+// namespace so that each library keeps its own registry.
+
+#include "ggml.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct trace_event {
+    const char * name; // must be a string literal
+    int64_t      t0_us;
+    int64_t      t1_us;
+    int64_t      arg;
+};
+
+struct trace_buffer {
+    static constexpr uint32_t capacity = 1u << 15;
+
+    int tid = 0;
+
+    // number of recorded events - written only by the owning thread
+    std::atomic<uint32_t> n         { 0 };
+    std::atomic<uint32_t> n_dropped { 0 };
+
+    std::unique_ptr<trace_event[]> events { new trace_event[capacity] };
+};
+
+struct trace_registry {
+    std::atomic<bool> enabled { false };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<trace_buffer>> buffers;
+    std::vector<trace_buffer *>                free; // the buffers of threads that have exited
+};
+
+trace_registry & trace_get_registry() {
+    static trace_registry registry;
+    return registry;
+}
+
+inline bool trace_enabled() {
+    return trace_get_registry().enabled.load(std::memory_order_relaxed);
+}
+
+// hands the buffer of a thread back to the registry when the thread exits
+// the next thread appends to the recorded events, so its events show up on the same track of the trace
+struct trace_buffer_owner {
+    trace_buffer * buf = nullptr;
+
+    ~trace_buffer_owner() {
+        if (buf) {
+            auto & registry = trace_get_registry();
+
+            std::lock_guard<std::mutex> lock(registry.mutex);
+
+            registry.free.push_back(buf);
+        }
+    }
+};
+
+trace_buffer * trace_get_thread_buffer() {
+    static thread_local trace_buffer_owner owner;
+
+    if (owner.buf == nullptr) {
+        auto & registry = trace_get_registry();
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        if (!registry.free.empty()) {
+            owner.buf = registry.free.back();
+            registry.free.pop_back();
+        } else {
+            registry.buffers.emplace_back(new trace_buffer);
+            owner.buf = registry.buffers.back().get();
+            owner.buf->tid = (int) registry.buffers.size();
+        }
+    }
+
+    return owner.buf;
+}
+
+void trace_record(const char * name, int64_t t0_us, int64_t t1_us, int64_t arg) {
+    trace_buffer * buf = trace_get_thread_buffer();
+
+    const uint32_t n = buf->n.load(std::memory_order_relaxed);
+    if (n >= trace_buffer::capacity) {
+        buf->n_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    buf->events[n] = { name, t0_us, t1_us, arg };
+    buf->n.store(n + 1, std::memory_order_release);
+}
+
+// records the lifetime of the scope as a complete event
+struct trace_scope {
+    const char * name;
+    int64_t      arg;
+    int64_t      t0_us;
+
+    trace_scope(const char * name, int64_t arg = -1) : name(name), arg(arg), t0_us(trace_enabled() ? ggml_time_us() : -1) {}
+
+    ~trace_scope() {
+        if (t0_us >= 0) {
+            trace_record(name, t0_us, ggml_time_us(), arg);
+        }
+    }
+};
+
+void trace_set_enabled(bool enabled) {
+    trace_get_registry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+// note: the events of threads that are still recording may be missing from the output
+void trace_clear() {
+    auto & registry = trace_get_registry();
+
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    for (auto & buf : registry.buffers) {
+        buf->n.store(0, std::memory_order_release);
+        buf->n_dropped.store(0, std::memory_order_relaxed);
+    }
+}
+
+// write the events in the Chrome trace event format (chrome://tracing, https://ui.perfetto.dev)
+bool trace_dump(const char * fname, const char * cat) {
+    FILE * f = fopen(fname, "w");
+    if (f == nullptr) {
+        return false;
+    }
+
+    auto & registry = trace_get_registry();
+
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool first = true;
+    for (const auto & buf : registry.buffers) {
+        const uint32_t n = buf->n.load(std::memory_order_acquire);
+        if (n == 0) {
+            continue;
+        }
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s thread %d\",\"dropped\":%u}}",
+                first ? "" : ",\n", buf->tid, cat, buf->tid, buf->n_dropped.load(std::memory_order_relaxed));
+        first = false;
+
+        for (uint32_t i = 0; i < n; ++i) {
+            const trace_event & ev = buf->events[i];
+
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64,
+                    ev.name, cat, buf->tid, ev.t0_us, ev.t1_us - ev.t0_us);
+            if (ev.arg >= 0) {
+                fprintf(f, ",\"args\":{\"v\":%" PRId64 "}", ev.arg);
+            }
+            fprintf(f, "}");
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+
+    const bool ok = ferror(f) == 0;
+
+    fclose(f);
+
+    return ok;
+}
+
+} // namespace
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#define TRACE_SCOPE(name)          trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(name, (int64_t) (arg))
@@ -1,5 +1,7 @@
 #include "whisper.h"
 #include "whisper-arch.h"
+#include "numa.h"
+#include "trace.h"
 
 #include "ggml.h"
 #include "ggml-cpp.h"
@@ -187,19 +189,40 @@ static bool ggml_graph_compute_helper(
     return ggml_backend_graph_compute(backend.get(), graph) == GGML_STATUS_SUCCESS;
 }
 
+typedef void (*ggml_backend_cpu_set_threadpool_t)(ggml_backend_t backend, ggml_threadpool_t threadpool);
+typedef int  (*ggml_threadpool_get_n_threads_t)(ggml_threadpool_t threadpool);
+typedef void (*ggml_threadpool_pause_t)(ggml_threadpool_t threadpool);
+
+// threadpool - the graphs of a state are computed on the attached threadpool (if any) with at most as many threads as
+// the threadpool has, otherwise the CPU backend uses its own threads
 static bool ggml_graph_compute_helper(
       ggml_backend_sched_t   sched,
         struct ggml_cgraph * graph,
                        int   n_threads,
+         ggml_threadpool_t   threadpool,
                       bool   sched_reset = true) {
+    TRACE_SCOPE_ARG("graph_compute", ggml_graph_n_nodes(graph));
+
     for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
         ggml_backend_dev_t dev = ggml_backend_get_device(backend);
         ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
 
+        int n_threads_cur = n_threads;
+
+        auto * fn_set_threadpool = (ggml_backend_cpu_set_threadpool_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
+        if (fn_set_threadpool && ggml_backend_dev_type(dev) == GGML_BACKEND_DEVICE_TYPE_CPU) {
+            fn_set_threadpool(backend, threadpool);
+
+            auto * fn_get_n_threads = (ggml_threadpool_get_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_get_n_threads");
+            if (threadpool && fn_get_n_threads) {
+                n_threads_cur = std::min(n_threads_cur, fn_get_n_threads(threadpool));
+            }
+        }
+
         auto * fn_set_n_threads = (ggml_backend_set_n_threads_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_set_n_threads");
         if (fn_set_n_threads) {
-            fn_set_n_threads(backend, n_threads);
+            fn_set_n_threads(backend, n_threads_cur);
         }
     }
 
@@ -212,6 +235,17 @@ static bool ggml_graph_compute_helper(
     return t;
 }
 
+// let the workers of a threadpool sleep until the next graph is computed on it
+static void ggml_threadpool_pause_helper(ggml_threadpool_t threadpool) {
+    ggml_backend_dev_t dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    ggml_backend_reg_t reg = dev ? ggml_backend_dev_backend_reg(dev) : nullptr;
+
+    auto * fn_pause = (ggml_threadpool_pause_t) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_pause");
+    if (threadpool && fn_pause) {
+        fn_pause(threadpool);
+    }
+}
+
 // TODO: move these functions to ggml-base with support for ggml-backend?
 
 static ggml_tensor * whisper_set_f32(struct ggml_tensor * t, float v) {
@@ -808,6 +842,8 @@ struct whisper_decoder {
     bool completed; // has the decoder completed the current segment?
     bool has_ts;    // have we already sampled a non-beg timestamp token for the current segment?
 
+    int i_bad; // [EXPERIMENTAL] tokens from this index on are not kept by the fallback resume (-1 = none)
+
     // new token probs, logits and logprobs after the last whisper_decode (1-dimensional array: [n_vocab])
     std::vector<float> probs;
     std::vector<float> logits;
@@ -838,6 +874,9 @@ struct whisper_state {
     int64_t t_batchd_us = 0;
     int64_t t_prompt_us = 0;
     int64_t t_mel_us = 0;
+    int64_t t_conv_us  = 0; // part of t_encode_us
+    int64_t t_cross_us = 0; // part of t_encode_us
+    int64_t t_dtw_us   = 0;
 
     int32_t n_sample = 0; // number of tokens sampled
     int32_t n_encode = 0; // number of encoder calls
@@ -846,6 +885,8 @@ struct whisper_state {
     int32_t n_prompt = 0; // number of decoder calls with n_tokens >  1  (prompt encoding)
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
+    int32_t n_draft  = 0; // number of tokens proposed by the draft model (speculative decoding)
+    int32_t n_accept = 0; // number of drafted tokens accepted by the main model
 
     // number of decoders for which we have constructed the KV cache
     int32_t kv_self_n_dec = 0;
@@ -868,6 +909,9 @@ struct whisper_state {
 
     std::vector<ggml_backend_t> backends;
 
+    // [EXPERIMENTAL] owned by the caller - see whisper_attach_threadpool_with_state()
+    ggml_threadpool_t threadpool = nullptr;
+
     // - stores meta info about the intermediate tensors into the `meta` buffers
     whisper_sched sched_conv;
     whisper_sched sched_encode;
@@ -879,8 +923,25 @@ struct whisper_state {
     struct ggml_tensor * embd_enc  = nullptr;
 
     // helpers for GPU offloading
-    std::vector<float> inp_mel;
-    std::vector<float> inp_mask;
+    std::vector<float>   inp_mel;
+    std::vector<float>   inp_mask;
+    std::vector<int64_t> inp_kv_idxs;
+
+    // [EXPERIMENTAL] decoder graph reuse
+    // the last decoder graph is kept allocated in sched_decode and replayed as long as its shape does not change
+    struct decode_graph_key {
+        int32_t n_tokens    = 0;
+        int32_t n_kv        = 0;
+        int32_t n_audio_ctx = 0;
+        bool    aheads      = false;
+
+        bool operator==(const decode_graph_key & other) const {
+            return n_tokens == other.n_tokens && n_kv == other.n_kv && n_audio_ctx == other.n_audio_ctx && aheads == other.aheads;
+        }
+    };
+
+    ggml_cgraph *    gf_decode = nullptr;
+    decode_graph_key gf_decode_key;
 
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
@@ -965,10 +1026,33 @@ static void read_safe(whisper_model_loader * loader, T & dest) {
     BYTESWAP_VALUE(dest);
 }
 
+// check that the requested KV cache type is supported and that the attention heads can be split into whole blocks
+static ggml_type whisper_kv_cache_type(ggml_type type, int64_t n_state_head, const char * name) {
+    switch (type) {
+        case GGML_TYPE_F32:
+        case GGML_TYPE_F16:
+        case GGML_TYPE_Q8_0:
+        case GGML_TYPE_Q4_0:
+            break;
+        default:
+            WHISPER_LOG_WARN("%s: unsupported %s type '%s' - using f16\n", __func__, name, ggml_type_name(type));
+            return GGML_TYPE_F16;
+    }
+
+    if (n_state_head % ggml_blck_size(type) != 0) {
+        WHISPER_LOG_WARN("%s: %s type '%s' requires a head size multiple of %d (got %d) - using f16\n",
+                __func__, name, ggml_type_name(type), (int) ggml_blck_size(type), (int) n_state_head);
+        return GGML_TYPE_F16;
+    }
+
+    return type;
+}
+
 static bool whisper_kv_cache_init(
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                              int64_t   n_text_state,
                              int64_t   n_text_layer,
                                  int   n_ctx) {
@@ -996,8 +1080,8 @@ static bool whisper_kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(ctx, wtype, n_elements);
+    cache.k = ggml_new_tensor_1d(ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(ctx, type_v, n_elements);
 
     cache.buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
     if (!cache.buffer) {
@@ -1855,6 +1939,11 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
             size_t size_main = ggml_backend_buffer_get_size(buf);
             WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf), size_main / 1e6);
+
+            // [EXPERIMENTAL] the weights are not written yet, so the pages will be faulted in on all nodes
+            if (wctx.params.numa == GGML_NUMA_STRATEGY_DISTRIBUTE && numa_is_numa() && numa_interleave(buf)) {
+                WHISPER_LOG_INFO("%s: %12s interleaved over %d NUMA nodes\n", __func__, ggml_backend_buffer_name(buf), numa_n_nodes());
+            }
         }
     }
 
@@ -2303,6 +2392,9 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     const float  Kscale = pow(float(n_state_head), -0.25);
 
+    // quantized V caches cannot be stored transposed - their rows are dequantized before the attention instead
+    const bool v_trans = !wctx.params.flash_attn && !ggml_is_quantized(wstate.kv_cross.v->type);
+
     for (int il = 0; il < model.hparams.n_text_layer; ++il) {
         auto & layer = model.layers_decoder[il];
 
@@ -2323,21 +2415,21 @@ static struct ggml_cgraph * whisper_build_graph_cross(
         struct ggml_tensor * k;
         struct ggml_tensor * v;
 
-        if (wctx.params.flash_attn) {
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+        // the flash-attn path uses the padded context for the layer stride
+        const int n_ctx_layer = wctx.params.flash_attn ? n_ctx_pad : n_ctx;
 
-            v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
-        } else {
-            Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
+        k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
+                ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx_layer));
 
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+        if (v_trans) {
+            Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
             v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
                     (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
                     (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
+        } else {
+            v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
+                    ggml_row_size(wstate.kv_cross.v->type, n_state)*(il*n_ctx_layer));
         }
 
         ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
@@ -2368,10 +2460,16 @@ static bool whisper_encode_internal(
               const int   n_threads,
     ggml_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    TRACE_SCOPE_ARG("encode", mel_offset);
+
     const int64_t t_start_us = ggml_time_us();
 
     // conv
     {
+        TRACE_SCOPE("conv");
+
+        const int64_t t_start_conv_us = ggml_time_us();
+
         auto & sched = wstate.sched_conv.sched;
 
         ggml_cgraph * gf = whisper_build_graph_conv(wctx, wstate);
@@ -2409,7 +2507,7 @@ static bool whisper_encode_internal(
         }
 
         if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            if (!ggml_graph_compute_helper(sched, gf, n_threads, wstate.threadpool)) {
                 return false;
             }
         } else {
@@ -2421,10 +2519,14 @@ static bool whisper_encode_internal(
             whisper_openvino_encode(wstate.ctx_openvino, mel, wstate.embd_enc);
 #endif
         }
+
+        wstate.t_conv_us += ggml_time_us() - t_start_conv_us;
     }
 
     // encoder
     if (!whisper_encode_external(wstate)) {
+        TRACE_SCOPE("encoder");
+
         auto & sched = wstate.sched_encode.sched;
 
         ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
@@ -2434,13 +2536,17 @@ static bool whisper_encode_internal(
             return false;
         }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, wstate.threadpool)) {
             return false;
         }
     }
 
     // cross
     {
+        TRACE_SCOPE("cross");
+
+        const int64_t t_start_cross_us = ggml_time_us();
+
         auto & sched = wstate.sched_cross.sched;
 
         ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
@@ -2450,9 +2556,11 @@ static bool whisper_encode_internal(
             return false;
         }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, wstate.threadpool)) {
             return false;
         }
+
+        wstate.t_cross_us += ggml_time_us() - t_start_cross_us;
     }
 
     wstate.t_encode_us += ggml_time_us() - t_start_us;
@@ -2486,8 +2594,10 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
     const int n_audio_ctx_pad = GGML_PAD(n_audio_ctx, 256);
 
-    const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
-    const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
+    const int32_t n_kv = worst_case ? n_ctx : kv_self.n;
+
+    // the non-flash path stores V transposed, except for quantized caches (see whisper_build_graph_cross)
+    const bool v_trans = !wctx.params.flash_attn && !ggml_is_quantized(kv_self.v->type);
 
     //WHISPER_LOG_DEBUG("%s: n_past = %d, n_tokens = %d, n_audio_ctx = %d, n_ctx = %d\n", __func__, n_past, n_tokens, n_audio_ctx, n_ctx);
 
@@ -2515,6 +2625,11 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     ggml_set_name(KQ_mask, "KQ_mask");
     ggml_set_input(KQ_mask);
 
+    // destination KV cells of the new tokens - an input, so that the graph does not depend on the KV cache head
+    struct ggml_tensor * kv_idxs = ggml_new_tensor_1d(ctx0, GGML_TYPE_I64, n_tokens);
+    ggml_set_name(kv_idxs, "kv_idxs");
+    ggml_set_input(kv_idxs);
+
     struct ggml_tensor * KQ_mask_f16 = ggml_cast(ctx0, KQ_mask, GGML_TYPE_F16);
 
     // token encoding + position encoding
@@ -2575,25 +2690,28 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * k;
                 struct ggml_tensor * v;
 
-                if (wctx.params.flash_attn) {
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
-
-                    v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
-                } else {
-                    Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
+                k = ggml_view_2d(ctx0, kv_self.k, n_state, n_ctx,
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state)*il*n_ctx);
 
-                    k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                if (v_trans) {
+                    // the transposed V cache of the layer as n_state planes of n_ctx single-element rows - the
+                    // same KV cell indices then select the rows of all planes
+                    Vcur = ggml_view_3d(ctx0, Vcur, 1, n_tokens, n_state,
+                            Vcur->nb[1], ggml_element_size(Vcur), 0);
 
-                    v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
-                            (   n_ctx)*ggml_element_size(kv_self.v),
-                            (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
+                    v = ggml_view_3d(ctx0, kv_self.v, 1, n_ctx, n_state,
+                            ggml_element_size(kv_self.v),
+                            ggml_element_size(kv_self.v)*n_ctx,
+                            ggml_element_size(kv_self.v)*n_state*il*n_ctx);
+                } else {
+                    v = ggml_view_2d(ctx0, kv_self.v, n_state, n_ctx,
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state)*il*n_ctx);
                 }
 
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
+                ggml_build_forward_expand(gf, ggml_set_rows(ctx0, k, Kcur,    kv_idxs));
+                ggml_build_forward_expand(gf, ggml_set_rows(ctx0, v, Vcur, kv_idxs));
             }
 
             // ------
@@ -2606,17 +2724,17 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             if (wctx.params.flash_attn) {
                 struct ggml_tensor * V =
                     ggml_view_3d(ctx0, kv_self.v,
                             n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
 
@@ -2627,12 +2745,23 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 struct ggml_tensor * KQ_soft_max = ggml_soft_max_ext(ctx0, KQ, KQ_mask, 1.0f, 0.0f);
 
-                struct ggml_tensor * V =
-                    ggml_view_3d(ctx0, kv_self.v,
+                struct ggml_tensor * V = nullptr;
+
+                if (v_trans) {
+                    V = ggml_view_3d(ctx0, kv_self.v,
                             n_kv, n_state_head, n_head,
                             n_ctx*ggml_element_size(kv_self.v),
                             n_ctx*ggml_element_size(kv_self.v)*n_state_head,
                             n_ctx*ggml_element_size(kv_self.v)*n_state*il);
+                } else {
+                    V = ggml_view_3d(ctx0, kv_self.v,
+                            n_state_head, n_kv, n_head,
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
+
+                    V = ggml_cont(ctx0, ggml_transpose(ctx0, ggml_cast(ctx0, V, GGML_TYPE_F32)));
+                }
 
                 struct ggml_tensor * KQV = ggml_mul_mat(ctx0, V, KQ_soft_max);
 
@@ -2687,16 +2816,16 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx_pad*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx_pad*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
@@ -2705,16 +2834,28 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
-                struct ggml_tensor * Vcross =
-                    ggml_view_3d(ctx0, wstate.kv_cross.v,
+                struct ggml_tensor * Vcross = nullptr;
+
+                if (!ggml_is_quantized(wstate.kv_cross.v->type)) {
+                    Vcross = ggml_view_3d(ctx0, wstate.kv_cross.v,
                             n_audio_ctx, n_state_head, n_head,
                             n_audio_ctx*ggml_element_size(wstate.kv_cross.v),
                             n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state_head,
                             n_audio_ctx*ggml_element_size(wstate.kv_cross.v)*n_state*il);
+                } else {
+                    // quantized V is stored non-transposed (see whisper_build_graph_cross)
+                    Vcross = ggml_view_3d(ctx0, wstate.kv_cross.v,
+                            n_state_head, n_audio_ctx, n_head,
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx*il);
+
+                    Vcross = ggml_cont(ctx0, ggml_transpose(ctx0, ggml_cast(ctx0, Vcross, GGML_TYPE_F32)));
+                }
 
                 // ------
 
@@ -2859,6 +3000,8 @@ static bool whisper_decode_internal(
                    bool   save_alignment_heads_QKs,
     ggml_abort_callback   abort_callback,
                    void * abort_callback_data) {
+    TRACE_SCOPE_ARG("decode", batch.n_tokens);
+
     const int64_t t_start_us = ggml_time_us();
 
     const auto & model   = wctx.model;
@@ -2890,74 +3033,126 @@ static bool whisper_decode_internal(
     {
         auto & sched = wstate.sched_decode.sched;
 
-        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+        const bool graph_reuse = wctx.params.decode_graph_reuse;
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+        whisper_state::decode_graph_key key;
+        key.n_tokens    = n_tokens;
+        key.n_kv        = wstate.kv_self.n;
+        key.n_audio_ctx = wstate.exp_n_audio_ctx;
+        key.aheads      = save_alignment_heads_QKs;
 
-        // set the inputs
-        {
-            struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
-            ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
-        }
+        ggml_cgraph * gf = nullptr;
 
-        {
-            struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
-            for (int i = 0; i < n_tokens; ++i) {
-                const int32_t val = batch.pos[i];
-                ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
+        if (graph_reuse && wstate.gf_decode && wstate.gf_decode_key == key) {
+            gf = wstate.gf_decode;
+        } else {
+            // release the allocation of the previous graph
+            ggml_backend_sched_reset(sched);
+            wstate.gf_decode = nullptr;
+
+            {
+                TRACE_SCOPE("graph_build");
+                gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+            }
+
+            {
+                TRACE_SCOPE("sched_alloc");
+                if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+                    // should never happen as we pre-allocate the memory
+                    return false;
+                }
+            }
+
+            if (graph_reuse) {
+                wstate.gf_decode     = gf;
+                wstate.gf_decode_key = key;
             }
         }
 
         {
-            struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
+            TRACE_SCOPE("set_inputs");
 
-            auto & kv_self = wstate.kv_self;
+            // set the inputs
+            {
+                struct ggml_tensor * embd = ggml_graph_get_tensor(gf, "embd");
+                ggml_backend_tensor_set(embd, batch.token, 0, n_tokens*ggml_element_size(embd));
+            }
+
+            {
+                struct ggml_tensor * position = ggml_graph_get_tensor(gf, "position");
+                for (int i = 0; i < n_tokens; ++i) {
+                    const int32_t val = batch.pos[i];
+                    ggml_backend_tensor_set(position, &val, i*sizeof(int32_t), sizeof(int32_t));
+                }
+            }
+
+            {
+                struct ggml_tensor * KQ_mask = ggml_graph_get_tensor(gf, "KQ_mask");
 
-            const int32_t n_kv = kv_self.n;
+                auto & kv_self = wstate.kv_self;
 
-            wstate.inp_mask.resize(ggml_nelements(KQ_mask));
+                const int32_t n_kv = kv_self.n;
 
-            float * data = wstate.inp_mask.data();
-            memset(data, 0, ggml_nbytes(KQ_mask));
+                wstate.inp_mask.resize(ggml_nelements(KQ_mask));
 
-            for (int h = 0; h < 1; ++h) {
-                for (int j = 0; j < n_tokens; ++j) {
-                    const whisper_pos    pos    = batch.pos[j];
-                    const whisper_seq_id seq_id = batch.seq_id[j][0];
+                float * data = wstate.inp_mask.data();
+                memset(data, 0, ggml_nbytes(KQ_mask));
 
-                    for (int i = 0; i < n_kv; ++i) {
-                        if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
-                            data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
+                for (int h = 0; h < 1; ++h) {
+                    for (int j = 0; j < n_tokens; ++j) {
+                        const whisper_pos    pos    = batch.pos[j];
+                        const whisper_seq_id seq_id = batch.seq_id[j][0];
+
+                        for (int i = 0; i < n_kv; ++i) {
+                            if (!kv_self.cells[i].has_seq_id(seq_id) || kv_self.cells[i].pos > pos) {
+                                data[h*(n_kv*n_tokens) + j*n_kv + i] = -INFINITY;
+                            }
                         }
                     }
-                }
 
-                for (int i = n_tokens; i < n_tokens; ++i) {
-                    for (int j = 0; j < n_kv; ++j) {
-                        data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
+                    for (int i = n_tokens; i < n_tokens; ++i) {
+                        for (int j = 0; j < n_kv; ++j) {
+                            data[h*(n_kv*n_tokens) + i*n_kv + j] = -INFINITY;
+                        }
                     }
                 }
+
+                ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
             }
 
-            ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
+            {
+                const int32_t kv_head = wstate.kv_self.head;
+
+                struct ggml_tensor * kv_idxs = ggml_graph_get_tensor(gf, "kv_idxs");
+
+                wstate.inp_kv_idxs.resize(n_tokens);
+                for (int i = 0; i < n_tokens; ++i) {
+                    wstate.inp_kv_idxs[i] = kv_head + i;
+                }
+
+                ggml_backend_tensor_set(kv_idxs, wstate.inp_kv_idxs.data(), 0, ggml_nbytes(kv_idxs));
+            }
         }
 
         logits = ggml_graph_node(gf, -1);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        // keep the allocation alive when the graph can be replayed
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, wstate.threadpool, !graph_reuse)) {
+            wstate.gf_decode = nullptr;
             return false;
         }
     }
 
-    logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
+    {
+        TRACE_SCOPE("logits_copy");
+
+        logits_out.resize(n_tokens*n_vocab);
+        for (int i = 0; i < n_tokens; i++) {
+            if (batch.logits[i] == 0) {
+                continue;
+            }
+            ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
         }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
     }
 
     if (batch.n_tokens > 1) {
@@ -3107,60 +3302,71 @@ static void fft(float* in, int N, float* out) {
     }
 }
 
+// log mel of a single frame - the first n samples of the frame are windowed, the rest is zero
+// the result of mel bin j is written to out[j*stride]
+static void log_mel_spectrogram_frame(const float * hann, const float * samples, int n, int frame_size,
+                                      const whisper_filters & filters, int n_mel,
+                                      std::vector<float> & fft_in, std::vector<float> & fft_out,
+                                      float * out, int stride) {
+    const int n_fft = filters.n_fft;
+
+    // apply Hann window (~10% faster)
+    for (int j = 0; j < std::min(frame_size, n); j++) {
+        fft_in[j] = hann[j] * samples[j];
+    }
+
+    // fill the rest with zeros
+    if (n < frame_size) {
+        std::fill(fft_in.begin() + n, fft_in.end(), 0.0);
+    }
+
+    // FFT
+    fft(fft_in.data(), frame_size, fft_out.data());
+
+    // Calculate modulus^2 of complex numbers
+    // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
+    for (int j = 0; j < n_fft; j++) {
+        fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+    }
+
+    // mel spectrogram
+    for (int j = 0; j < n_mel; j++) {
+        double sum = 0.0;
+        // unroll loop (suggested by GH user @lunixbochs)
+        int k = 0;
+        for (k = 0; k < n_fft - 3; k += 4) {
+            sum +=
+                    fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
+                    fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
+                    fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
+                    fft_out[k + 3] * filters.data[j * n_fft + k + 3];
+        }
+        // handle n_fft remainder
+        for (; k < n_fft; k++) {
+            sum += fft_out[k] * filters.data[j * n_fft + k];
+        }
+        sum = log10(std::max(sum, 1e-10));
+        out[j * stride] = sum;
+    }
+}
+
 static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
                                               const whisper_filters & filters, whisper_mel & mel) {
     std::vector<float> fft_in(frame_size * 2, 0.0);
     std::vector<float> fft_out(frame_size * 2 * 2 * 2);
 
-    int n_fft = filters.n_fft;
     int i = ith;
 
     // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
-    assert(n_fft == 1 + (frame_size / 2));
+    assert(filters.n_fft == 1 + (frame_size / 2));
 
     // calculate FFT only when fft_in are not all zero
     for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
         const int offset = i * frame_step;
 
-        // apply Hann window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
-        }
-
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
-        }
-
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
-
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
-        }
-
-        // mel spectrogram
-        for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
-        }
+        log_mel_spectrogram_frame(hann, samples.data() + offset, n_samples - offset, frame_size,
+                                  filters, mel.n_mel, fft_in, fft_out, mel.data.data() + i, mel.n_len);
     }
 
     // Otherwise fft_out are all zero
@@ -3381,6 +3587,19 @@ static std::string whisper_openvino_get_path_cache(std::string path_bin) {
 }
 #endif
 
+static void whisper_state_memory(struct whisper_state & state, size_t & kv_size, size_t & compute_size) {
+    kv_size =
+        ggml_backend_buffer_get_size(state.kv_self.buffer) +
+        ggml_backend_buffer_get_size(state.kv_cross.buffer) +
+        ggml_backend_buffer_get_size(state.kv_pad.buffer);
+
+    compute_size =
+        whisper_sched_size(state.sched_conv) +
+        (state.sched_encode.sched ? whisper_sched_size(state.sched_encode) : 0) +
+        whisper_sched_size(state.sched_cross) +
+        whisper_sched_size(state.sched_decode);
+}
+
 struct whisper_state * whisper_init_state(whisper_context * ctx) {
     whisper_state * state = new whisper_state;
 
@@ -3391,10 +3610,17 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         return nullptr;
     }
 
+    const int64_t n_text_state_head = ctx->model.hparams.n_text_state/ctx->model.hparams.n_text_head;
+
+    const ggml_type type_k_self  = whisper_kv_cache_type(ctx->params.type_k_self,  n_text_state_head, "type_k_self");
+    const ggml_type type_v_self  = whisper_kv_cache_type(ctx->params.type_v_self,  n_text_state_head, "type_v_self");
+    const ggml_type type_k_cross = whisper_kv_cache_type(ctx->params.type_k_cross, n_text_state_head, "type_k_cross");
+    const ggml_type type_v_cross = whisper_kv_cache_type(ctx->params.type_v_cross, n_text_state_head, "type_v_cross");
+
     // at this point, we don't know yet how many decoders will be used
     // later during decoding, if more decoders are used, we will recreate the KV cache respectively
     state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], type_k_self, type_v_self,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
@@ -3405,10 +3631,11 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB (K: %s, V: %s)\n", __func__, memory_size / 1e6,
+                ggml_type_name(type_k_self), ggml_type_name(type_v_self));
     }
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], type_k_cross, type_v_cross,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3419,10 +3646,11 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_cross.k) + ggml_nbytes(state->kv_cross.v);
-        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB (K: %s, V: %s)\n", __func__, memory_size / 1e6,
+                ggml_type_name(type_k_cross), ggml_type_name(type_v_cross));
     }
 
-    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype, ctx->itype,
                 ctx->model.hparams.n_audio_state,
                 1,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3551,6 +3779,16 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_decode) / 1e6);
     }
 
+    {
+        size_t kv_size      = 0;
+        size_t compute_size = 0;
+
+        whisper_state_memory(*state, kv_size, compute_size);
+
+        WHISPER_LOG_INFO("%s: state memory = %7.2f MB (kv = %7.2f MB, compute = %7.2f MB)\n", __func__,
+                (kv_size + compute_size) / 1e6, kv_size / 1e6, compute_size / 1e6);
+    }
+
     return state;
 }
 
@@ -3613,6 +3851,14 @@ int whisper_ctx_init_openvino_encoder(
     return whisper_ctx_init_openvino_encoder_with_state(ctx, ctx->state, model_path, device, cache_dir);
 }
 
+void whisper_attach_threadpool_with_state(struct whisper_state * state, ggml_threadpool_t threadpool) {
+    state->threadpool = threadpool;
+}
+
+void whisper_attach_threadpool(struct whisper_context * ctx, ggml_threadpool_t threadpool) {
+    whisper_attach_threadpool_with_state(ctx->state, threadpool);
+}
+
 struct whisper_context_params whisper_context_default_params() {
     struct whisper_context_params result = {
         /*.use_gpu              =*/ true,
@@ -3627,6 +3873,15 @@ struct whisper_context_params whisper_context_default_params() {
             /*.heads            =*/ NULL,
         },
         /*.dtw_mem_size         =*/ 1024*1024*128,
+
+        /*.type_k_self          =*/ GGML_TYPE_F16,
+        /*.type_v_self          =*/ GGML_TYPE_F16,
+        /*.type_k_cross         =*/ GGML_TYPE_F16,
+        /*.type_v_cross         =*/ GGML_TYPE_F16,
+
+        /*.decode_graph_reuse   =*/ true,
+
+        /*.numa                 =*/ GGML_NUMA_STRATEGY_DISABLED,
     };
     return result;
 }
@@ -3727,6 +3982,8 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
+    numa_init(params.numa);
+
     whisper_context * ctx = new whisper_context;
     ctx->params = params;
 
@@ -3897,6 +4154,8 @@ void whisper_free_params(struct whisper_full_params * params) {
 }
 
 int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    TRACE_SCOPE_ARG("mel", n_samples);
+
     if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
         WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
         return -1;
@@ -4266,16 +4525,54 @@ whisper_token whisper_token_transcribe(struct whisper_context * ctx) {
     return ctx->vocab.token_transcribe;
 }
 
+void whisper_trace_set_enabled(bool enabled) {
+    trace_set_enabled(enabled);
+}
+
+void whisper_trace_clear(void) {
+    trace_clear();
+}
+
+bool whisper_trace_dump(const char * fname) {
+    if (!trace_dump(fname, "whisper")) {
+        WHISPER_LOG_ERROR("%s: failed to write trace to '%s'\n", __func__, fname);
+        return false;
+    }
+
+    return true;
+}
+
 struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
     if (ctx->state == nullptr) {
         return nullptr;
     }
+    return whisper_get_timings_from_state(ctx->state);
+}
+
+struct whisper_timings * whisper_get_timings_from_state(struct whisper_state * state) {
     whisper_timings * timings = new whisper_timings;
-    timings->sample_ms = 1e-3f * ctx->state->t_sample_us / std::max(1, ctx->state->n_sample);
-    timings->encode_ms = 1e-3f * ctx->state->t_encode_us / std::max(1, ctx->state->n_encode);
-    timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
-    timings->batchd_ms = 1e-3f * ctx->state->t_batchd_us / std::max(1, ctx->state->n_batchd);
-    timings->prompt_ms = 1e-3f * ctx->state->t_prompt_us / std::max(1, ctx->state->n_prompt);
+    timings->sample_ms = 1e-3f * state->t_sample_us / std::max(1, state->n_sample);
+    timings->encode_ms = 1e-3f * state->t_encode_us / std::max(1, state->n_encode);
+    timings->decode_ms = 1e-3f * state->t_decode_us / std::max(1, state->n_decode);
+    timings->batchd_ms = 1e-3f * state->t_batchd_us / std::max(1, state->n_batchd);
+    timings->prompt_ms = 1e-3f * state->t_prompt_us / std::max(1, state->n_prompt);
+    timings->mel_ms    = 1e-3f * state->t_mel_us;
+    timings->conv_ms   = 1e-3f * state->t_conv_us  / std::max(1, state->n_encode);
+    timings->cross_ms  = 1e-3f * state->t_cross_us / std::max(1, state->n_encode);
+    timings->dtw_ms    = 1e-3f * state->t_dtw_us;
+    timings->n_sample  = state->n_sample;
+    timings->n_encode  = state->n_encode;
+    timings->n_decode  = state->n_decode;
+    timings->n_batchd  = state->n_batchd;
+    timings->n_prompt  = state->n_prompt;
+    timings->n_fail_p  = state->n_fail_p;
+    timings->n_fail_h  = state->n_fail_h;
+    timings->t_mel_us    = state->t_mel_us;
+    timings->t_sample_us = state->t_sample_us;
+    timings->t_encode_us = state->t_encode_us;
+    timings->t_decode_us = state->t_decode_us;
+    timings->t_batchd_us = state->t_batchd_us;
+    timings->t_prompt_us = state->t_prompt_us;
     return timings;
 }
 
@@ -4299,6 +4596,9 @@ void whisper_print_timings(struct whisper_context * ctx) {
         WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
         WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
         WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+        if (ctx->state->n_draft > 0) {
+            WHISPER_LOG_INFO("%s:  draft accept = %5d / %5d tokens ( %6.2f %%)\n", __func__, ctx->state->n_accept, ctx->state->n_draft, 100.0f * ctx->state->n_accept / ctx->state->n_draft);
+        }
     }
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
@@ -4312,14 +4612,30 @@ void whisper_reset_timings(struct whisper_context * ctx) {
         ctx->state->t_decode_us = 0;
         ctx->state->t_batchd_us = 0;
         ctx->state->t_prompt_us = 0;
+        ctx->state->t_conv_us = 0;
+        ctx->state->t_cross_us = 0;
+        ctx->state->t_dtw_us = 0;
         ctx->state->n_sample = 0;
         ctx->state->n_encode = 0;
         ctx->state->n_decode = 0;
         ctx->state->n_batchd = 0;
         ctx->state->n_prompt = 0;
+        ctx->state->n_draft  = 0;
+        ctx->state->n_accept = 0;
+        ctx->state->n_fail_p = 0;
+        ctx->state->n_fail_h = 0;
     }
 }
 
+size_t whisper_get_state_memory_size(struct whisper_state * state) {
+    size_t kv_size      = 0;
+    size_t compute_size = 0;
+
+    whisper_state_memory(*state, kv_size, compute_size);
+
+    return kv_size + compute_size;
+}
+
 static int whisper_has_coreml(void) {
 #ifdef WHISPER_USE_COREML
     return 1;
@@ -4440,6 +4756,8 @@ struct whisper_vad_context {
     std::vector<ggml_backend_t> backends;
     ggml_backend_buffer_t       buffer = nullptr;
     whisper_context_params      params;
+
+    ggml_threadpool_t threadpool = nullptr; // [EXPERIMENTAL] owned by the caller
     std::vector<uint8_t>        ctx_buf;
     whisper_sched               sched;
 
@@ -5117,6 +5435,10 @@ void whisper_vad_reset_state(whisper_vad_context * vctx) {
     ggml_backend_buffer_clear(vctx->buffer, 0);
 }
 
+void whisper_vad_attach_threadpool(whisper_vad_context * vctx, ggml_threadpool_t threadpool) {
+    vctx->threadpool = threadpool;
+}
+
 bool whisper_vad_detect_speech_no_reset(
         struct whisper_vad_context * vctx,
         const float * samples,
@@ -5126,11 +5448,11 @@ bool whisper_vad_detect_speech_no_reset(
         n_chunks += 1;  // Add one more chunk for remaining samples.
     }
 
-    WHISPER_LOG_INFO("%s: detecting speech in %d samples\n", __func__, n_samples);
-    WHISPER_LOG_INFO("%s: n_chunks: %d\n", __func__, n_chunks);
+    WHISPER_LOG_DEBUG("%s: detecting speech in %d samples\n", __func__, n_samples);
+    WHISPER_LOG_DEBUG("%s: n_chunks: %d\n", __func__, n_chunks);
 
     vctx->probs.resize(n_chunks);
-    WHISPER_LOG_INFO("%s: props size: %u\n", __func__, n_chunks);
+    WHISPER_LOG_DEBUG("%s: props size: %u\n", __func__, n_chunks);
 
     std::vector<float> window(vctx->n_window, 0.0f);
 
@@ -5156,7 +5478,7 @@ bool whisper_vad_detect_speech_no_reset(
         const int chunk_len = idx_end - idx_start;
 
         if (chunk_len < vctx->n_window) {
-            WHISPER_LOG_INFO("%s: chunk_len: %d < n_window: %d\n", __func__, chunk_len, vctx->n_window);
+            WHISPER_LOG_DEBUG("%s: chunk_len: %d < n_window: %d\n", __func__, chunk_len, vctx->n_window);
             std::vector<float> partial_chunk(vctx->n_window, 0.0f);
             std::copy(samples + idx_start, samples + idx_end, partial_chunk.begin());
 
@@ -5177,7 +5499,7 @@ bool whisper_vad_detect_speech_no_reset(
         ggml_backend_tensor_set(frame, window.data(), 0, ggml_nelements(frame) * sizeof(float));
 
         // do not reset the scheduler - we will reuse the graph in the next chunk
-        if (!ggml_graph_compute_helper(sched, gf, vctx->n_threads, false)) {
+        if (!ggml_graph_compute_helper(sched, gf, vctx->n_threads, vctx->threadpool, false)) {
             WHISPER_LOG_ERROR("%s: failed to compute VAD graph\n", __func__);
             break;
         }
@@ -5189,10 +5511,12 @@ bool whisper_vad_detect_speech_no_reset(
     }
 
     vctx->t_vad_us += ggml_time_us() - t_start_vad_us;
-    WHISPER_LOG_INFO("%s: vad time = %.2f ms processing %d samples\n", __func__, 1e-3f * vctx->t_vad_us, n_samples);
+    WHISPER_LOG_DEBUG("%s: vad time = %.2f ms processing %d samples\n", __func__, 1e-3f * vctx->t_vad_us, n_samples);
 
     ggml_backend_sched_reset(sched);
 
+    ggml_threadpool_pause_helper(vctx->threadpool);
+
     return true;
 }
 
@@ -6028,6 +6352,17 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.vad_model_path              =*/ nullptr,
 
         /* vad_params =*/ whisper_vad_default_params(),
+
+        /*.speculative =*/ {
+            /*.ctx     =*/ nullptr,
+            /*.state   =*/ nullptr,
+            /*.n_draft =*/ 8,
+        },
+
+        /*.fallback =*/ {
+            /*.early_exit =*/ false,
+            /*.resume     =*/ false,
+        },
     };
 
     switch (strategy) {
@@ -6197,6 +6532,8 @@ static void whisper_process_logits(
               struct whisper_decoder & decoder,
     const struct whisper_full_params   params,
                                float   temperature) {
+    TRACE_SCOPE("process_logits");
+
     const auto & vocab      = ctx.vocab;
     const auto & tokens_cur = decoder.sequence.tokens;
 
@@ -6615,6 +6952,30 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
     return result;
 }
 
+// number of most recent tokens used by the entropy check and by the early exit checks
+#define WHISPER_FALLBACK_WINDOW 32
+
+// entropy of the token ids in [i0, i1)
+static double whisper_tokens_entropy(const std::vector<whisper_token_data> & tokens, int i0, int i1) {
+    int cnt = 0;
+    double entropy = 0.0f;
+
+    std::map<whisper_token, int> token_counts;
+    for (int i = i0; i < i1; ++i) {
+        token_counts[tokens[i].id]++;
+        cnt++;
+    }
+
+    for (const auto & kv : token_counts) {
+        const auto p = kv.second/(double)cnt;
+        entropy -= p*log(p);
+
+        //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
+    }
+
+    return entropy;
+}
+
 // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L178-L192
 static void whisper_sequence_score(
         const struct whisper_full_params & params,
@@ -6641,27 +7002,185 @@ static void whisper_sequence_score(
     sequence.score = result/penalty;
 
     // compute the entropy of the sequence of the last 32 tokens
-    {
-        const int n = 32;
+    sequence.entropy = whisper_tokens_entropy(sequence.tokens, std::max(0, sequence.result_len - WHISPER_FALLBACK_WINDOW), sequence.result_len);
+}
 
-        int cnt = 0;
-        double entropy = 0.0f;
+// [EXPERIMENTAL] incremental temperature fallback
+//
+// returns the length of the longest prefix of the first n_max tokens that ends a segment (a text token followed by
+// a timestamp token) and whose average log probability passes logprob_thold, or 0 if there is none
+static int whisper_sequence_good_prefix(
+              struct whisper_context & ctx,
+        const struct whisper_full_params & params,
+                  const whisper_sequence & sequence,
+                                     int   n_max) {
+    const whisper_token token_eot = whisper_token_eot(&ctx);
+    const whisper_token token_beg = whisper_token_beg(&ctx);
+
+    n_max = std::min(n_max, (int) sequence.tokens.size());
+
+    int    result = 0;
+    double sum    = 0.0;
+
+    for (int i = 0; i < n_max; ++i) {
+        sum += sequence.tokens[i].plog;
 
-        std::map<whisper_token, int> token_counts;
-        for (int i = std::max(0, sequence.result_len - n); i < sequence.result_len; ++i) {
-            token_counts[sequence.tokens[i].id]++;
-            cnt++;
+        if (i > 0 && sequence.tokens[i].id > token_beg && sequence.tokens[i - 1].id < token_eot && sum/(i + 1) >= params.logprob_thold) {
+            result = i + 1;
         }
+    }
+
+    return result;
+}
+
+// [EXPERIMENTAL] speculative decoding
+//
+// map a token between the vocabularies of the main and the draft model - the text tokens are shared, the special
+// tokens are mapped by role and the language and timestamp tokens by their offset (e.g. large-v3 has one language
+// more than the other multilingual models, which shifts all special tokens after the languages)
+// returns -1 if the token has no counterpart in the destination vocabulary
+static whisper_token whisper_token_map(const whisper_vocab & src, const whisper_vocab & dst, whisper_token id) {
+    if (id < src.token_eot) {
+        return id;
+    }
+
+    if (id >= src.token_beg) {
+        const whisper_token res = dst.token_beg + (id - src.token_beg);
+        return res < dst.n_vocab ? res : -1;
+    }
+
+    if (id == src.token_eot)        return dst.token_eot;
+    if (id == src.token_sot)        return dst.token_sot;
+    if (id == src.token_translate)  return dst.token_translate;
+    if (id == src.token_transcribe) return dst.token_transcribe;
+    if (id == src.token_solm)       return dst.token_solm;
+    if (id == src.token_prev)       return dst.token_prev;
+    if (id == src.token_nosp)       return dst.token_nosp;
+    if (id == src.token_not)        return dst.token_not;
+
+    const int lang_id = id - src.token_sot - 1;
+    if (lang_id >= 0 && lang_id < src.num_languages() && lang_id < dst.num_languages()) {
+        return dst.token_sot + 1 + lang_id;
+    }
+
+    return -1;
+}
+
+// use the draft model to propose up to n_draft tokens that follow the given context (prompt + sampled tokens)
+// the draft KV cache is kept between calls and only the part of the context that changed is re-evaluated
+//
+//   - draft_past: the tokens currently stored in the draft KV cache, in the draft vocabulary (updated)
+//   - context:    in the vocabulary of the main model
+//   - decoder:    the main decoder - its sampling state is used to seed the draft logit filters
+//   - result:     the drafted tokens, in the vocabulary of the main model
+//
+static bool whisper_speculative_draft(
+          const whisper_context & ctx,
+                whisper_context & ctx_draft,
+                  whisper_state & state_draft,
+     std::vector<whisper_token> & draft_past,
+const std::vector<whisper_token> & context_main,
+          const whisper_decoder & decoder,
+      const whisper_full_params & params,
+                            int   n_draft,
+     std::vector<whisper_token> & result) {
+    result.clear();
+
+    if (context_main.empty() || n_draft <= 0) {
+        return true;
+    }
+
+    const auto & vocab       = ctx.vocab;
+    const auto & vocab_draft = ctx_draft.vocab;
+
+    // nothing is drafted if a token has no counterpart in the draft vocabulary (e.g. a language the draft model lacks)
+    std::vector<whisper_token> context(context_main.size());
+    for (size_t i = 0; i < context_main.size(); ++i) {
+        context[i] = whisper_token_map(vocab, vocab_draft, context_main[i]);
+        if (context[i] < 0) {
+            return true;
+        }
+    }
+
+    const int n_ctx = whisper_n_text_ctx(&ctx_draft);
+
+    // find the common prefix with the cached tokens - we need to evaluate at least the last token to get its logits
+    int n_past = 0;
+    while (n_past < (int) draft_past.size() && n_past < (int) context.size() - 1 && draft_past[n_past] == context[n_past]) {
+        n_past++;
+    }
+
+    whisper_kv_cache_seq_rm(state_draft.kv_self, 0, n_past, -1);
+    draft_past.resize(n_past);
+
+    auto & batch = state_draft.batch;
+
+    whisper_batch_prep_legacy(batch, context.data() + n_past, context.size() - n_past, n_past, 0);
+
+    if (!whisper_decode_internal(ctx_draft, state_draft, batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+        return false;
+    }
 
-        for (const auto & kv : token_counts) {
-            const auto p = kv.second/(double)cnt;
-            entropy -= p*log(p);
+    draft_past.insert(draft_past.end(), context.begin() + n_past, context.end());
 
-            //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
+    // the draft model uses its own copy of the sampling state - no grammar and no user logit filters
+    whisper_full_params params_draft = params;
+
+    params_draft.logits_filter_callback           = nullptr;
+    params_draft.logits_filter_callback_user_data = nullptr;
+    params_draft.grammar_rules                    = nullptr;
+    params_draft.n_grammar_rules                  = 0;
+
+    auto & decoder_draft = state_draft.decoders[0];
+
+    decoder_draft.sequence   = decoder.sequence;
+    decoder_draft.seek_delta = decoder.seek_delta;
+    decoder_draft.has_ts     = decoder.has_ts;
+    decoder_draft.grammar    = {};
+    decoder_draft.i_batch    = batch.n_tokens - 1;
+
+    for (auto & token : decoder_draft.sequence.tokens) {
+        token.id  = whisper_token_map(vocab, vocab_draft, token.id);
+        token.tid = whisper_token_map(vocab, vocab_draft, token.tid);
+    }
+
+    const whisper_token token_beg = whisper_token_beg(&ctx_draft);
+    const whisper_token token_eot = whisper_token_eot(&ctx_draft);
+
+    while ((int) result.size() < n_draft) {
+        whisper_process_logits(ctx_draft, state_draft, decoder_draft, params_draft, 0.0f);
+
+        const auto token = whisper_sample_token(ctx_draft, decoder_draft, true);
+
+        const whisper_token id = whisper_token_map(vocab_draft, vocab, token.id);
+        if (id < 0) {
+            break;
+        }
+
+        result.push_back(id);
+        decoder_draft.sequence.tokens.push_back(token);
+
+        if (token.id > token_beg) {
+            decoder_draft.seek_delta = 2*(token.id - token_beg);
+            decoder_draft.has_ts     = true;
+        }
+
+        if (token.id == token_eot || (int) result.size() == n_draft || (int) draft_past.size() >= n_ctx) {
+            break;
         }
 
-        sequence.entropy = entropy;
+        whisper_batch_prep_legacy(batch, &token.id, 1, draft_past.size(), 0);
+
+        if (!whisper_decode_internal(ctx_draft, state_draft, batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+            return false;
+        }
+
+        draft_past.push_back(token.id);
+
+        decoder_draft.i_batch = 0;
     }
+
+    return true;
 }
 
 static bool whisper_vad(
@@ -6671,6 +7190,8 @@ static bool whisper_vad(
                    const float * samples,
                            int   n_samples,
             std::vector<float> & filtered_samples) {
+    TRACE_SCOPE_ARG("vad", n_samples);
+
     WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
     int filtered_n_samples = 0;
 
@@ -6832,6 +7353,14 @@ int whisper_full_with_state(
     struct whisper_full_params   params,
                    const float * samples,
                            int   n_samples) {
+    TRACE_SCOPE("full");
+
+    // [EXPERIMENTAL] pause the attached threadpool between requests
+    struct threadpool_pause_guard {
+        ggml_threadpool_t threadpool;
+        ~threadpool_pause_guard() { ggml_threadpool_pause_helper(threadpool); }
+    } pause_guard = { state->threadpool };
+
     // clear old results
     auto & result_all = state->result_all;
 
@@ -6987,6 +7516,51 @@ int whisper_full_with_state(
     }
     state->exp_n_audio_ctx = params.audio_ctx;
 
+    // [EXPERIMENTAL] speculative decoding
+    whisper_context * ctx_draft   = params.speculative.ctx;
+    whisper_state   * state_draft = params.speculative.state ? params.speculative.state : (ctx_draft ? ctx_draft->state : nullptr);
+
+    if (ctx_draft) {
+        const char * reason = nullptr;
+
+        if (state_draft == nullptr) {
+            reason = "the draft context has no state";
+        } else if (state_draft == state) {
+            reason = "the draft state cannot be the same as the main state";
+        } else if (ctx_draft->vocab.token_eot != ctx->vocab.token_eot) {
+            // the text tokens must be the same - the special tokens are mapped (see whisper_token_map)
+            reason = "the draft model text vocabulary does not match the main model";
+        } else if (whisper_n_text_ctx(ctx_draft) != whisper_n_text_ctx(ctx)) {
+            reason = "the draft model text context does not match the main model";
+        } else if (params.audio_ctx > whisper_n_audio_ctx(ctx_draft)) {
+            reason = "audio_ctx is larger than the draft model audio context";
+        } else if (params.speculative.n_draft <= 0) {
+            reason = "n_draft <= 0";
+        } else if (n_samples > 0) {
+            if (whisper_pcm_to_mel_with_state(ctx_draft, state_draft, samples, n_samples, params.n_threads) != 0) {
+                reason = "failed to compute the draft log mel spectrogram";
+            }
+        } else if (state_draft->mel.n_len == 0) {
+            reason = "no log mel spectrogram available for the draft model";
+        }
+
+        if (reason) {
+            WHISPER_LOG_WARN("%s: disabling speculative decoding: %s\n", __func__, reason);
+            ctx_draft   = nullptr;
+            state_draft = nullptr;
+        } else {
+            state_draft->exp_n_audio_ctx = params.audio_ctx;
+        }
+    }
+
+    // the tokens currently stored in the draft KV cache
+    std::vector<whisper_token> draft_past;
+
+    // the tokens drafted in the last verification batch and how many of them were consumed
+    std::vector<whisper_token> draft;
+    std::vector<whisper_token> draft_context;
+    int draft_i = 0;
+
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
 
@@ -7034,6 +7608,8 @@ int whisper_full_with_state(
 
     // main loop
     while (true) {
+        TRACE_SCOPE_ARG("window", seek);
+
         if (params.progress_callback) {
             const int progress_cur = (100*(seek - seek_start))/(seek_end - seek_start);
 
@@ -7059,6 +7635,17 @@ int whisper_full_with_state(
             return -6;
         }
 
+        if (ctx_draft) {
+            if (!whisper_encode_internal(*ctx_draft, *state_draft, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+                WHISPER_LOG_ERROR("%s: failed to encode with the draft model\n", __func__);
+                return -6;
+            }
+
+            // the cross-attention has changed - the cached draft tokens are no longer valid
+            whisper_kv_cache_clear(state_draft->kv_self);
+            draft_past.clear();
+        }
+
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
         if (seek > seek_start && seek + 500 >= seek_end) {
@@ -7068,6 +7655,16 @@ int whisper_full_with_state(
 
         int best_decoder_id = 0;
 
+        // the audio is the same for all temperature fallbacks of this window, so as long as the prompt does not
+        // change, the self-attention KV cache of the prompt and the logits of its last token are computed only once
+        std::vector<whisper_token> prompt_cached;
+        std::vector<float>         prompt_logits;
+        float prompt_no_speech_prob = 0.0f;
+
+        // [EXPERIMENTAL] the prefix of the last failed attempt that the next temperature continues from
+        std::vector<whisper_token_data> resume;
+        int resume_seq = -1;
+
         for (int it = 0; it < (int) temperatures.size(); ++it) {
             const float t_cur = temperatures[it];
 
@@ -7094,6 +7691,12 @@ int whisper_full_with_state(
 
             WHISPER_LOG_DEBUG("\n%s: strategy = %d, decoding with %d decoders, temperature = %.2f\n", __func__, params.strategy, n_decoders_cur, t_cur);
 
+            // speculative decoding is used only for deterministic single-decoder sampling
+            const bool use_draft = ctx_draft && params.strategy == WHISPER_SAMPLING_GREEDY && n_decoders_cur == 1 && t_cur < 1e-6f;
+
+            draft.clear();
+            draft_i = 0;
+
             // TAGS: WHISPER_DECODER_INIT
             for (int j = 0; j < n_decoders_cur; ++j) {
                 auto & decoder = state->decoders[j];
@@ -7112,15 +7715,34 @@ int whisper_full_with_state(
                 decoder.completed = false;
                 decoder.has_ts    = false;
 
+                decoder.i_bad = -1;
+
                 if (params.grammar_rules != nullptr) {
                     decoder.grammar = whisper_grammar_init(params.grammar_rules, params.n_grammar_rules, params.i_start_rule);
                 } else {
                     decoder.grammar = {};
                 }
+
+                // continue from the prefix kept from the previous attempt
+                for (int i = 0; i < (int) resume.size(); ++i) {
+                    const auto & token = resume[i];
+
+                    decoder.sequence.tokens.push_back(token);
+                    decoder.sequence.sum_logprobs_all += token.plog;
+
+                    if (token.id > whisper_token_beg(ctx)) {
+                        decoder.seek_delta = 2*(token.id - whisper_token_beg(ctx));
+                        decoder.sequence.result_len = i + 1;
+                        decoder.has_ts = true;
+                    }
+
+                    whisper_grammar_accept_token(*ctx, decoder.grammar, token.id);
+                }
             }
 
+            const int n_resume = resume.size();
+
             // init prompt and kv cache for the current iteration
-            // TODO: do not recompute the prompt if it is the same as previous time
             {
                 prompt.clear();
 
@@ -7159,12 +7781,18 @@ int whisper_full_with_state(
                 if (state->kv_self_n_dec < n_decoders_cur) {
                     WHISPER_LOG_DEBUG("%s: recreating KV cache: n_decoders_cur = %d\n", __func__, n_decoders_cur);
 
+                    const ggml_type type_k = state->kv_self.k->type;
+                    const ggml_type type_v = state->kv_self.v->type;
+
                     whisper_kv_cache_free(state->kv_self);
 
+                    // the reused decoder graph references the old cache
+                    state->gf_decode = nullptr;
+
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
 
-                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], type_k, type_v,
                                 ctx->model.hparams.n_text_state,
                                 ctx->model.hparams.n_text_layer,
                                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*factor)) {
@@ -7174,33 +7802,88 @@ int whisper_full_with_state(
                     }
 
                     state->kv_self_n_dec = n_decoders_cur;
+
+                    prompt_logits.clear();
                 }
 
-                whisper_kv_cache_clear(state->kv_self);
+                const int n_vocab = ctx->vocab.n_vocab;
+
+                // number of resumed tokens that are already in the KV cache
+                int n_keep = 0;
+
+                if (!prompt_logits.empty() && prompt == prompt_cached && n_resume > 0) {
+                    // keep the prompt and the resumed prefix of the previous attempt and move the prefix to sequence 0
+                    n_keep = n_resume - 1;
+
+                    for (int j = 0; j < WHISPER_MAX_DECODERS; ++j) {
+                        if (j != resume_seq) {
+                            whisper_kv_cache_seq_rm(state->kv_self, j, prompt.size(), -1);
+                        }
+                    }
+
+                    whisper_kv_cache_seq_rm(state->kv_self, resume_seq, prompt.size() + n_keep, -1);
+
+                    if (resume_seq != 0) {
+                        whisper_kv_cache_seq_cp(state->kv_self, resume_seq, 0, prompt.size(), -1);
+                        whisper_kv_cache_seq_rm(state->kv_self, resume_seq, prompt.size(), -1);
+                    }
+
+                    state->no_speech_prob = prompt_no_speech_prob;
+                } else if (!prompt_logits.empty() && prompt == prompt_cached) {
+                    // keep the prompt and discard the tokens generated by the previous attempt
+                    whisper_kv_cache_seq_rm(state->kv_self, -1, prompt.size(), -1);
 
-                whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+                    state->logits.resize(prompt.size()*n_vocab);
+                    std::copy(prompt_logits.begin(), prompt_logits.end(), state->logits.begin() + (prompt.size() - 1)*n_vocab);
+
+                    state->no_speech_prob = prompt_no_speech_prob;
+                } else {
+                    whisper_kv_cache_clear(state->kv_self);
+
+                    whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                        return -8;
+                    }
+
+                    // Calculate no_speech probability after first decode.
+                    // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
+                    {
+                        const int n_logits = ctx->vocab.id_to_token.size();
+                        std::vector<float> logprobs(n_logits);
+                        std::vector<float> probs(n_logits);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
-                    WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
-                    return -8;
+                        whisper_compute_logprobs(state->logits, n_logits, logprobs);
+                        whisper_compute_probs(state->logits, n_logits, logprobs, probs);
+                        state->no_speech_prob = probs[whisper_token_nosp(ctx)];
+                    }
+
+                    prompt_cached = prompt;
+                    prompt_logits.assign(state->logits.begin() + (prompt.size() - 1)*n_vocab, state->logits.begin() + prompt.size()*n_vocab);
+                    prompt_no_speech_prob = state->no_speech_prob;
                 }
 
-                // Calculate no_speech probability after first decode.
-                // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
-                {
-                    const int n_logits = ctx->vocab.id_to_token.size();
-                    std::vector<float> logprobs(n_logits);
-                    std::vector<float> probs(n_logits);
+                if (n_resume > 0) {
+                    WHISPER_LOG_DEBUG("%s: resuming from %d tokens of the previous attempt (%d kept in the KV cache)\n", __func__, n_resume, n_keep);
+
+                    std::vector<whisper_token> tokens(n_resume - n_keep);
+                    for (int i = n_keep; i < n_resume; ++i) {
+                        tokens[i - n_keep] = resume[i].id;
+                    }
 
-                    whisper_compute_logprobs(state->logits, n_logits, logprobs);
-                    whisper_compute_probs(state->logits, n_logits, logprobs, probs);
-                    state->no_speech_prob = probs[whisper_token_nosp(ctx)];
+                    whisper_batch_prep_legacy(state->batch, tokens.data(), tokens.size(), prompt.size() + n_keep, 0);
+
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                        return -8;
+                    }
                 }
 
                 {
                     const int64_t t_start_sample_us = ggml_time_us();
 
-                    state->decoders[0].i_batch = prompt.size() - 1;
+                    state->decoders[0].i_batch = n_resume > 0 ? state->batch.n_tokens - 1 : prompt.size() - 1;
 
                     whisper_process_logits(*ctx, *state, state->decoders[0], params, t_cur);
 
@@ -7218,7 +7901,7 @@ int whisper_full_with_state(
                 }
             }
 
-            for (int i = 0, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
+            for (int i = n_resume, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
                 const int64_t t_start_sample_us = ggml_time_us();
 
                 if (params.strategy == whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH) {
@@ -7230,6 +7913,8 @@ int whisper_full_with_state(
                 // sampling
                 // TODO: avoid memory allocations, optimize, avoid threads?
                 {
+                    TRACE_SCOPE("sample");
+
                     std::atomic<int> j_cur(0);
 
                     auto process = [&]() {
@@ -7382,6 +8067,7 @@ int whisper_full_with_state(
                             if (has_ts && seek_delta > seek_delta_new && result_len < i) {
                                 WHISPER_LOG_DEBUG("%s: decoder %d: failed due to seek_delta (%d > %d)\n", __func__, j, seek_delta, seek_delta_new);
                                 failed = true; // TODO: maybe this is not a failure ?
+                                decoder.i_bad = i;
                                 continue;
                             }
 
@@ -7438,8 +8124,33 @@ int whisper_full_with_state(
                     if (i == n_max - 1 && (result_len == 0 || seek_delta < 100*WHISPER_CHUNK_SIZE/2)) {
                         WHISPER_LOG_DEBUG("%s: decoder %d: failed due to repetition loop\n", __func__, j);
                         failed = true;
+                        decoder.i_bad = 0; // we don't know where the loop started
                         continue;
                     }
+
+                    // [EXPERIMENTAL] apply the entropy and logprob checks to the most recent tokens while decoding
+                    // so that a hopeless attempt does not run until the end of the window
+                    if (params.fallback.early_exit && it != (int) temperatures.size() - 1 && i + 1 >= WHISPER_FALLBACK_WINDOW) {
+                        const auto & tokens = decoder.sequence.tokens;
+
+                        const int i0 = tokens.size() - WHISPER_FALLBACK_WINDOW;
+
+                        double sum_logprobs = 0.0;
+                        for (int k = i0; k < (int) tokens.size(); ++k) {
+                            sum_logprobs += tokens[k].plog;
+                        }
+
+                        const double avg_logprobs = sum_logprobs/WHISPER_FALLBACK_WINDOW;
+                        const double entropy      = whisper_tokens_entropy(tokens, i0, tokens.size());
+
+                        if (entropy < params.entropy_thold ||
+                            (avg_logprobs < params.logprob_thold && state->no_speech_prob < params.no_speech_thold)) {
+                            WHISPER_LOG_DEBUG("%s: decoder %d: early exit at %d (entropy = %8.5f, avg_logprobs = %8.5f)\n", __func__, j, i, entropy, avg_logprobs);
+                            failed = true;
+                            decoder.i_bad = i0;
+                            continue;
+                        }
+                    }
                 }
 
                 // check if all decoders have finished (i.e. completed or failed)
@@ -7471,6 +8182,68 @@ int whisper_full_with_state(
 
                     const int n_past = prompt.size() + i;
 
+                    if (use_draft) {
+                        auto & decoder = state->decoders[0];
+
+                        const whisper_token id = decoder.sequence.tokens.back().id;
+
+                        if (draft_i < (int) draft.size() && draft[draft_i] == id) {
+                            // the sampled token matches the draft - its logits were already computed in the last batch
+                            decoder.i_batch = ++draft_i;
+                            state->n_accept++;
+                        } else {
+                            // discard the rejected draft tokens
+                            whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+                            draft_context = prompt;
+                            for (const auto & token : decoder.sequence.tokens) {
+                                draft_context.push_back(token.id);
+                            }
+
+                            const int n_draft = std::min(params.speculative.n_draft, whisper_n_text_ctx(ctx) - 1 - n_past);
+
+                            if (!whisper_speculative_draft(*ctx, *ctx_draft, *state_draft, draft_past, draft_context, decoder, params, n_draft, draft)) {
+                                WHISPER_LOG_ERROR("%s: failed to decode with the draft model\n", __func__);
+                                return -9;
+                            }
+
+                            draft_i = 0;
+
+                            // verify the sampled token and all drafted tokens in a single batch
+                            batch.token   [0]    = id;
+                            batch.pos     [0]    = n_past;
+                            batch.n_seq_id[0]    = 1;
+                            batch.seq_id  [0][0] = 0;
+                            batch.logits  [0]    = 1;
+                            batch.n_tokens = 1;
+
+                            for (const auto token : draft) {
+                                batch.token   [batch.n_tokens]    = token;
+                                batch.pos     [batch.n_tokens]    = n_past + batch.n_tokens;
+                                batch.n_seq_id[batch.n_tokens]    = 1;
+                                batch.seq_id  [batch.n_tokens][0] = 0;
+                                batch.logits  [batch.n_tokens]    = 1;
+                                batch.n_tokens++;
+                            }
+
+                            if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                                WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                                return -9;
+                            }
+
+                            decoder.i_batch = 0;
+                            state->n_draft += draft.size();
+                        }
+
+                        const int64_t t_start_sample_us = ggml_time_us();
+
+                        whisper_process_logits(*ctx, *state, decoder, params, t_cur);
+
+                        state->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                        continue;
+                    }
+
                     for (int j = 0; j < n_decoders_cur; ++j) {
                         auto & decoder = state->decoders[j];
 
@@ -7561,11 +8334,12 @@ int whisper_full_with_state(
                     WHISPER_LOG_DEBUG("%s: decoder %2d: score = %8.5f, result_len = %3d, avg_logprobs = %8.5f, entropy = %8.5f\n",
                             __func__, j, decoder.sequence.score, decoder.sequence.result_len, decoder.sequence.avg_logprobs, decoder.sequence.entropy);
 
-                    if (decoder.sequence.result_len > 32 && decoder.sequence.entropy < params.entropy_thold) {
+                    if (decoder.sequence.result_len > WHISPER_FALLBACK_WINDOW && decoder.sequence.entropy < params.entropy_thold) {
                         WHISPER_LOG_DEBUG("%s: decoder %2d: failed due to entropy %8.5f < %8.5f\n",
                                 __func__, j, decoder.sequence.entropy, params.entropy_thold);
 
                         decoder.failed = true;
+                        decoder.i_bad  = decoder.sequence.result_len - WHISPER_FALLBACK_WINDOW;
                         state->n_fail_h++;
 
                         continue;
@@ -7605,6 +8379,32 @@ int whisper_full_with_state(
             }
 
             WHISPER_LOG_DEBUG("\n%s: failed to decode with temperature = %.2f\n", __func__, t_cur);
+
+            // [EXPERIMENTAL] keep the longest good prefix of this attempt for the next temperature
+            resume.clear();
+            resume_seq = -1;
+
+            if (params.fallback.resume) {
+                int n_best = 0;
+
+                for (int j = 0; j < n_decoders_cur; ++j) {
+                    const auto & decoder = state->decoders[j];
+
+                    const int n_max = decoder.i_bad >= 0 ? decoder.i_bad : decoder.sequence.tokens.size();
+                    const int n     = whisper_sequence_good_prefix(*ctx, params, decoder.sequence, n_max);
+
+                    if (n > n_best) {
+                        n_best     = n;
+                        resume_seq = j;
+                    }
+                }
+
+                if (n_best > 0) {
+                    const auto & tokens = state->decoders[resume_seq].sequence.tokens;
+
+                    resume.assign(tokens.begin(), tokens.begin() + n_best);
+                }
+            }
         }
 
         // output results through a user-provided callback
@@ -7751,8 +8551,10 @@ int whisper_full_with_state(
                 const int n_segments = state->result_all.size() - n_segments_before;
                 if (ctx->params.dtw_token_timestamps && n_segments) {
                     const int n_frames = std::min(std::min(WHISPER_CHUNK_SIZE * 100, seek_delta), seek_end - seek);
+                    const int64_t t_start_dtw_us = ggml_time_us();
                     whisper_exp_compute_token_level_timestamps_dtw(
                             ctx, state, params, result_all.size() - n_segments, n_segments, seek, n_frames, 7, params.n_threads);
+                    state->t_dtw_us += ggml_time_us() - t_start_dtw_us;
                     if (params.new_segment_callback) {
                         for (int seg = (int) result_all.size() - n_segments; seg < n_segments; seg++) {
                             params.new_segment_callback(ctx, state, seg, params.new_segment_callback_user_data);
@@ -7863,6 +8665,10 @@ int whisper_full_parallel(
         params_cur.progress_callback = nullptr;
         params_cur.progress_callback_user_data = nullptr;
 
+        // the draft state cannot be shared between threads
+        params_cur.speculative.ctx   = nullptr;
+        params_cur.speculative.state = nullptr;
+
         workers[i] = std::thread(whisper_full_with_state, ctx, states[i], std::move(params_cur), samples + start_samples, n_samples_cur);
     }
 
@@ -7911,6 +8717,9 @@ int whisper_full_parallel(
         ctx->state->t_decode_us += states[i]->t_decode_us;
         ctx->state->t_batchd_us += states[i]->t_batchd_us;
         ctx->state->t_prompt_us += states[i]->t_prompt_us;
+        ctx->state->t_conv_us   += states[i]->t_conv_us;
+        ctx->state->t_cross_us  += states[i]->t_cross_us;
+        ctx->state->t_dtw_us    += states[i]->t_dtw_us;
 
         ctx->state->n_sample += states[i]->n_sample;
         ctx->state->n_encode += states[i]->n_encode;
@@ -7918,6 +8727,9 @@ int whisper_full_parallel(
         ctx->state->n_batchd += states[i]->n_batchd;
         ctx->state->n_prompt += states[i]->n_prompt;
 
+        ctx->state->n_fail_p += states[i]->n_fail_p;
+        ctx->state->n_fail_h += states[i]->n_fail_h;
+
         whisper_free_state(states[i]);
     }
 
@@ -8197,6 +9009,463 @@ float whisper_full_get_segment_no_speech_prob_from_state(struct whisper_state *
 
 // =================================================================================================
 
+//
+// [EXPERIMENTAL] Streaming transcription
+//
+
+struct whisper_stream_token {
+    whisper_token id;
+
+    int64_t t0; // centiseconds from the start of the stream
+    int64_t t1;
+};
+
+struct whisper_stream {
+    whisper_context * ctx   = nullptr;
+    whisper_state   * state = nullptr;
+
+    bool own_state = false;
+
+    whisper_full_params   params;
+    whisper_stream_params sparams;
+
+    // audio from sample pcm_offset to the end of the stream
+    // n_fft/2 samples before the start of the buffer are kept as context for the first mel frames
+    std::vector<float> pcm;
+
+    int64_t pcm_offset = 0;
+    int64_t n_total    = 0; // samples pushed since the start of the stream
+    int64_t n_decoded  = 0; // n_total at the last decode
+
+    // start of the decoded buffer - always a multiple of the hop length, so that the mel frames of the
+    // buffer stay aligned with the cached frames
+    int64_t buf_start = 0;
+
+    // raw log mel of the frames whose window is fully covered by audio, frame major
+    // these do not change when audio is appended, so only the frames at the end are computed at each step
+    std::vector<float> mel_frames;
+
+    int64_t mel_f0 = 0; // index of the first cached frame
+
+    std::vector<float> fft_in;
+    std::vector<float> fft_out;
+    std::vector<float> frame;
+
+    std::vector<whisper_stream_token> committed;
+
+    int64_t t_committed = 0; // end of the last committed token
+    int     n_out       = 0; // number of committed tokens whose audio is no longer in the buffer
+
+    // uncommitted tails of the latest hypotheses, oldest first
+    std::vector<std::vector<whisper_stream_token>> hyps;
+
+    // segment ends of the latest hypothesis
+    std::vector<int64_t> seg_ends;
+
+    std::vector<whisper_token> prompt;
+
+    std::string text;
+    std::string text_unstable;
+};
+
+struct whisper_stream_params whisper_stream_default_params(void) {
+    whisper_stream_params result = {
+        /*.step_ms                   =*/ 1000,
+        /*.trim_ms                   =*/ 15000,
+        /*.max_buffer_ms             =*/ 25000,
+        /*.n_agree                   =*/ 2,
+        /*.commit_callback           =*/ nullptr,
+        /*.commit_callback_user_data =*/ nullptr,
+    };
+    return result;
+}
+
+struct whisper_stream * whisper_stream_init_with_state(
+        struct whisper_context * ctx,
+        struct whisper_state * state,
+        struct whisper_full_params params,
+        struct whisper_stream_params sparams) {
+    whisper_stream * stream = new whisper_stream;
+
+    stream->ctx   = ctx;
+    stream->state = state;
+
+    // the stream manages the context and the timestamps itself
+    params.no_context       = true;
+    params.single_segment   = false;
+    params.token_timestamps = true;
+    params.offset_ms        = 0;
+    params.duration_ms      = 0;
+    params.print_progress   = false;
+    params.print_realtime   = false;
+    params.vad              = false;
+
+    params.new_segment_callback = nullptr;
+    params.progress_callback    = nullptr;
+
+    sparams.step_ms = std::max(sparams.step_ms, 100);
+    sparams.n_agree = std::max(sparams.n_agree, 1);
+
+    stream->params  = params;
+    stream->sparams = sparams;
+
+    stream->fft_in.resize(WHISPER_N_FFT * 2, 0.0f);
+    stream->fft_out.resize(WHISPER_N_FFT * 2 * 2 * 2);
+    stream->frame.resize(WHISPER_N_FFT);
+
+    return stream;
+}
+
+struct whisper_stream * whisper_stream_init(
+        struct whisper_context * ctx,
+        struct whisper_full_params params,
+        struct whisper_stream_params sparams) {
+    whisper_state * state = whisper_init_state(ctx);
+    if (state == nullptr) {
+        WHISPER_LOG_ERROR("%s: failed to initialize the state\n", __func__);
+        return nullptr;
+    }
+
+    whisper_stream * stream = whisper_stream_init_with_state(ctx, state, params, sparams);
+    stream->own_state = true;
+
+    return stream;
+}
+
+void whisper_stream_free(struct whisper_stream * stream) {
+    if (stream) {
+        if (stream->own_state) {
+            whisper_free_state(stream->state);
+        }
+        delete stream;
+    }
+}
+
+// raw log mel of the frame centered at sample f*hop, with the reflective padding of log_mel_spectrogram()
+// at the start of the stream and zeros after the end of the audio
+static void whisper_stream_mel_frame(whisper_stream & stream, int64_t f, float * out, int stride) {
+    const auto & filters = stream.ctx->model.filters;
+
+    const int64_t s0 = f*WHISPER_HOP_LENGTH - WHISPER_N_FFT/2;
+
+    for (int j = 0; j < WHISPER_N_FFT; ++j) {
+        const int64_t s = s0 + j;
+
+        float v = 0.0f;
+        if (s < 0) {
+            if (-s < stream.n_total) {
+                v = stream.pcm[-s - stream.pcm_offset];
+            }
+        } else if (s < stream.n_total) {
+            v = stream.pcm[s - stream.pcm_offset];
+        }
+
+        stream.frame[j] = v;
+    }
+
+    log_mel_spectrogram_frame(global_cache.hann_window, stream.frame.data(), WHISPER_N_FFT, WHISPER_N_FFT,
+                              filters, filters.n_mel, stream.fft_in, stream.fft_out, out, stride);
+}
+
+// build the normalized log mel of the buffer in the state - same layout and padding as log_mel_spectrogram()
+static void whisper_stream_mel(whisper_stream & stream) {
+    const int64_t t_start_us = ggml_time_us();
+
+    const int n_mel = stream.ctx->model.filters.n_mel;
+
+    // cache the frames that are fully covered by audio
+    {
+        int64_t f = stream.mel_f0 + (int64_t) stream.mel_frames.size()/n_mel;
+
+        while (f*WHISPER_HOP_LENGTH + WHISPER_N_FFT/2 < stream.n_total) {
+            stream.mel_frames.resize(stream.mel_frames.size() + n_mel);
+            whisper_stream_mel_frame(stream, f, stream.mel_frames.data() + stream.mel_frames.size() - n_mel, 1);
+            f++;
+        }
+    }
+
+    const int64_t n  = stream.n_total - stream.buf_start;
+    const int64_t f0 = stream.buf_start/WHISPER_HOP_LENGTH;
+
+    const int64_t n_cached = stream.mel_f0 + (int64_t) stream.mel_frames.size()/n_mel - f0;
+
+    auto & mel = stream.state->mel;
+
+    mel.n_mel     = n_mel;
+    mel.n_len     = (n + WHISPER_SAMPLE_RATE*WHISPER_CHUNK_SIZE)/WHISPER_HOP_LENGTH;
+    mel.n_len_org = 1 + (n + WHISPER_N_FFT/2 - WHISPER_N_FFT)/WHISPER_HOP_LENGTH;
+    mel.data.resize(mel.n_mel*mel.n_len);
+
+    const int n_frames = std::min<int64_t>((n + WHISPER_N_FFT/2)/WHISPER_HOP_LENGTH + 1, mel.n_len);
+
+    for (int i = 0; i < mel.n_len; ++i) {
+        if (i < n_cached) {
+            const float * src = stream.mel_frames.data() + (f0 + i - stream.mel_f0)*n_mel;
+            for (int j = 0; j < n_mel; ++j) {
+                mel.data[j*mel.n_len + i] = src[j];
+            }
+        } else if (i < n_frames) {
+            whisper_stream_mel_frame(stream, f0 + i, mel.data.data() + i, mel.n_len);
+        } else {
+            for (int j = 0; j < n_mel; ++j) {
+                mel.data[j*mel.n_len + i] = -10.0f;
+            }
+        }
+    }
+
+    // clamping and normalization
+    double mmax = -1e20;
+    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+        if (mel.data[i] > mmax) {
+            mmax = mel.data[i];
+        }
+    }
+
+    mmax -= 8.0;
+
+    for (int i = 0; i < mel.n_mel*mel.n_len; i++) {
+        if (mel.data[i] < mmax) {
+            mel.data[i] = mmax;
+        }
+
+        mel.data[i] = (mel.data[i] + 4.0)/4.0;
+    }
+
+    stream.state->t_mel_us += ggml_time_us() - t_start_us;
+}
+
+// drop the audio before t (centiseconds) from the buffer
+static void whisper_stream_trim(whisper_stream & stream, int64_t t) {
+    const int n_mel = stream.ctx->model.filters.n_mel;
+
+    t = std::min(t, stream.n_total/WHISPER_HOP_LENGTH);
+    if (t*WHISPER_HOP_LENGTH <= stream.buf_start) {
+        return;
+    }
+
+    stream.buf_start = t*WHISPER_HOP_LENGTH;
+
+    const int64_t pcm_offset = std::max<int64_t>(0, stream.buf_start - WHISPER_N_FFT/2);
+    if (pcm_offset > stream.pcm_offset) {
+        stream.pcm.erase(stream.pcm.begin(), stream.pcm.begin() + (pcm_offset - stream.pcm_offset));
+        stream.pcm_offset = pcm_offset;
+    }
+
+    const int64_t n_drop = t - stream.mel_f0;
+    if (n_drop >= (int64_t) stream.mel_frames.size()/n_mel) {
+        stream.mel_frames.clear();
+        stream.mel_f0 = t;
+    } else if (n_drop > 0) {
+        stream.mel_frames.erase(stream.mel_frames.begin(), stream.mel_frames.begin() + n_drop*n_mel);
+        stream.mel_f0 = t;
+    }
+
+    while (stream.n_out < (int) stream.committed.size() && stream.committed[stream.n_out].t1 <= t) {
+        stream.n_out++;
+    }
+}
+
+static int whisper_stream_commit(whisper_stream & stream, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+
+    auto & hyp = stream.hyps.back();
+
+    std::string text;
+    for (int i = 0; i < n; ++i) {
+        text += whisper_token_to_str(stream.ctx, hyp[i].id);
+        stream.committed.push_back(hyp[i]);
+    }
+
+    const int64_t t0 = hyp[0].t0;
+    const int64_t t1 = hyp[n - 1].t1;
+
+    stream.t_committed = std::max(stream.t_committed, t1);
+    stream.text += text;
+
+    // the hypotheses agree on the committed tokens
+    for (auto & h : stream.hyps) {
+        h.erase(h.begin(), h.begin() + std::min<size_t>(n, h.size()));
+    }
+
+    if (stream.sparams.commit_callback) {
+        stream.sparams.commit_callback(stream.ctx, &stream, text.c_str(), t0, t1, stream.sparams.commit_callback_user_data);
+    }
+
+    return n;
+}
+
+// decode the buffer and commit the prefix on which the latest n_agree hypotheses agree
+static int whisper_stream_decode(whisper_stream & stream, bool final) {
+    whisper_context * ctx   = stream.ctx;
+    whisper_state   * state = stream.state;
+
+    stream.n_decoded = stream.n_total;
+
+    const int64_t n = stream.n_total - stream.buf_start;
+    const int64_t t_start = stream.buf_start/WHISPER_HOP_LENGTH;
+
+    // whisper_full() skips anything shorter than 100 ms
+    const bool decode = n >= WHISPER_SAMPLE_RATE/10;
+    if (!decode && !final) {
+        return 0;
+    }
+
+    if (decode) {
+        std::vector<whisper_stream_token> hyp;
+
+        stream.seg_ends.clear();
+
+        whisper_stream_mel(stream);
+
+        // the state has no samples to compute the energy from
+        state->energy = get_signal_energy(stream.pcm.data() + (stream.buf_start - stream.pcm_offset), n, 32);
+
+        // the committed tokens whose audio has been dropped are used as prompt
+        const int n_prompt_max = whisper_n_text_ctx(ctx)/2;
+
+        stream.prompt.clear();
+        for (int i = std::max(0, stream.n_out - n_prompt_max); i < stream.n_out; ++i) {
+            stream.prompt.push_back(stream.committed[i].id);
+        }
+
+        whisper_full_params params = stream.params;
+        if (!stream.prompt.empty()) {
+            params.prompt_tokens   = stream.prompt.data();
+            params.prompt_n_tokens = stream.prompt.size();
+        }
+
+        const int ret = whisper_full_with_state(ctx, state, params, nullptr, 0);
+        if (ret != 0) {
+            WHISPER_LOG_ERROR("%s: failed to decode the stream buffer (%d)\n", __func__, ret);
+            return -1;
+        }
+
+        for (const auto & segment : state->result_all) {
+            for (const auto & token : segment.tokens) {
+                if (token.id >= whisper_token_eot(ctx)) {
+                    continue;
+                }
+
+                // skip the tokens that were already committed - a little slack for the timestamp jitter
+                if (token.t0 + t_start <= stream.t_committed - 10) {
+                    continue;
+                }
+
+                hyp.push_back({ token.id, token.t0 + t_start, token.t1 + t_start });
+            }
+
+            stream.seg_ends.push_back(segment.t1 + t_start);
+        }
+
+        // the first tokens may repeat the end of the committed text - drop the longest such n-gram
+        if (!hyp.empty() && !stream.committed.empty() && hyp[0].t0 - stream.t_committed < 100) {
+            const int n_max = std::min<int>({ 5, (int) hyp.size(), (int) stream.committed.size() });
+
+            for (int k = n_max; k >= 1; --k) {
+                bool match = true;
+                for (int i = 0; i < k && match; ++i) {
+                    match = stream.committed[stream.committed.size() - k + i].id == hyp[i].id;
+                }
+
+                if (match) {
+                    hyp.erase(hyp.begin(), hyp.begin() + k);
+                    break;
+                }
+            }
+        }
+
+        stream.hyps.push_back(std::move(hyp));
+        if ((int) stream.hyps.size() > stream.sparams.n_agree) {
+            stream.hyps.erase(stream.hyps.begin());
+        }
+    }
+
+    int n_commit = 0;
+
+    if (final) {
+        // commit everything that is left
+        n_commit = stream.hyps.empty() ? 0 : stream.hyps.back().size();
+    } else if ((int) stream.hyps.size() == stream.sparams.n_agree) {
+        // longest common prefix of the latest hypotheses
+        const auto & cur = stream.hyps.back();
+
+        n_commit = cur.size();
+        for (const auto & h : stream.hyps) {
+            int k = 0;
+            while (k < n_commit && k < (int) h.size() && h[k].id == cur[k].id) {
+                k++;
+            }
+            n_commit = k;
+        }
+    }
+
+    int n_new = whisper_stream_commit(stream, n_commit);
+
+    const int64_t t_end   = stream.n_total/WHISPER_HOP_LENGTH;
+    const int64_t t_begin = stream.buf_start/WHISPER_HOP_LENGTH;
+
+    if (final) {
+        whisper_stream_trim(stream, t_end);
+        stream.hyps.clear();
+    } else {
+        if (t_end - t_begin > stream.sparams.trim_ms/10) {
+            // cut at the end of the latest segment that is fully committed - the last segment is still open
+            for (int i = (int) stream.seg_ends.size() - 2; i >= 0; --i) {
+                if (stream.seg_ends[i] <= stream.t_committed) {
+                    whisper_stream_trim(stream, stream.seg_ends[i]);
+                    break;
+                }
+            }
+        }
+
+        if (t_end - stream.buf_start/WHISPER_HOP_LENGTH > stream.sparams.max_buffer_ms/10) {
+            // the hypotheses do not settle - commit the latest one instead of growing the buffer further
+            n_new += whisper_stream_commit(stream, stream.hyps.empty() ? 0 : stream.hyps.back().size());
+
+            whisper_stream_trim(stream, std::max(stream.t_committed, t_end - 100));
+            stream.hyps.clear();
+        }
+    }
+
+    stream.text_unstable.clear();
+    if (!stream.hyps.empty()) {
+        for (const auto & token : stream.hyps.back()) {
+            stream.text_unstable += whisper_token_to_str(ctx, token.id);
+        }
+    }
+
+    return n_new;
+}
+
+int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples) {
+    if (n_samples > 0) {
+        stream->pcm.insert(stream->pcm.end(), samples, samples + n_samples);
+        stream->n_total += n_samples;
+    }
+
+    if (stream->n_total - stream->n_decoded < (int64_t) stream->sparams.step_ms*WHISPER_SAMPLE_RATE/1000) {
+        return 0;
+    }
+
+    return whisper_stream_decode(*stream, false);
+}
+
+int whisper_stream_flush(struct whisper_stream * stream) {
+    return whisper_stream_decode(*stream, true);
+}
+
+const char * whisper_stream_get_text(struct whisper_stream * stream) {
+    return stream->text.c_str();
+}
+
+const char * whisper_stream_get_unstable_text(struct whisper_stream * stream) {
+    return stream->text_unstable.c_str();
+}
+
+// =================================================================================================
+
 //
 // Temporary interface needed for exposing ggml interface
 // Will be removed in the future when ggml becomes a separate library
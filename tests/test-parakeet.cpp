@@ -98,6 +98,7 @@ static int test_valid_model() {
     params.new_token_callback_user_data = nullptr;
     params.new_segment_callback = segment_callback;
     params.new_segment_callback_user_data = nullptr;
+    params.token_probs = true;
     parakeet_state * state = parakeet_init_state(pctx);
 
     int ret = parakeet_chunk(pctx, state, params, pcmf32.data(), pcmf32.size());
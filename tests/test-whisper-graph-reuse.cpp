@@ -0,0 +1,236 @@
+// Checks that replaying the cached decoder graph (decode_graph_reuse) produces the same logits as rebuilding
+// the graph on every decode step.
+//
+// The test models in the repo hold only the vocabulary, so random weights are appended to build a real model
+// in memory. The decode sequence crosses the KV padding, changes the batch size and rewinds the KV cache, so
+// both the replay and the rebuild path are taken.
+
+#include "whisper.h"
+#include "ggml.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+struct model_writer {
+    std::vector<uint8_t> data;
+    std::mt19937 rng { 42 };
+
+    template <typename T>
+    void write(const T & val) {
+        const uint8_t * p = (const uint8_t *) &val;
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+
+    void tensor(const std::string & name, const std::vector<int32_t> & ne, bool f16) {
+        std::normal_distribution<float> dist(0.0f, 0.05f);
+
+        write<int32_t>(ne.size());
+        write<int32_t>(name.size());
+        write<int32_t>(f16 ? 1 : 0);
+        for (const int32_t n : ne) {
+            write(n);
+        }
+        data.insert(data.end(), name.begin(), name.end());
+
+        int64_t n_elements = 1;
+        for (const int32_t n : ne) {
+            n_elements *= n;
+        }
+
+        for (int64_t i = 0; i < n_elements; ++i) {
+            if (f16) {
+                write(ggml_fp32_to_fp16(dist(rng)));
+            } else {
+                write(dist(rng));
+            }
+        }
+    }
+
+    void block(const std::string & prefix, int32_t n_state, bool cross, bool f16) {
+        tensor(prefix + "mlp_ln.weight",  { n_state },              false);
+        tensor(prefix + "mlp_ln.bias",    { n_state },              false);
+        tensor(prefix + "mlp.0.weight",   { n_state, 4*n_state },   f16);
+        tensor(prefix + "mlp.0.bias",     { 4*n_state },            false);
+        tensor(prefix + "mlp.2.weight",   { 4*n_state, n_state },   f16);
+        tensor(prefix + "mlp.2.bias",     { n_state },              false);
+
+        for (const char * attn : { "attn", "cross_attn" }) {
+            if (!cross && std::string(attn) == "cross_attn") {
+                continue;
+            }
+
+            const std::string p = prefix + attn;
+
+            tensor(p + "_ln.weight",    { n_state },          false);
+            tensor(p + "_ln.bias",      { n_state },          false);
+            tensor(p + ".query.weight", { n_state, n_state }, f16);
+            tensor(p + ".query.bias",   { n_state },          false);
+            tensor(p + ".key.weight",   { n_state, n_state }, f16);
+            tensor(p + ".value.weight", { n_state, n_state }, f16);
+            tensor(p + ".value.bias",   { n_state },          false);
+            tensor(p + ".out.weight",   { n_state, n_state }, f16);
+            tensor(p + ".out.bias",     { n_state },          false);
+        }
+    }
+};
+
+// append random weights to a model file that holds only the hyperparameters, the mel filters and the vocabulary
+static std::vector<uint8_t> make_random_model(const char * fname) {
+    std::ifstream fin(fname, std::ios::binary);
+    assert(fin.is_open());
+
+    model_writer w;
+    w.data.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+    int32_t hp[12];
+    memcpy(hp, w.data.data(), sizeof(hp));
+
+    const int32_t n_vocab       = hp[1];
+    const int32_t n_audio_ctx   = hp[2];
+    const int32_t n_audio_state = hp[3];
+    const int32_t n_audio_layer = hp[5];
+    const int32_t n_text_ctx    = hp[6];
+    const int32_t n_text_state  = hp[7];
+    const int32_t n_text_layer  = hp[9];
+    const int32_t n_mels        = hp[10];
+    const bool    f16           = hp[11] % 1000 == 1;
+
+    const int32_t A = n_audio_state;
+    const int32_t T = n_text_state;
+
+    w.tensor("encoder.positional_embedding", { A, n_audio_ctx }, false);
+    w.tensor("encoder.conv1.weight", { 3, n_mels, A }, f16);
+    w.tensor("encoder.conv1.bias",   { 1, A },         false);
+    w.tensor("encoder.conv2.weight", { 3, A, A },      f16);
+    w.tensor("encoder.conv2.bias",   { 1, A },         false);
+    w.tensor("encoder.ln_post.weight", { A }, false);
+    w.tensor("encoder.ln_post.bias",   { A }, false);
+
+    for (int i = 0; i < n_audio_layer; ++i) {
+        w.block("encoder.blocks." + std::to_string(i) + ".", A, false, f16);
+    }
+
+    w.tensor("decoder.positional_embedding",   { T, n_text_ctx }, false);
+    w.tensor("decoder.token_embedding.weight", { T, n_vocab },    f16);
+    w.tensor("decoder.ln.weight", { T }, false);
+    w.tensor("decoder.ln.bias",   { T }, false);
+
+    for (int i = 0; i < n_text_layer; ++i) {
+        w.block("decoder.blocks." + std::to_string(i) + ".", T, true, f16);
+    }
+
+    return w.data;
+}
+
+static whisper_context * init_context(std::vector<uint8_t> & model, bool flash_attn, bool graph_reuse) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu            = false;
+    cparams.flash_attn         = flash_attn;
+    cparams.decode_graph_reuse = graph_reuse;
+
+    whisper_context * ctx = whisper_init_from_buffer_with_params(model.data(), model.size(), cparams);
+    assert(ctx != nullptr);
+
+    // a deterministic input - the equivalence does not depend on the audio
+    std::vector<float> pcmf32(2*WHISPER_SAMPLE_RATE);
+    for (size_t i = 0; i < pcmf32.size(); ++i) {
+        pcmf32[i] = 0.1f*sinf(2.0f*M_PI*440.0f*i/WHISPER_SAMPLE_RATE);
+    }
+
+    assert(whisper_pcm_to_mel(ctx, pcmf32.data(), pcmf32.size(), 2) == 0);
+    assert(whisper_encode(ctx, 0, 2) == 0);
+
+    return ctx;
+}
+
+static whisper_token argmax(const float * logits, int n_vocab) {
+    whisper_token best = 0;
+    for (int i = 1; i < n_vocab; ++i) {
+        if (logits[i] > logits[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// decode the same tokens with both contexts and compare the logits of the last token of every step
+static void test_equivalence(std::vector<uint8_t> & model, bool flash_attn) {
+    whisper_context * ctx_rebuild = init_context(model, flash_attn, false);
+    whisper_context * ctx_reuse   = init_context(model, flash_attn, true);
+
+    const int n_vocab = whisper_n_vocab(ctx_rebuild);
+
+    float max_diff = 0.0f;
+
+    auto step = [&](const std::vector<whisper_token> & tokens, int n_past) {
+        assert(whisper_decode(ctx_rebuild, tokens.data(), tokens.size(), n_past, 2) == 0);
+        assert(whisper_decode(ctx_reuse,   tokens.data(), tokens.size(), n_past, 2) == 0);
+
+        const float * logits_rebuild = whisper_get_logits(ctx_rebuild) + (tokens.size() - 1)*n_vocab;
+        const float * logits_reuse   = whisper_get_logits(ctx_reuse)   + (tokens.size() - 1)*n_vocab;
+
+        for (int i = 0; i < n_vocab; ++i) {
+            max_diff = std::max(max_diff, fabsf(logits_rebuild[i] - logits_reuse[i]));
+        }
+
+        return argmax(logits_rebuild, n_vocab);
+    };
+
+    const whisper_token sot = whisper_token_sot(ctx_rebuild);
+    const whisper_token not_ = whisper_token_not(ctx_rebuild);
+
+    std::vector<whisper_token> tokens = { sot, not_ };
+    int n_past = 0;
+
+    // the prompt, then single tokens past the KV padding
+    whisper_token next = step(tokens, n_past);
+    n_past += tokens.size();
+
+    for (int i = 0; i < 40; ++i) {
+        next = step({ next }, n_past++);
+    }
+
+    // a batch changes the graph shape, the following single tokens go back to the cached shape
+    next = step({ next, 100, 200, 300 }, n_past);
+    n_past += 4;
+
+    for (int i = 0; i < 8; ++i) {
+        next = step({ next }, n_past++);
+    }
+
+    // rewind the KV cache - the new tokens are written at a lower KV head
+    n_past -= 20;
+    for (int i = 0; i < 30; ++i) {
+        next = step({ (whisper_token) (1000 + i) }, n_past++);
+    }
+
+    printf("%s: flash_attn = %d, max |logits(rebuild) - logits(reuse)| = %g\n", __func__, flash_attn, max_diff);
+
+    assert(max_diff <= 1e-5f);
+
+    whisper_free(ctx_reuse);
+    whisper_free(ctx_rebuild);
+}
+
+int main() {
+    std::vector<uint8_t> model = make_random_model(WHISPER_MODEL_PATH);
+
+    test_equivalence(model, false); // transposed V cache
+    test_equivalence(model, true);
+
+    return 0;
+}